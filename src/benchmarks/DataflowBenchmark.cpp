@@ -0,0 +1,132 @@
+//
+// Created on 2026/10/19.
+//
+
+// Times building the control flow graph, dominators, liveness and reaching definitions of generated procedures
+// with thousands of blocks. Usage: dataflow_benchmark [blocks...], each the number of labels to generate
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include "../compiler/ControlFlowGraph.h"
+#include "../compiler/Dataflow.h"
+
+static const Register allocatable[] = {RAX, RBX, RCX, RDX, R8, R9, R10, R11, RSI, RDI, R12, R13, R14, R15};
+
+static Instruction instruction(const std::string& mnemonic, const std::vector<Operand>& operands) {
+  Instruction made;
+  made.mnemonic = mnemonic;
+  made.operands = operands;
+  return made;
+}
+
+// Structured like the generator's output: runs of register moves and arithmetic, ifs that branch forwards over
+// their arm, and loops that branch back to their head, nested a few deep
+class ProcedureGenerator {
+  std::vector<Instruction> code;
+  unsigned long long state;
+  size_t labels = 0;
+
+public:
+  explicit ProcedureGenerator(unsigned int seed)
+      : state(seed) {
+  }
+
+  std::vector<Instruction> generate(size_t blocks) {
+    code.clear();
+    while (labels < blocks) {
+      emitStatements(blocks, 4);
+    }
+    code.push_back(instruction("ret", {}));
+    return code;
+  }
+
+private:
+  size_t random(size_t bound) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (size_t) ((state >> 33) % bound);
+  }
+
+  Register anyRegister() {
+    return allocatable[random(TOTAL_REGISTERS)];
+  }
+
+  std::string newLabel() {
+    return "_b" + std::to_string(labels++);
+  }
+
+  // Each statement starts at least one block, and nothing more is started once `blocks` have been
+  void emitStatements(size_t blocks, unsigned int depth) {
+    size_t count = 1 + random(6);
+    for (size_t statement = 0; statement < count && labels < blocks; ++statement) {
+      size_t kind = depth == 0 ? 0 : random(3);
+      if (kind == 0) {
+        code.push_back(Instruction::label(newLabel()));
+        code.push_back(instruction("mov", {anyRegister(), anyRegister()}));
+        code.push_back(instruction("add", {anyRegister(), (long long) random(100)}));
+      } else if (kind == 1) {
+        std::string end = newLabel();
+        code.push_back(instruction("cmp", {anyRegister(), anyRegister()}));
+        code.push_back(instruction("jl", {Operand::symbolic(end)}));
+        emitStatements(blocks, depth - 1);
+        code.push_back(Instruction::label(end));
+      } else {
+        std::string head = newLabel();
+        code.push_back(Instruction::label(head));
+        emitStatements(blocks, depth - 1);
+        code.push_back(instruction("cmp", {anyRegister(), anyRegister()}));
+        code.push_back(instruction("jl", {Operand::symbolic(head)}));
+      }
+    }
+  }
+};
+
+static double millisecondsFor(const std::function<void()>& run) {
+  auto start = std::chrono::steady_clock::now();
+  run();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char* argv[]) {
+  std::vector<size_t> sizes = {1000, 2000, 5000};
+  if (argc > 1) {
+    sizes.clear();
+    for (int i = 1; i < argc; ++i) {
+      sizes.push_back(strtoul(argv[i], nullptr, 10));
+    }
+  }
+
+  for (auto size : sizes) {
+    std::vector<Instruction> code = ProcedureGenerator(42).generate(size);
+
+    ControlFlowGraph* graph = nullptr;
+    double graphTime = millisecondsFor([&]() {
+      graph = new ControlFlowGraph(code);
+    });
+    double dominatorTime = millisecondsFor([&]() {
+      DominatorTree dominators(*graph);
+    });
+    unsigned int livenessVisits = 0;
+    double livenessTime = millisecondsFor([&]() {
+      Liveness liveness(*graph, code);
+      livenessVisits = liveness.getResult().visits;
+    });
+    unsigned int reachingVisits = 0;
+    size_t definitions = 0;
+    double reachingTime = millisecondsFor([&]() {
+      ReachingDefinitions reachingDefinitions(*graph, code);
+      reachingVisits = reachingDefinitions.getResult().visits;
+      definitions = reachingDefinitions.getDefinitions().size();
+    });
+
+    std::cout << graph->getBlocks().size() << " blocks: graph " << graphTime << " ms, dominators " << dominatorTime
+              << " ms, liveness " << livenessTime << " ms (" << livenessVisits << " visits), reaching definitions "
+              << reachingTime << " ms (" << definitions << " definitions, " << reachingVisits << " visits)"
+              << std::endl;
+    delete graph;
+  }
+
+  return 0;
+}
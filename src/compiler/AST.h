@@ -11,7 +11,12 @@
 
 struct Location {
   unsigned int id;
-  bool isParameter = false;
+  bool isPromoted = false; // A local or parameter kept in a register for its whole scope
+
+  // Pinned locations keep their register until their procedure ends
+  bool isPinned() const {
+    return isPromoted;
+  }
 
   Location() : id(idCount++) {}
 
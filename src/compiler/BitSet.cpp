@@ -0,0 +1,70 @@
+//
+// Created on 2026/10/19.
+//
+
+#include "BitSet.h"
+
+BitSet::BitSet(size_t size, bool value)
+    : bits(size), words((size + 63) / 64, value ? ~0ULL : 0ULL) {
+  clearTail();
+}
+
+void BitSet::setAll() {
+  for (auto& word : words) {
+    word = ~0ULL;
+  }
+  clearTail();
+}
+
+void BitSet::resetAll() {
+  for (auto& word : words) {
+    word = 0;
+  }
+}
+
+bool BitSet::unionWith(const BitSet& other) {
+  bool changed = false;
+  for (size_t i = 0; i < words.size(); ++i) {
+    uint64_t merged = words[i] | other.words[i];
+    changed |= merged != words[i];
+    words[i] = merged;
+  }
+  return changed;
+}
+
+bool BitSet::intersectWith(const BitSet& other) {
+  bool changed = false;
+  for (size_t i = 0; i < words.size(); ++i) {
+    uint64_t merged = words[i] & other.words[i];
+    changed |= merged != words[i];
+    words[i] = merged;
+  }
+  return changed;
+}
+
+void BitSet::subtract(const BitSet& other) {
+  for (size_t i = 0; i < words.size(); ++i) {
+    words[i] &= ~other.words[i];
+  }
+}
+
+size_t BitSet::count() const {
+  size_t total = 0;
+  for (auto word : words) {
+    total += __builtin_popcountll(word);
+  }
+  return total;
+}
+
+bool BitSet::any() const {
+  for (auto word : words) {
+    if (word) return true;
+  }
+  return false;
+}
+
+void BitSet::clearTail() {
+  if (bits % 64 && !words.empty()) {
+    words.back() &= (1ULL << (bits % 64)) - 1;
+  }
+}
@@ -0,0 +1,68 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_BITSET_H
+#define COMPILER_VISUALIZATION_BITSET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Fixed size dense set of small integers, one bit each, for the dataflow sets
+class BitSet {
+  size_t bits = 0;
+  std::vector<uint64_t> words;
+
+public:
+  BitSet() = default;
+  explicit BitSet(size_t size, bool value = false);
+
+  size_t size() const {
+    return bits;
+  }
+  bool test(size_t i) const {
+    return (words[i / 64] >> (i % 64)) & 1u;
+  }
+  void set(size_t i) {
+    words[i / 64] |= 1ULL << (i % 64);
+  }
+  void reset(size_t i) {
+    words[i / 64] &= ~(1ULL << (i % 64));
+  }
+  void setAll();
+  void resetAll();
+
+  // Each returns whether the set changed
+  bool unionWith(const BitSet& other);
+  bool intersectWith(const BitSet& other);
+  void subtract(const BitSet& other);
+
+  size_t count() const;
+  bool any() const;
+
+  // Calls `f` with each member, smallest first
+  template<typename F>
+  void forEach(F f) const {
+    for (size_t word = 0; word < words.size(); ++word) {
+      uint64_t remaining = words[word];
+      while (remaining) {
+        f(word * 64 + __builtin_ctzll(remaining));
+        remaining &= remaining - 1;
+      }
+    }
+  }
+
+  bool operator==(const BitSet& other) const {
+    return bits == other.bits && words == other.words;
+  }
+  bool operator!=(const BitSet& other) const {
+    return !(*this == other);
+  }
+
+private:
+  // Keeps the bits past the end clear, so whole word comparisons and counts stay correct
+  void clearTail();
+};
+
+#endif //COMPILER_VISUALIZATION_BITSET_H
@@ -0,0 +1,363 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <cstdint>
+#include "BranchFolder.h"
+#include "InstructionSelector.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cppcoreguidelines-pro-type-static-cast-downcast"
+
+// Whether the generator treats `value` as a 64 bit operand, rather than one a 32 bit divide can take
+static bool isWideValue(long long value) {
+  return value < INT32_MIN || value > INT32_MAX;
+}
+
+BranchFolder::BranchFolder(ASTBlock* root)
+    : root(root) {
+}
+
+void BranchFolder::run() {
+  foldBlock(root);
+}
+
+void BranchFolder::foldStatement(ASTStatement*& node, ASTBlock* parent) {
+  switch (node->type) {
+    case BLOCK:
+      foldBlock(static_cast<ASTBlock*>(node));
+      break;
+    case PROC_DECL: {
+      auto* procedure = static_cast<ASTProcedure*>(node);
+      if (procedure->isExternal || !procedure->block) break;
+
+      // Its variables are its own, so nothing known outside it holds
+      std::vector<Fact> outer;
+      outer.swap(facts);
+      foldBlock(procedure->block);
+      facts.swap(outer);
+      break;
+    }
+    case PROC_CALL:
+      for (auto& parameter : static_cast<ASTProcedureCall*>(node)->parameters) {
+        parameter = foldExpression(parameter);
+      }
+      break;
+    case VARIABLE_DECL: {
+      auto* declaration = static_cast<ASTVariableDeclaration*>(node);
+      if (declaration->initialValueExpression) {
+        declaration->initialValueExpression = foldExpression(declaration->initialValueExpression);
+      }
+      break;
+    }
+    case VARIABLE_ASSIGNMENT: {
+      auto* assignment = static_cast<ASTVariableAssignment*>(node);
+      assignment->newValueExpression = foldExpression(assignment->newValueExpression);
+      break;
+    }
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      ifNode->conditional = foldExpression(ifNode->conditional);
+
+      bool value;
+      if (decide(ifNode->conditional, value)) {
+        hits[ifNode->conditional->type == ASTType::LITERAL ? "constant-if" : "repeated-condition"]++;
+        node = replacement(node, value ? ifNode->trueStatement : ifNode->falseStatement, parent);
+        foldStatement(node, parent);
+        break;
+      }
+
+      foldArm(ifNode->trueStatement, ifNode->conditional, true, parent);
+      if (ifNode->falseStatement) {
+        foldArm(ifNode->falseStatement, ifNode->conditional, false, parent);
+      }
+      break;
+    }
+    case WHILE: {
+      auto* whileNode = static_cast<ASTWhile*>(node);
+      whileNode->conditional = foldExpression(whileNode->conditional);
+
+      // Only a literal holds on every iteration; what is known on entry may not be after the first
+      unsigned long long value;
+      if (InstructionSelector::isIntegerLiteral(whileNode->conditional, value) && value == 0) {
+        hits["constant-loop"]++;
+        node = replacement(node, nullptr, parent);
+        break;
+      }
+
+      foldBlock(whileNode->body);
+      break;
+    }
+    case RETURN: {
+      auto* returnNode = static_cast<ASTReturn*>(node);
+      if (returnNode->expression) {
+        returnNode->expression = foldExpression(returnNode->expression);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void BranchFolder::foldBlock(ASTBlock* block) {
+  auto& statements = block->statements;
+  for (size_t i = 0; i < statements.size(); ++i) {
+    foldStatement(statements[i], block);
+    if (!endsInJump(statements[i])) continue;
+
+    // Procedures declared after it can still be called, so only they stay
+    for (size_t j = i + 1; j < statements.size();) {
+      if (statements[j]->type == ASTType::PROC_DECL) {
+        ++j;
+        continue;
+      }
+      statements.erase(statements.begin() + (long) j);
+      hits["unreachable-statement"]++;
+    }
+  }
+}
+
+void BranchFolder::foldArm(ASTStatement*& arm, ASTExpression* condition, bool value, ASTBlock* parent) {
+  std::set<std::string> variables;
+  collectVariables(condition, variables);
+
+  // The condition can only change if the arm assigns something it reads
+  bool holds = !assignsAny(arm, variables);
+  if (holds) {
+    facts.push_back({condition, value});
+  }
+  foldStatement(arm, parent);
+  if (holds) {
+    facts.pop_back();
+  }
+}
+
+ASTExpression* BranchFolder::foldExpression(ASTExpression* node) {
+  unsigned long long left, right;
+  long long result;
+  if (node->type == ASTType::BIN_OP) {
+    auto* binOp = static_cast<ASTBinOp*>(node);
+    binOp->left = foldExpression(binOp->left);
+    binOp->right = foldExpression(binOp->right);
+    if (InstructionSelector::isIntegerLiteral(binOp->left, left)
+        && InstructionSelector::isIntegerLiteral(binOp->right, right)
+        && evaluate(binOp->op, (long long) left, (long long) right, result)) {
+      hits["constant-expression"]++;
+      return literal(node, result);
+    }
+  } else if (node->type == ASTType::UNARY_OP) {
+    auto* unaryOp = static_cast<ASTUnaryOp*>(node);
+    unaryOp->child = foldExpression(unaryOp->child);
+    if (!InstructionSelector::isIntegerLiteral(unaryOp->child, right)) return node;
+
+    bool isFolded = false;
+    switch (unaryOp->op) {
+      case ExpressionOperatorType::ADD:
+        result = (long long) right;
+        isFolded = true;
+        break;
+      case ExpressionOperatorType::MINUS:
+        isFolded = evaluate(ExpressionOperatorType::MINUS, 0, (long long) right, result);
+        break;
+      case ExpressionOperatorType::LOGICAL_NOT:
+        result = right == 0;
+        isFolded = true;
+        break;
+      default:
+        break;
+    }
+    if (isFolded) {
+      hits["constant-expression"]++;
+      return literal(node, result);
+    }
+  }
+  return node;
+}
+
+bool BranchFolder::decide(ASTExpression* condition, bool& value) const {
+  unsigned long long constant;
+  if (InstructionSelector::isIntegerLiteral(condition, constant)) {
+    value = constant != 0;
+    return true;
+  }
+
+  for (auto fact = facts.rbegin(); fact != facts.rend(); ++fact) {
+    if (isSame(fact->condition, condition)) {
+      value = fact->value;
+      return true;
+    }
+  }
+  return false;
+}
+
+ASTStatement* BranchFolder::replacement(ASTStatement* node, ASTStatement* with, ASTBlock* parent) {
+  if (with && with->type == ASTType::BLOCK) {
+    static_cast<ASTBlock*>(with)->parent = parent;
+    return with;
+  }
+
+  auto* block = new ASTBlock();
+  block->nodeId = node->nodeId;
+  block->parent = parent;
+  if (with) {
+    block->statements.push_back(with);
+  }
+  return block;
+}
+
+ASTLiteral* BranchFolder::literal(ASTExpression* node, unsigned long long value) {
+  auto* literal = new ASTLiteral();
+  literal->nodeId = node->nodeId;
+  literal->valueType = ASTLiteral::ValueType::INTEGER;
+  literal->value.integerData = value;
+  return literal;
+}
+
+// Arithmetic is done in 64 bit registers, and wraps the same way here. Only division has a 32 bit form, taken
+// when neither side is wide, so a result that would make a parent divide wide when its operands didn't is left alone.
+bool BranchFolder::evaluate(ExpressionOperatorType op, long long left, long long right, long long& result) {
+  bool isWide = isWideValue(left) || isWideValue(right);
+  auto wrap = [](unsigned long long value) {
+    return (long long) value;
+  };
+
+  switch (op) {
+    case ExpressionOperatorType::ADD:
+      result = wrap((unsigned long long) left + (unsigned long long) right);
+      break;
+    case ExpressionOperatorType::MINUS:
+      result = wrap((unsigned long long) left - (unsigned long long) right);
+      break;
+    case ExpressionOperatorType::MULTIPLY:
+      result = wrap((unsigned long long) left * (unsigned long long) right);
+      break;
+    case ExpressionOperatorType::DIVIDE:
+      // Left to fault at run time
+      if (right == 0) return false;
+      if (right == -1 && left == (isWide ? INT64_MIN : INT32_MIN)) return false;
+      result = left / right;
+      break;
+    case ExpressionOperatorType::EQUALS:
+      result = left == right;
+      break;
+    case ExpressionOperatorType::NOT_EQUALS:
+      result = left != right;
+      break;
+    case ExpressionOperatorType::LESS_THAN:
+      result = left < right;
+      break;
+    case ExpressionOperatorType::LESS_THAN_OR_EQUAL:
+      result = left <= right;
+      break;
+    case ExpressionOperatorType::GREATER_THAN:
+      result = left > right;
+      break;
+    case ExpressionOperatorType::GREATER_THAN_OR_EQUAL:
+      result = left >= right;
+      break;
+    case ExpressionOperatorType::LOGICAL_AND:
+      result = left != 0 && right != 0;
+      break;
+    case ExpressionOperatorType::LOGICAL_OR:
+      result = left != 0 || right != 0;
+      break;
+    default:
+      return false;
+  }
+
+  // The generator picks a divide's width from the literals under it, so arithmetic keeps its operands' width:
+  // neither a narrow result of wide operands nor a wide result of narrow ones is folded. Comparisons are narrow
+  // whatever they compare
+  bool isArithmetic = op == ExpressionOperatorType::ADD || op == ExpressionOperatorType::MINUS
+      || op == ExpressionOperatorType::MULTIPLY || op == ExpressionOperatorType::DIVIDE;
+  return !isArithmetic || isWideValue(result) == isWide;
+}
+
+bool BranchFolder::isSame(ASTExpression* a, ASTExpression* b) {
+  if (a->type != b->type) return false;
+
+  switch (a->type) {
+    case ASTType::LITERAL: {
+      unsigned long long aValue, bValue;
+      return InstructionSelector::isIntegerLiteral(a, aValue) && InstructionSelector::isIntegerLiteral(b, bValue)
+          && aValue == bValue;
+    }
+    case ASTType::VARIABLE:
+      return static_cast<ASTVariableIdent*>(a)->ident == static_cast<ASTVariableIdent*>(b)->ident;
+    case ASTType::BIN_OP: {
+      auto* aBinOp = static_cast<ASTBinOp*>(a);
+      auto* bBinOp = static_cast<ASTBinOp*>(b);
+      return aBinOp->op == bBinOp->op && isSame(aBinOp->left, bBinOp->left) && isSame(aBinOp->right, bBinOp->right);
+    }
+    case ASTType::UNARY_OP: {
+      auto* aUnaryOp = static_cast<ASTUnaryOp*>(a);
+      auto* bUnaryOp = static_cast<ASTUnaryOp*>(b);
+      return aUnaryOp->op == bUnaryOp->op && isSame(aUnaryOp->child, bUnaryOp->child);
+    }
+    default:
+      return false;
+  }
+}
+
+bool BranchFolder::endsInJump(ASTStatement* node) {
+  switch (node->type) {
+    case BREAK:
+    case CONTINUE:
+    case RETURN:
+      return true;
+    case BLOCK: {
+      auto& statements = static_cast<ASTBlock*>(node)->statements;
+      return !statements.empty() && endsInJump(statements.back());
+    }
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      return ifNode->falseStatement && endsInJump(ifNode->trueStatement) && endsInJump(ifNode->falseStatement);
+    }
+    default:
+      return false;
+  }
+}
+
+void BranchFolder::collectVariables(ASTExpression* node, std::set<std::string>& variables) {
+  switch (node->type) {
+    case ASTType::VARIABLE:
+      variables.insert(static_cast<ASTVariableIdent*>(node)->ident);
+      break;
+    case ASTType::BIN_OP:
+      collectVariables(static_cast<ASTBinOp*>(node)->left, variables);
+      collectVariables(static_cast<ASTBinOp*>(node)->right, variables);
+      break;
+    case ASTType::UNARY_OP:
+      collectVariables(static_cast<ASTUnaryOp*>(node)->child, variables);
+      break;
+    default:
+      break;
+  }
+}
+
+bool BranchFolder::assignsAny(ASTStatement* node, const std::set<std::string>& variables) {
+  switch (node->type) {
+    case BLOCK:
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        if (assignsAny(statement, variables)) return true;
+      }
+      return false;
+    case VARIABLE_DECL:
+      return variables.count(static_cast<ASTVariableDeclaration*>(node)->ident) > 0;
+    case VARIABLE_ASSIGNMENT:
+      return variables.count(static_cast<ASTVariableAssignment*>(node)->ident) > 0;
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      return assignsAny(ifNode->trueStatement, variables)
+          || (ifNode->falseStatement && assignsAny(ifNode->falseStatement, variables));
+    }
+    case WHILE:
+      return assignsAny(static_cast<ASTWhile*>(node)->body, variables);
+    default:
+      // A procedure declared inside only sees its own variables
+      return false;
+  }
+}
+
+#pragma clang diagnostic pop
@@ -0,0 +1,66 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_BRANCHFOLDER_H
+#define COMPILER_VISUALIZATION_BRANCHFOLDER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "AST.h"
+
+// Decides the branches whose outcome is known at compile time, so no test is emitted for them:
+// - operators on integer literals are evaluated, as the generator would in 64 bits, unless that changes whether
+//   the value is wide, leaving divisions by zero to fault at run time
+// - an if on a literal is replaced by the arm taken, and a loop on 0 removed; a loop on any other literal is left
+//   for the generator, which emits its backedge as a plain jmp
+// - an if inside an arm of another with the same condition takes the same arm, when nothing in that arm can change
+//   a variable the condition reads
+// - statements after a break, continue or return, or an if both of whose arms end in one, are removed
+class BranchFolder {
+  struct Fact {
+    ASTExpression* condition;
+    bool value;
+  };
+
+  ASTBlock* root;
+  // Conditions known to hold in the arm being folded, outermost first
+  std::vector<Fact> facts;
+  std::map<std::string, unsigned int> hits;
+
+public:
+  explicit BranchFolder(ASTBlock* root);
+
+  void run();
+
+  const std::map<std::string, unsigned int>& getHits() const {
+    return hits;
+  }
+
+private:
+  // Folds `node`, which is replaced when it is decided
+  void foldStatement(ASTStatement*& node, ASTBlock* parent);
+  void foldBlock(ASTBlock* block);
+  // Folds the arm of an if taken when its condition is `value`
+  void foldArm(ASTStatement*& arm, ASTExpression* condition, bool value, ASTBlock* parent);
+  ASTExpression* foldExpression(ASTExpression* node);
+
+  // Whether `condition` is decided by the literal it folded to or by a fact, and if so to what
+  bool decide(ASTExpression* condition, bool& value) const;
+  // What a decided statement becomes: `with`, in a block of its own so its scope is unchanged, or nothing
+  static ASTStatement* replacement(ASTStatement* node, ASTStatement* with, ASTBlock* parent);
+  static ASTLiteral* literal(ASTExpression* node, unsigned long long value);
+
+  // Whether `left op right` can be worked out here, giving the same result as the code generated for it would
+  static bool evaluate(ExpressionOperatorType op, long long left, long long right, long long& result);
+  static bool isSame(ASTExpression* a, ASTExpression* b);
+  // Whether control can never reach the statement after `node`
+  static bool endsInJump(ASTStatement* node);
+  static void collectVariables(ASTExpression* node, std::set<std::string>& variables);
+  // Whether `node` assigns or declares any of `variables`
+  static bool assignsAny(ASTStatement* node, const std::set<std::string>& variables);
+};
+
+#endif //COMPILER_VISUALIZATION_BRANCHFOLDER_H
@@ -0,0 +1,143 @@
+//
+// Created on 2026/10/19.
+//
+
+#include "Cloner.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cppcoreguidelines-pro-type-static-cast-downcast"
+
+ASTStatement* Cloner::cloneStatement(ASTStatement* node, ASTBlock* parent) {
+  switch (node->type) {
+    case BLOCK:
+      return cloneBlock(static_cast<ASTBlock*>(node), parent);
+    case PROC_DECL: {
+      auto* procedure = new ASTProcedure(*static_cast<ASTProcedure*>(node));
+      procedure->parent = parent;
+      return procedure;
+    }
+    case PROC_CALL: {
+      auto* call = static_cast<ASTProcedureCall*>(node);
+      auto* clone = new ASTProcedureCall();
+      clone->nodeId = call->nodeId;
+      clone->ident = call->ident;
+      for (auto parameter : call->parameters) {
+        clone->parameters.push_back(cloneExpression(parameter));
+      }
+      return clone;
+    }
+    case VARIABLE_DECL: {
+      auto* declaration = static_cast<ASTVariableDeclaration*>(node);
+      auto* clone = new ASTVariableDeclaration();
+      clone->nodeId = declaration->nodeId;
+      clone->dataType = declaration->dataType;
+      clone->ident = declaration->ident + suffix;
+      if (declaration->initialValueExpression) {
+        clone->initialValueExpression = cloneExpression(declaration->initialValueExpression);
+      }
+      return clone;
+    }
+    case VARIABLE_ASSIGNMENT: {
+      auto* assignment = static_cast<ASTVariableAssignment*>(node);
+      auto* clone = new ASTVariableAssignment();
+      clone->nodeId = assignment->nodeId;
+      clone->ident = assignment->ident + suffix;
+      clone->newValueExpression = cloneExpression(assignment->newValueExpression);
+      return clone;
+    }
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      auto* clone = new ASTIf();
+      clone->nodeId = ifNode->nodeId;
+      clone->conditional = cloneExpression(ifNode->conditional);
+      clone->trueStatement = cloneStatement(ifNode->trueStatement, parent);
+      if (ifNode->falseStatement) {
+        clone->falseStatement = cloneStatement(ifNode->falseStatement, parent);
+      }
+      return clone;
+    }
+    case WHILE: {
+      auto* whileNode = static_cast<ASTWhile*>(node);
+      auto* clone = new ASTWhile();
+      clone->nodeId = whileNode->nodeId;
+      clone->conditional = cloneExpression(whileNode->conditional);
+      clone->body = cloneBlock(whileNode->body, parent);
+      return clone;
+    }
+    case CONTINUE: {
+      auto* clone = new ASTContinue();
+      clone->nodeId = node->nodeId;
+      return clone;
+    }
+    case BREAK: {
+      auto* clone = new ASTBreak();
+      clone->nodeId = node->nodeId;
+      return clone;
+    }
+    default:
+      // Returns aren't copied; procedures that return early are never inlined
+      return node;
+  }
+}
+
+ASTBlock* Cloner::cloneBlock(ASTBlock* node, ASTBlock* parent) {
+  auto* clone = new ASTBlock();
+  clone->nodeId = node->nodeId;
+  clone->parent = parent;
+  for (auto statement : node->statements) {
+    clone->statements.push_back(cloneStatement(statement, clone));
+  }
+  return clone;
+}
+
+// Every copy gets its own location, as the generator tracks each expression's value by it
+ASTExpression* Cloner::cloneExpression(ASTExpression* node) {
+  switch (node->type) {
+    case ASTType::LITERAL: {
+      auto* clone = new ASTLiteral();
+      clone->nodeId = node->nodeId;
+      clone->valueType = static_cast<ASTLiteral*>(node)->valueType;
+      clone->value = static_cast<ASTLiteral*>(node)->value;
+      return clone;
+    }
+    case ASTType::VARIABLE: {
+      auto* variable = static_cast<ASTVariableIdent*>(node);
+      std::string ident = variable->ident + suffix;
+
+      auto constant = constants.find(ident);
+      if (constant != constants.end()) {
+        auto* literal = new ASTLiteral();
+        literal->nodeId = node->nodeId;
+        literal->valueType = ASTLiteral::ValueType::INTEGER;
+        literal->value.integerData = constant->second;
+        return literal;
+      }
+
+      auto* clone = new ASTVariableIdent();
+      clone->nodeId = node->nodeId;
+      clone->ident = ident;
+      return clone;
+    }
+    case ASTType::BIN_OP: {
+      auto* binOp = static_cast<ASTBinOp*>(node);
+      auto* clone = new ASTBinOp();
+      clone->nodeId = node->nodeId;
+      clone->op = binOp->op;
+      clone->left = cloneExpression(binOp->left);
+      clone->right = cloneExpression(binOp->right);
+      return clone;
+    }
+    case ASTType::UNARY_OP: {
+      auto* unaryOp = static_cast<ASTUnaryOp*>(node);
+      auto* clone = new ASTUnaryOp();
+      clone->nodeId = node->nodeId;
+      clone->op = unaryOp->op;
+      clone->child = cloneExpression(unaryOp->child);
+      return clone;
+    }
+    default:
+      return node;
+  }
+}
+
+#pragma clang diagnostic pop
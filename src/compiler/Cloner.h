@@ -0,0 +1,26 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_CLONER_H
+#define COMPILER_VISUALIZATION_CLONER_H
+
+#include <map>
+#include <string>
+#include "AST.h"
+
+// Deep copies of statements and expressions, for the passes that duplicate code. Copies keep the node ids of what
+// they were copied from, so they still show up against it.
+class Cloner {
+public:
+  // Appended to every variable in the copy
+  std::string suffix;
+  // Variables replaced by a literal in the copy, by new name
+  std::map<std::string, unsigned long long> constants;
+
+  ASTStatement* cloneStatement(ASTStatement* node, ASTBlock* parent);
+  ASTBlock* cloneBlock(ASTBlock* node, ASTBlock* parent);
+  ASTExpression* cloneExpression(ASTExpression* node);
+};
+
+#endif //COMPILER_VISUALIZATION_CLONER_H
@@ -0,0 +1,225 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <algorithm>
+#include <map>
+#include "ControlFlowGraph.h"
+
+ControlFlowGraph::ControlFlowGraph(const std::vector<Instruction>& code)
+    : blockOfInstruction(code.size()) {
+  bool hasInstruction = false;
+  bool isAfterJump = false;
+  for (size_t i = 0; i < code.size(); ++i) {
+    const Instruction& instruction = code[i];
+    bool startsBlock = blocks.empty() || isAfterJump
+        || (instruction.type == Instruction::Type::LABEL && hasInstruction);
+    if (startsBlock) {
+      if (!blocks.empty()) {
+        blocks.back().end = i;
+      }
+      blocks.emplace_back();
+      blocks.back().begin = i;
+      hasInstruction = false;
+      isAfterJump = false;
+    }
+
+    if (instruction.type == Instruction::Type::LABEL && blocks.back().label.empty()) {
+      blocks.back().label = instruction.mnemonic;
+    }
+    if (instruction.isInstruction()) {
+      hasInstruction = true;
+      isAfterJump = instruction.isBarrier() || instruction.isConditionalJump();
+    }
+    blockOfInstruction[i] = blocks.size() - 1;
+  }
+  if (!blocks.empty()) {
+    blocks.back().end = code.size();
+  }
+
+  std::map<std::string, size_t> labelBlocks;
+  for (size_t i = 0; i < code.size(); ++i) {
+    if (code[i].type == Instruction::Type::LABEL) {
+      labelBlocks[code[i].mnemonic] = blockOfInstruction[i];
+    }
+  }
+
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    size_t last = blocks[block].end;
+    for (size_t i = blocks[block].end; i-- > blocks[block].begin;) {
+      if (code[i].isInstruction()) {
+        last = i;
+        break;
+      }
+    }
+
+    bool fallsThrough = true;
+    if (last != blocks[block].end) {
+      const Instruction& instruction = code[last];
+      fallsThrough = !instruction.isBarrier();
+
+      if (instruction.isUnconditionalJump() || instruction.isConditionalJump()) {
+        auto target = labelBlocks.find(instruction.jumpTarget());
+        if (target != labelBlocks.end()) {
+          addEdge(block, target->second);
+        } else {
+          // Another procedure, or somewhere only known at run time
+          blocks[block].isExit = true;
+        }
+      } else if (instruction.isBarrier()) {
+        blocks[block].isExit = true;
+      }
+    }
+
+    if (fallsThrough) {
+      if (block + 1 < blocks.size()) {
+        addEdge(block, block + 1);
+      } else {
+        blocks[block].isExit = true;
+      }
+    }
+  }
+}
+
+ControlFlowGraph::ControlFlowGraph(size_t count, const std::vector<std::pair<size_t, size_t>>& edges)
+    : blocks(count) {
+  for (const auto& edge : edges) {
+    addEdge(edge.first, edge.second);
+  }
+  for (auto& block : blocks) {
+    block.isExit = block.successors.empty();
+  }
+}
+
+std::vector<size_t> ControlFlowGraph::reversePostorder() const {
+  std::vector<size_t> postorder;
+  if (blocks.empty()) return postorder;
+
+  // Iterative, as a procedure can have thousands of blocks; each entry is a block and its next successor to visit
+  std::vector<bool> visited(blocks.size(), false);
+  std::vector<std::pair<size_t, size_t>> stack;
+  stack.emplace_back(0, 0);
+  visited[0] = true;
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    const auto& successors = blocks[top.first].successors;
+    if (top.second < successors.size()) {
+      size_t next = successors[top.second++];
+      if (!visited[next]) {
+        visited[next] = true;
+        stack.emplace_back(next, 0);
+      }
+    } else {
+      postorder.push_back(top.first);
+      stack.pop_back();
+    }
+  }
+
+  std::reverse(postorder.begin(), postorder.end());
+  return postorder;
+}
+
+void ControlFlowGraph::print(std::ostream& os) const {
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    os << "block " << block << " [" << blocks[block].begin << ", " << blocks[block].end << ")";
+    if (!blocks[block].label.empty()) {
+      os << " " << blocks[block].label;
+    }
+    os << " ->";
+    for (auto successor : blocks[block].successors) {
+      os << " " << successor;
+    }
+    if (blocks[block].isExit) {
+      os << " exit";
+    }
+    os << std::endl;
+  }
+}
+
+void ControlFlowGraph::addEdge(size_t from, size_t to) {
+  auto& successors = blocks[from].successors;
+  if (std::find(successors.begin(), successors.end(), to) != successors.end()) return;
+  successors.push_back(to);
+  blocks[to].predecessors.push_back(from);
+}
+
+DominatorTree::DominatorTree(const ControlFlowGraph& graph)
+    : immediateDominators(graph.getBlocks().size(), NONE),
+      children(graph.getBlocks().size()),
+      preorderStart(graph.getBlocks().size(), NONE),
+      preorderEnd(graph.getBlocks().size(), NONE) {
+  const auto& blocks = graph.getBlocks();
+  if (blocks.empty()) return;
+
+  std::vector<size_t> order = graph.reversePostorder();
+  std::vector<size_t> position(blocks.size(), NONE);
+  for (size_t i = 0; i < order.size(); ++i) {
+    position[order[i]] = i;
+  }
+
+  // Walks both up the tree built so far until they meet at the nearest common dominator
+  auto intersect = [&](size_t a, size_t b) {
+    while (a != b) {
+      while (position[a] > position[b]) a = immediateDominators[a];
+      while (position[b] > position[a]) b = immediateDominators[b];
+    }
+    return a;
+  };
+
+  immediateDominators[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 1; i < order.size(); ++i) {
+      size_t block = order[i];
+      size_t dominator = NONE;
+      for (auto predecessor : blocks[block].predecessors) {
+        if (immediateDominators[predecessor] == NONE) continue; // Not reached yet, or never
+        dominator = dominator == NONE ? predecessor : intersect(predecessor, dominator);
+      }
+      if (immediateDominators[block] != dominator) {
+        immediateDominators[block] = dominator;
+        changed = true;
+      }
+    }
+  }
+  immediateDominators[0] = NONE;
+
+  for (size_t i = 1; i < order.size(); ++i) {
+    children[immediateDominators[order[i]]].push_back(order[i]);
+  }
+
+  size_t counter = 0;
+  std::vector<std::pair<size_t, size_t>> stack;
+  stack.emplace_back(0, 0);
+  preorderStart[0] = counter++;
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    if (top.second < children[top.first].size()) {
+      size_t child = children[top.first][top.second++];
+      preorderStart[child] = counter++;
+      stack.emplace_back(child, 0);
+    } else {
+      preorderEnd[top.first] = counter;
+      stack.pop_back();
+    }
+  }
+}
+
+bool DominatorTree::dominates(size_t a, size_t b) const {
+  if (a == b) return true;
+  if (preorderStart[a] == NONE || preorderStart[b] == NONE) return false;
+  return preorderStart[a] <= preorderStart[b] && preorderEnd[b] <= preorderEnd[a];
+}
+
+void DominatorTree::print(std::ostream& os) const {
+  for (size_t block = 0; block < immediateDominators.size(); ++block) {
+    os << "block " << block << " idom ";
+    if (immediateDominators[block] == NONE) {
+      os << (block == 0 ? "entry" : "unreachable");
+    } else {
+      os << immediateDominators[block];
+    }
+    os << std::endl;
+  }
+}
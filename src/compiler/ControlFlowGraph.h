@@ -0,0 +1,81 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_CONTROLFLOWGRAPH_H
+#define COMPILER_VISUALIZATION_CONTROLFLOWGRAPH_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Instruction.h"
+
+struct BasicBlock {
+  // Instructions [begin, end) of the code the graph was built from; both 0 for a graph built from edges
+  size_t begin = 0;
+  size_t end = 0;
+  std::string label; // First label heading it, if any
+  std::vector<size_t> successors;
+  std::vector<size_t> predecessors;
+  // Control can leave the graph from the end of it: a ret, a jump to another procedure, or the end of the code
+  bool isExit = false;
+};
+
+// Basic blocks of one procedure's code, with block 0 its entry. A block starts at a label that follows an
+// instruction, or after a jump or ret, so consecutive labels and the comments around them share one.
+class ControlFlowGraph {
+  std::vector<BasicBlock> blocks;
+  std::vector<size_t> blockOfInstruction;
+
+public:
+  explicit ControlFlowGraph(const std::vector<Instruction>& code);
+  // For any other IR: `count` blocks joined by (from, to) edges, with those that have no successors the exits
+  ControlFlowGraph(size_t count, const std::vector<std::pair<size_t, size_t>>& edges);
+
+  const std::vector<BasicBlock>& getBlocks() const {
+    return blocks;
+  }
+  size_t blockOf(size_t instruction) const {
+    return blockOfInstruction[instruction];
+  }
+
+  // Blocks reachable from the entry, each before its successors except along backedges
+  std::vector<size_t> reversePostorder() const;
+
+  void print(std::ostream& os) const;
+
+private:
+  void addEdge(size_t from, size_t to);
+};
+
+// Immediate dominators, found with the iterative algorithm of Cooper, Harvey and Kennedy, which on the mostly
+// reducible graphs the generator emits settles in two or three passes over the blocks in reverse postorder
+class DominatorTree {
+public:
+  static constexpr size_t NONE = SIZE_MAX;
+
+private:
+  std::vector<size_t> immediateDominators; // NONE for the entry and unreachable blocks
+  std::vector<std::vector<size_t>> children;
+  // Interval of each block in a preorder walk of the tree, so dominance is a constant time check
+  std::vector<size_t> preorderStart;
+  std::vector<size_t> preorderEnd;
+
+public:
+  explicit DominatorTree(const ControlFlowGraph& graph);
+
+  size_t immediateDominator(size_t block) const {
+    return immediateDominators[block];
+  }
+  const std::vector<size_t>& getChildren(size_t block) const {
+    return children[block];
+  }
+  // Whether every path from the entry to `b` goes through `a`; a block dominates itself
+  bool dominates(size_t a, size_t b) const;
+
+  void print(std::ostream& os) const;
+};
+
+#endif //COMPILER_VISUALIZATION_CONTROLFLOWGRAPH_H
@@ -0,0 +1,245 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include "Dataflow.h"
+
+// RegisterMask is a bit per Register value, so the sets over registers have one bit per bit of the mask
+#define REGISTER_BITS 32
+
+static BitSet toBitSet(RegisterMask mask) {
+  BitSet registers(REGISTER_BITS);
+  for (size_t bit = 0; bit < REGISTER_BITS; ++bit) {
+    if (mask & (1u << bit)) {
+      registers.set(bit);
+    }
+  }
+  return registers;
+}
+
+static RegisterMask toMask(const BitSet& registers) {
+  RegisterMask mask = 0;
+  registers.forEach([&mask](size_t bit) {
+    mask |= 1u << bit;
+  });
+  return mask;
+}
+
+static bool isRegister(size_t bit) {
+  return bit < TOTAL_REGISTERS || bit == RBP || bit == RSP;
+}
+
+DataflowResult solveDataflow(const ControlFlowGraph& graph, const DataflowProblem& problem) {
+  const auto& blocks = graph.getBlocks();
+  bool isForward = problem.direction == DataflowProblem::Direction::FORWARD;
+  bool isUnion = problem.meet == DataflowProblem::Meet::UNION;
+
+  // An intersection starts from everything, so only what some path rules out is removed
+  BitSet identity(problem.size, !isUnion);
+  DataflowResult result;
+  result.in.assign(blocks.size(), identity);
+  result.out.assign(blocks.size(), identity);
+
+  // Unreachable blocks go last; nothing they compute reaches the rest
+  std::vector<size_t> order = graph.reversePostorder();
+  std::vector<bool> isQueued(blocks.size(), false);
+  for (auto block : order) {
+    isQueued[block] = true;
+  }
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    if (!isQueued[block]) {
+      order.push_back(block);
+      isQueued[block] = true;
+    }
+  }
+  if (!isForward) {
+    std::reverse(order.begin(), order.end());
+  }
+  std::vector<size_t> position(blocks.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    position[order[i]] = i;
+  }
+
+  // Always the earliest block in the order that needs another visit, so a loop settles before what follows it
+  // is looked at again
+  std::priority_queue<size_t, std::vector<size_t>, std::greater<>> worklist;
+  for (size_t i = 0; i < order.size(); ++i) {
+    worklist.push(i);
+  }
+
+  auto meet = [isUnion](BitSet& into, const BitSet& from) {
+    if (isUnion) {
+      into.unionWith(from);
+    } else {
+      into.intersectWith(from);
+    }
+  };
+
+  BitSet transferred;
+  while (!worklist.empty()) {
+    size_t block = order[worklist.top()];
+    worklist.pop();
+    isQueued[block] = false;
+
+    // Backward problems run against the code, from what is known after a block to what is known before it
+    const auto& sources = isForward ? blocks[block].predecessors : blocks[block].successors;
+    const auto& dependents = isForward ? blocks[block].successors : blocks[block].predecessors;
+    BitSet& input = isForward ? result.in[block] : result.out[block];
+    BitSet& output = isForward ? result.out[block] : result.in[block];
+
+    input = identity;
+    if (isForward ? block == 0 : blocks[block].isExit) {
+      meet(input, problem.boundary);
+    }
+    for (auto source : sources) {
+      meet(input, isForward ? result.out[source] : result.in[source]);
+    }
+
+    transferred = input;
+    transferred.subtract(problem.kill[block]);
+    transferred.unionWith(problem.gen[block]);
+    result.visits++;
+
+    if (transferred != output) {
+      std::swap(output, transferred);
+      for (auto dependent : dependents) {
+        if (!isQueued[dependent]) {
+          isQueued[dependent] = true;
+          worklist.push(position[dependent]);
+        }
+      }
+    }
+  }
+
+  return result;
+}
+
+Liveness::Liveness(const ControlFlowGraph& graph, const std::vector<Instruction>& code)
+    : graph(graph), code(code), leavesProcedure(graph.getBlocks().size(), false) {
+  const auto& blocks = graph.getBlocks();
+
+  DataflowProblem problem;
+  problem.direction = DataflowProblem::Direction::BACKWARD;
+  problem.meet = DataflowProblem::Meet::UNION;
+  problem.size = REGISTER_BITS;
+  problem.boundary = BitSet(REGISTER_BITS);
+
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    // A ret says what it reads itself; anywhere else the procedure can go is assumed to read everything
+    size_t last = blocks[block].end;
+    for (size_t i = blocks[block].end; i-- > blocks[block].begin;) {
+      if (code[i].isInstruction()) {
+        last = i;
+        break;
+      }
+    }
+    bool isReturn = last != blocks[block].end && code[last].mnemonic == "ret";
+    leavesProcedure[block] = blocks[block].isExit && !isReturn;
+
+    RegisterMask live = leavesProcedure[block] ? ALL_REGISTERS_MASK : 0;
+    RegisterMask killed = 0;
+    for (size_t i = blocks[block].end; i-- > blocks[block].begin;) {
+      if (!code[i].isInstruction()) continue;
+      RegisterMask written = code[i].registersWritten();
+      live = (live & ~written) | code[i].registersRead();
+      killed |= written;
+    }
+
+    // Nothing from after it matters when the block leaves, so what it starts with is all there is
+    problem.gen.push_back(toBitSet(live));
+    problem.kill.push_back(toBitSet(leavesProcedure[block] ? ALL_REGISTERS_MASK : killed));
+  }
+
+  result = solveDataflow(graph, problem);
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    if (leavesProcedure[block]) {
+      result.out[block].setAll();
+    }
+  }
+}
+
+bool Liveness::isLiveAfter(size_t index, Register reg) const {
+  size_t block = graph.blockOf(index);
+  RegisterMask live = toMask(result.out[block]);
+  for (size_t i = graph.getBlocks()[block].end; i-- > index + 1;) {
+    if (!code[i].isInstruction()) continue;
+    live = (live & ~code[i].registersWritten()) | code[i].registersRead();
+  }
+  return live & registerMask(reg);
+}
+
+ReachingDefinitions::ReachingDefinitions(const ControlFlowGraph& graph, const std::vector<Instruction>& code)
+    : graph(graph), code(code), firstDefinition(code.size() + 1, 0) {
+  for (size_t i = 0; i < code.size(); ++i) {
+    firstDefinition[i] = definitions.size();
+    if (!code[i].isInstruction()) continue;
+
+    RegisterMask written = code[i].registersWritten();
+    for (size_t bit = 0; bit < REGISTER_BITS; ++bit) {
+      if ((written & (1u << bit)) && isRegister(bit)) {
+        definitions.push_back({i, (Register) bit});
+      }
+    }
+  }
+  firstDefinition[code.size()] = definitions.size();
+
+  definitionsOfRegister.assign(REGISTER_BITS, BitSet(definitions.size()));
+  for (size_t definition = 0; definition < definitions.size(); ++definition) {
+    definitionsOfRegister[definitions[definition].reg].set(definition);
+  }
+
+  DataflowProblem problem;
+  problem.direction = DataflowProblem::Direction::FORWARD;
+  problem.meet = DataflowProblem::Meet::UNION;
+  problem.size = definitions.size();
+  problem.boundary = BitSet(definitions.size());
+
+  for (const auto& block : graph.getBlocks()) {
+    BitSet gen(definitions.size());
+    BitSet kill(definitions.size());
+    for (size_t i = block.begin; i < block.end; ++i) {
+      for (size_t definition = firstDefinition[i]; definition < firstDefinition[i + 1]; ++definition) {
+        const BitSet& sameRegister = definitionsOfRegister[definitions[definition].reg];
+        gen.subtract(sameRegister);
+        gen.set(definition);
+        kill.unionWith(sameRegister);
+      }
+    }
+    problem.gen.push_back(gen);
+    problem.kill.push_back(kill);
+  }
+
+  result = solveDataflow(graph, problem);
+}
+
+std::vector<size_t> ReachingDefinitions::reaching(size_t index, Register reg) const {
+  // The last one in the block before it hides the rest
+  size_t block = graph.blockOf(index);
+  for (size_t i = index; i-- > graph.getBlocks()[block].begin;) {
+    for (size_t definition = firstDefinition[i]; definition < firstDefinition[i + 1]; ++definition) {
+      if (definitions[definition].reg == reg) return {definition};
+    }
+  }
+
+  std::vector<size_t> found;
+  BitSet incoming = result.in[block];
+  incoming.intersectWith(definitionsOfRegister[reg]);
+  incoming.forEach([&found](size_t definition) {
+    found.push_back(definition);
+  });
+  return found;
+}
+
+void printRegisters(std::ostream& os, const BitSet& registers) {
+  os << "{";
+  bool isFirst = true;
+  registers.forEach([&os, &isFirst](size_t bit) {
+    if (!isRegister(bit)) return;
+    os << (isFirst ? "" : ", ") << (Register) bit;
+    isFirst = false;
+  });
+  os << "}";
+}
@@ -0,0 +1,111 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_DATAFLOW_H
+#define COMPILER_VISUALIZATION_DATAFLOW_H
+
+#include <ostream>
+#include <vector>
+#include "BitSet.h"
+#include "ControlFlowGraph.h"
+#include "Instruction.h"
+
+// A gen/kill problem over a ControlFlowGraph, where what flows out of a block is
+//   gen | (what flows in & ~kill)
+// and what flows in is the meet of what flows out of its predecessors (forward) or successors (backward)
+struct DataflowProblem {
+  enum class Direction {
+    FORWARD,
+    BACKWARD,
+  };
+  enum class Meet {
+    UNION, // Holds along some path
+    INTERSECTION, // Holds along every path
+  };
+
+  Direction direction = Direction::FORWARD;
+  Meet meet = Meet::UNION;
+  size_t size = 0; // Bits in every set
+  std::vector<BitSet> gen; // Per block
+  std::vector<BitSet> kill;
+  // Flows into the entry (forward) or out of the exits (backward)
+  BitSet boundary;
+};
+
+struct DataflowResult {
+  // In the direction of the code, whichever way the problem runs: `in` holds before a block, `out` after it
+  std::vector<BitSet> in;
+  std::vector<BitSet> out;
+  unsigned int visits = 0; // Blocks whose transfer function ran, for benchmarking
+};
+
+// Worklist solver, visiting blocks in reverse postorder (forward) or postorder (backward) so most are seen after
+// what feeds them, and only revisiting those whose inputs changed, earliest in that order first
+DataflowResult solveDataflow(const ControlFlowGraph& graph, const DataflowProblem& problem);
+
+// Registers that may be read before they are next written, with a bit per Register value. A ret reads the
+// registers the caller expects back, and everything is assumed live after a jump that leaves the procedure.
+class Liveness {
+  const ControlFlowGraph& graph;
+  const std::vector<Instruction>& code;
+  DataflowResult result;
+  std::vector<bool> leavesProcedure; // Per block, ends in a jump elsewhere or the end of the code
+
+public:
+  Liveness(const ControlFlowGraph& graph, const std::vector<Instruction>& code);
+
+  const BitSet& liveIn(size_t block) const {
+    return result.in[block];
+  }
+  const BitSet& liveOut(size_t block) const {
+    return result.out[block];
+  }
+  const DataflowResult& getResult() const {
+    return result;
+  }
+
+  // Whether `reg` may still be read after code[index] executes
+  bool isLiveAfter(size_t index, Register reg) const;
+};
+
+// Which complete writes of a register may be the last one to it before each point. A partial write, which
+// registersWritten doesn't count, neither defines nor kills.
+class ReachingDefinitions {
+public:
+  struct Definition {
+    size_t instruction;
+    Register reg;
+  };
+
+private:
+  const ControlFlowGraph& graph;
+  const std::vector<Instruction>& code;
+  std::vector<Definition> definitions;
+  // Definitions of each register, by Register value
+  std::vector<BitSet> definitionsOfRegister;
+  // Index of the first definition made by each instruction, and one past the last instruction's
+  std::vector<size_t> firstDefinition;
+  DataflowResult result;
+
+public:
+  ReachingDefinitions(const ControlFlowGraph& graph, const std::vector<Instruction>& code);
+
+  const std::vector<Definition>& getDefinitions() const {
+    return definitions;
+  }
+  const BitSet& reachingIn(size_t block) const {
+    return result.in[block];
+  }
+  const DataflowResult& getResult() const {
+    return result;
+  }
+
+  // Indices into getDefinitions() of those of `reg` that reach code[index] before it runs
+  std::vector<size_t> reaching(size_t index, Register reg) const;
+};
+
+// Prints a set of registers, as Liveness has them
+void printRegisters(std::ostream& os, const BitSet& registers);
+
+#endif //COMPILER_VISUALIZATION_DATAFLOW_H
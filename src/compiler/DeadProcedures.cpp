@@ -0,0 +1,84 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <algorithm>
+#include "DeadProcedures.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cppcoreguidelines-pro-type-static-cast-downcast"
+
+DeadProcedures::DeadProcedures(ASTBlock* root)
+    : root(root) {
+}
+
+void DeadProcedures::run() {
+  bool hasMain = false;
+  std::vector<std::string> pending;
+  for (auto statement : root->statements) {
+    if (statement->type != ASTType::PROC_DECL) {
+      std::set<std::string> calls;
+      collectCalls(statement, calls);
+      pending.insert(pending.end(), calls.begin(), calls.end());
+      continue;
+    }
+
+    auto* procedure = static_cast<ASTProcedure*>(statement);
+    if (procedure->isExternal) continue;
+    collectCalls(procedure->block, callGraph[procedure->ident]);
+    hasMain |= procedure->ident == "main";
+  }
+  if (!hasMain) return;
+
+  std::set<std::string> reachable;
+  pending.emplace_back("main");
+  while (!pending.empty()) {
+    std::string ident = pending.back();
+    pending.pop_back();
+    if (!reachable.insert(ident).second) continue;
+
+    const auto& calls = callGraph[ident];
+    pending.insert(pending.end(), calls.begin(), calls.end());
+  }
+
+  auto& statements = root->statements;
+  statements.erase(std::remove_if(statements.begin(), statements.end(), [this, &reachable](ASTStatement* statement) {
+    if (statement->type != ASTType::PROC_DECL) return false;
+    auto* procedure = static_cast<ASTProcedure*>(statement);
+    if (reachable.count(procedure->ident)) return false;
+
+    removed.push_back(procedure->ident);
+    return true;
+  }), statements.end());
+}
+
+void DeadProcedures::collectCalls(ASTStatement* node, std::set<std::string>& calls) {
+  if (!node) return;
+  switch (node->type) {
+    case BLOCK:
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        collectCalls(statement, calls);
+      }
+      break;
+    case PROC_CALL:
+      calls.insert(static_cast<ASTProcedureCall*>(node)->ident);
+      break;
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      collectCalls(ifNode->trueStatement, calls);
+      collectCalls(ifNode->falseStatement, calls);
+      break;
+    }
+    case WHILE:
+      collectCalls(static_cast<ASTWhile*>(node)->body, calls);
+      break;
+    case PROC_DECL:
+      // Nested procedures are only kept alive through their enclosing one, so what they call is counted as its
+      collectCalls(static_cast<ASTProcedure*>(node)->block, calls);
+      break;
+    default:
+      break;
+  }
+}
+
+#pragma clang diagnostic pop
@@ -0,0 +1,37 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_DEADPROCEDURES_H
+#define COMPILER_VISUALIZATION_DEADPROCEDURES_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "AST.h"
+
+// Removes the procedures and externs nothing reachable from main calls. The call graph is rooted at main and at any
+// calls made outside a procedure, and is built after inlining, so procedures whose every call was inlined go too.
+// A file without a main of its own is left alone, as everything in it may be wanted by whatever it is linked with.
+class DeadProcedures {
+private:
+  ASTBlock* root;
+  std::map<std::string, std::set<std::string>> callGraph;
+  std::vector<std::string> removed;
+
+public:
+  explicit DeadProcedures(ASTBlock* root);
+
+  void run();
+
+  // Procedures and externs taken out of the tree, in declaration order
+  const std::vector<std::string>& getRemoved() const {
+    return removed;
+  }
+
+private:
+  static void collectCalls(ASTStatement* node, std::set<std::string>& calls);
+};
+
+#endif //COMPILER_VISUALIZATION_DEADPROCEDURES_H
@@ -0,0 +1,163 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <algorithm>
+#include <climits>
+#include "DeadStoreElimination.h"
+#include "BitSet.h"
+#include "ControlFlowGraph.h"
+#include "Dataflow.h"
+
+static bool isFrameSlot(const Operand& memory) {
+  return memory.reg == Register::RSP && memory.index == Register::NONE;
+}
+
+// Bytes accessed, from the operand when it says, otherwise from the register on the other side
+static unsigned int widthOf(const Instruction& instruction, const Operand& memory) {
+  if (memory.bytes) return memory.bytes;
+  for (const auto& operand : instruction.operands) {
+    if (operand.type == Operand::Type::REGISTER) return operand.bytes;
+  }
+  return 8;
+}
+
+unsigned int DeadStoreElimination::run(std::vector<Instruction>& code) {
+  std::vector<Effect> effects;
+  effects.reserve(code.size());
+  long long lowest = LLONG_MAX;
+  long long highest = LLONG_MIN;
+  bool hasStore = false;
+  for (const auto& instruction : code) {
+    effects.push_back(effectOf(instruction));
+    const Effect& effect = effects.back();
+    for (const auto& range : effect.reads) {
+      lowest = std::min(lowest, range.first);
+      highest = std::max(highest, range.second);
+    }
+    if (effect.isStore) {
+      lowest = std::min(lowest, effect.store.first);
+      highest = std::max(highest, effect.store.second);
+      hasStore = true;
+    }
+  }
+  if (!hasStore) return 0;
+
+  // A bit per byte of the frame, numbered from the lowest displacement used
+  size_t size = highest - lowest;
+  auto bytesOf = [&](const std::pair<long long, long long>& range) {
+    BitSet bytes(size);
+    for (long long displacement = range.first; displacement < range.second; ++displacement) {
+      bytes.set(displacement - lowest);
+    }
+    return bytes;
+  };
+  BitSet everything(size, true);
+  // live = gen | (live & ~kill), working back over instruction i
+  auto genOf = [&](size_t i) {
+    BitSet gen(size, effects[i].readsFrame);
+    for (const auto& range : effects[i].reads) {
+      gen.unionWith(bytesOf(range));
+    }
+    return gen;
+  };
+  auto killOf = [&](size_t i) {
+    if (effects[i].freesFrame) return everything;
+    return effects[i].isStore ? bytesOf(effects[i].store) : BitSet(size);
+  };
+
+  ControlFlowGraph graph(code);
+  const auto& blocks = graph.getBlocks();
+  std::vector<bool> leavesProcedure(blocks.size(), false);
+
+  DataflowProblem problem;
+  problem.direction = DataflowProblem::Direction::BACKWARD;
+  problem.meet = DataflowProblem::Meet::UNION;
+  problem.size = size;
+  problem.boundary = BitSet(size);
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    // The frame is gone once the procedure returns, but a jump anywhere else is assumed to read all of it
+    size_t last = blocks[block].end;
+    for (size_t i = blocks[block].end; i-- > blocks[block].begin;) {
+      if (code[i].isInstruction()) {
+        last = i;
+        break;
+      }
+    }
+    bool isReturn = last != blocks[block].end && code[last].mnemonic == "ret";
+    leavesProcedure[block] = blocks[block].isExit && !isReturn;
+
+    BitSet gen(size, leavesProcedure[block]);
+    BitSet kill(size, leavesProcedure[block]);
+    for (size_t i = blocks[block].end; i-- > blocks[block].begin;) {
+      gen.subtract(killOf(i));
+      gen.unionWith(genOf(i));
+      kill.unionWith(killOf(i));
+    }
+    problem.gen.push_back(gen);
+    problem.kill.push_back(kill);
+  }
+  DataflowResult result = solveDataflow(graph, problem);
+
+  std::vector<size_t> deadStores;
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    BitSet live = leavesProcedure[block] ? everything : result.out[block];
+    for (size_t i = blocks[block].end; i-- > blocks[block].begin;) {
+      if (effects[i].isStore) {
+        BitSet stored = bytesOf(effects[i].store);
+        stored.intersectWith(live);
+        if (!stored.any()) {
+          deadStores.push_back(i);
+        }
+      }
+      live.subtract(killOf(i));
+      live.unionWith(genOf(i));
+    }
+  }
+
+  // From the back, so the indices still to go stay put
+  std::sort(deadStores.begin(), deadStores.end());
+  for (auto i = deadStores.rbegin(); i != deadStores.rend(); ++i) {
+    code.erase(code.begin() + (long) *i);
+  }
+  hits["dead-store"] += deadStores.size();
+  return deadStores.size();
+}
+
+DeadStoreElimination::Effect DeadStoreElimination::effectOf(const Instruction& instruction) {
+  Effect effect;
+  if (!instruction.isInstruction()) return effect;
+
+  const auto& operands = instruction.operands;
+  bool isFrameResize = (instruction.mnemonic == "add" || instruction.mnemonic == "sub") && operands.size() == 2
+      && operands[0].isRegister(Register::RSP) && operands[1].type == Operand::Type::IMMEDIATE;
+  if (isFrameResize) {
+    effect.freesFrame = true;
+    return effect;
+  }
+  if (instruction.registersWritten() & registerMask(Register::RSP) || instruction.mnemonic == "push"
+      || instruction.mnemonic == "pop") {
+    effect.readsFrame = true;
+    return effect;
+  }
+
+  for (size_t i = 0; i < operands.size(); ++i) {
+    const Operand& operand = operands[i];
+    if (operand.type != Operand::Type::MEMORY) continue;
+
+    // Its address could be kept and read through later
+    if (!isFrameSlot(operand) || instruction.mnemonic == "lea") {
+      effect.readsFrame = true;
+      continue;
+    }
+
+    std::pair<long long, long long> range = {operand.value, operand.value + widthOf(instruction, operand)};
+    if (i == 0 && instruction.mnemonic == "mov") {
+      effect.isStore = true;
+      effect.store = range;
+    } else {
+      effect.reads.push_back(range);
+    }
+  }
+  return effect;
+}
@@ -0,0 +1,43 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_DEADSTOREELIMINATION_H
+#define COMPILER_VISUALIZATION_DEADSTOREELIMINATION_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Instruction.h"
+
+// Backward liveness over the bytes of the frame, solved on the procedure's control flow graph. A store to a frame
+// slot none of whose bytes are read again before being overwritten, or before the procedure returns, is removed;
+// the value stored then usually has no other use, and goes with the dead moves.
+//
+// Only rsp relative slots without an index are told apart. Any other memory operand, and anything else that moves
+// rsp, may read the whole frame, and a jump out of the procedure is assumed to.
+class DeadStoreElimination {
+  // What an instruction does to the frame
+  struct Effect {
+    bool readsFrame = false; // All of it
+    bool freesFrame = false; // Allocates or frees it, so nothing stored before matters after
+    std::vector<std::pair<long long, long long>> reads; // Byte ranges [begin, end)
+    bool isStore = false; // Overwrites `store` and nothing else
+    std::pair<long long, long long> store;
+  };
+
+  std::map<std::string, unsigned int> hits;
+
+public:
+  // Removes dead stores from one procedure's code; returns the number removed
+  unsigned int run(std::vector<Instruction>& code);
+
+  const std::map<std::string, unsigned int>& getHits() const {
+    return hits;
+  }
+
+private:
+  static Effect effectOf(const Instruction& instruction);
+};
+
+#endif //COMPILER_VISUALIZATION_DEADSTOREELIMINATION_H
@@ -2,129 +2,43 @@
 // Created by Callum Todd on 2020/03/23.
 //
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <functional>
+#include <numeric>
 #include "Generator.h"
 #include "AST.h"
+#include "BranchFolder.h"
+#include "ControlFlowGraph.h"
+#include "Dataflow.h"
+#include "DeadProcedures.h"
+#include "DeadStoreElimination.h"
+#include "Inliner.h"
+#include "Peephole.h"
+#include "ProcedureLayout.h"
+#include "RedundancyElimination.h"
+#include "TailCalls.h"
+#include "ThreadPool.h"
+#include "Unroller.h"
 #include "../Data.h"
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "cppcoreguidelines-pro-type-static-cast-downcast"
 
-template<typename T>
-Generator::StreamHelper& operator<<(Generator::StreamHelper& h, T const& t) {
-  *h._fileOut << t;
-  h.ss << t;
-  return h;
-}
-
-std::string registerToByteEquivalent(Register reg, unsigned int bytes) {
-  if (bytes == 1) {
-    return registerTo8BitEquivalent(reg);
-  } else if (bytes == 2) {
-    return registerTo16BitEquivalent(reg);
-  } else if (bytes == 4) {
-    return registerTo32BitEquivalent(reg);
-  } else if (bytes == 8) {
-    std::stringstream ss;
-    ss << reg;
-    return ss.str();
-  } else {
-    std::cout << "Byte amount not supported!" << std::endl;
-    throw std::exception();
-  }
-}
-
-std::string registerTo8BitEquivalent(Register reg) {
-  switch (reg) {
-    case NONE:
-      return "REGISTER_NONE";
-    case RAX:
-      return "al";
-    case RBX:
-      return "bl";
-    case RCX:
-      return "cl";
-    case RDX:
-      return "dl";
-    case RSI:
-      return "sil";
-    case RDI:
-      return "dil";
-    case R8:
-    case R9:
-    case R10:
-    case R11:
-    case R15: {
-      std::stringstream ss;
-      ss << reg << "b";
-      return ss.str();
-    }
-  }
-  throw std::exception();
-}
-
-std::string registerTo16BitEquivalent(Register reg) {
-  switch (reg) {
-    case NONE:
-      return "REGISTER_NONE";
-    case RAX:
-      return "ax";
-    case RBX:
-      return "bx";
-    case RCX:
-      return "cx";
-    case RDX:
-      return "dx";
-    case RSI:
-      return "si";
-    case RDI:
-      return "di";
-    case R8:
-    case R9:
-    case R10:
-    case R11:
-    case R15: {
-      std::stringstream ss;
-      ss << reg << "w";
-      return ss.str();
-    }
+static bool isCalleSaved(Register reg) {
+  for (auto calleSavedRegister : calleSavedRegisters) {
+    if (calleSavedRegister == reg) return true;
   }
-  throw std::exception();
-}
-
-std::string registerTo32BitEquivalent(Register reg) {
-  switch (reg) {
-    case NONE:
-      return "REGISTER_NONE";
-    case RAX:
-      return "eax";
-    case RBX:
-      return "ebx";
-    case RCX:
-      return "ecx";
-    case RDX:
-      return "edx";
-    case RSI:
-      return "esi";
-    case RDI:
-      return "edi";
-    case R8:
-    case R9:
-    case R10:
-    case R11:
-    case R15: {
-      std::stringstream ss;
-      ss << reg << "d";
-      return ss.str();
-    }
-  }
-  throw std::exception();
+  return false;
 }
 
 ParameterClass identifyParamClass(DataType dataType) {
   switch (dataType) {
-    case DataType::INT:
+    case DataType::I8:
+    case DataType::I16:
+    case DataType::I32:
+    case DataType::I64:
       return INTEGER;
 
     case DataType::UNINITIALISED:
@@ -133,10 +47,29 @@ ParameterClass identifyParamClass(DataType dataType) {
   }
 }
 
-unsigned int Label::idCount = 1;
-
-Generator::Generator(const std::function<void(const Data&)>& ready, ASTNode* astRoot, std::string filepath)
-    : ready(ready) {
+Generator::Generator(const std::function<void(const Data&)>& ready, ASTNode* astRoot, std::string filepath,
+                     GeneratorOptions options)
+    : options(std::move(options)),
+      passManager(this->options.passes, this->options.timePasses),
+      selector({
+                   .isInRegister = [this](ASTVariableIdent* node) {
+                     return blockScopeStack.top().searchForVariable(node->ident).location->isPromoted;
+                   },
+                   .isMemoryOperand = [this](ASTVariableIdent* node) {
+                     auto var = blockScopeStack.top().searchForVariable(node->ident);
+                     return !var.location->isPromoted && bytesOf(var.dataType) == 8;
+                   },
+                   .isReused = [this](ASTExpression* node) {
+                     return reusedExpressions.count(node) > 0;
+                   },
+                   .isKept = [this](ASTExpression* node) {
+                     return expressionSlots.count(node) > 0;
+                   },
+                   .isWide = [this](ASTExpression* node) {
+                     return isWide(node);
+                   },
+               }, passManager.isEnabled(Pass::STRENGTH_REDUCE)),
+      ready(ready) {
   this->astRoot = astRoot;
 
   auto outputStream = new std::ofstream(filepath, std::ios::binary);
@@ -145,7 +78,7 @@ Generator::Generator(const std::function<void(const Data&)>& ready, ASTNode* ast
       .fileStream = outputStream,
   };
 
-  _output = StreamHelper(file->fileStream);
+  codeBuffers.emplace_back();
 }
 
 Generator::~Generator() {
@@ -156,27 +89,50 @@ void Generator::generate() {
   std::cout << "Generating asm" << std::endl;
 
   comment("BEGIN leading boilerplate");
-  output() << "global main\n";
+  emitDirective("global main");
   comment("END leading boilerplate");
 
   if (astRoot->type == ASTType::BLOCK) {
     auto* block = static_cast<ASTBlock*>(astRoot);
+    // Measured by how much of the tree they leave
+    auto programSize = [block]() {
+      return PassManager::sizeOf(block);
+    };
+    passManager.run(Pass::TAIL_CALLS, [&]() {
+      runTailCalls(block);
+    }, programSize);
+    passManager.run(Pass::INLINE, [&]() {
+      runInliner(block);
+    }, programSize);
+    passManager.run(Pass::UNROLL, [&]() {
+      runUnroller(block);
+    }, programSize);
+    passManager.run(Pass::BRANCH_FOLD, [&]() {
+      runBranchFolder(block);
+    }, programSize);
+    passManager.run(Pass::DEAD_PROCEDURES, [&]() {
+      runDeadProcedures(block);
+    }, programSize);
 
     comment("BEGIN externs");
     for (auto& statement : block->statements) {
       if (statement->type == ASTType::PROC_DECL) {
         auto* procDecl = static_cast<ASTProcedure*>(statement);
         if (procDecl->isExternal) {
-          output() << "extern " << procDecl->ident << "\n";
+          emitDirective("extern " + procDecl->ident);
+          abiCompliantProcedures.insert(procDecl->ident);
         }
       }
     }
     comment("END externs");
 
     comment("BEGIN program");
-    output() << "section .text\n";
+    emitDirective("section .text");
 
     walkBlock(block, true);
+    passManager.run(Pass::LAYOUT, [&]() {
+      runLayout(block);
+    });
     comment("END program");
   } else {
     std::stringstream ssError;
@@ -191,8 +147,29 @@ void Generator::generate() {
     throw std::exception();
   }
 
+  runProcedurePasses();
+  if (options.dumpDataflow) {
+    dumpDataflow();
+  }
+  if (options.timePasses) {
+    passManager.printStatistics(std::cout);
+  }
+
+  // Only the strings still referenced once the passes have finished
+  std::set<std::string> referenced;
+  for (const auto& buffer : codeBuffers) {
+    for (const auto& instruction : buffer.instructions) {
+      for (const auto& operand : instruction.operands) {
+        if (operand.type == Operand::Type::SYMBOL) {
+          referenced.insert(operand.symbol);
+        }
+      }
+    }
+  }
+
+  codeBuffers.emplace_back();
   comment("BEGIN constants");
-  output() << "section .data\n";
+  emitDirective("section .data");
   for (const auto& constantPair : constants) {
     auto str = constantPair.first;
     auto id = constantPair.second;
@@ -203,24 +180,27 @@ void Generator::generate() {
               .codeGenState = Data::CodeGenState::POP_CONSTANT,
               .id = id,
           });
+    if (!referenced.count(id)) continue;
 
-    output() << id << ": db ";
-    writeStringLiteralList(str);
-    output() << ", 0\n";
+    std::stringstream ssConstant;
+    ssConstant << id << ": db ";
+    writeStringLiteralList(ssConstant, str);
+    ssConstant << ", 0";
+    emitDirective(ssConstant.str());
   }
   comment("END constants");
 
-  flushOutput();
+  writeOutput();
   file->fileStream->close();
   std::cout << "Done! See: " << file->filepath << std::endl;
 }
 
-void Generator::writeStringLiteralList(const std::string& str) {
+void Generator::writeStringLiteralList(std::ostream& os, const std::string& str) {
   unsigned int charIndex = 0;
 
   while (charIndex < str.size()) {
     if (charIndex != 0) {
-      output() << ", ";
+      os << ", ";
     }
 
     if (str[charIndex] == '\\') {
@@ -229,11 +209,11 @@ void Generator::writeStringLiteralList(const std::string& str) {
 
         switch (pc) {
           case 'n':
-            output() << "10";
+            os << "10";
             charIndex += 2;
             continue;
           case '0':
-            output() << "0";
+            os << "0";
             charIndex += 2;
             continue;
           default:
@@ -247,7 +227,7 @@ void Generator::writeStringLiteralList(const std::string& str) {
       strSegment.push_back(str[charIndex]);
       charIndex++;
     }
-    output() << "\"" << strSegment << "\"";
+    os << "\"" << strSegment << "\"";
   }
 }
 
@@ -256,31 +236,32 @@ void Generator::walkBlock(ASTBlock* node,
                           const std::function<void(BlockScope&)>& initCallback) {
   enterNode(node, "Block");
 
-  if (!isEntrypoint) {
-    // Set stackbase pointer
-    output() << "push rbp\n";
-    output() << "mov rbp, rsp\n";
-  }
-
-  // Allocate local var space on stack
+  // Locals live in the enclosing procedure's frame (see layoutFrame)
   BlockScope scope = BlockScope();
-  scope.stackHeight = blockScopeStack.size();
   if (!blockScopeStack.empty()) {
     scope.parent = &blockScopeStack.top();
   }
 
+  unsigned int frameOffset = 0;
+  if (!isEntrypoint) {
+    frameOffset = frameOffsets.at(node);
+  }
+
   for (auto statement : node->statements) {
     if (statement->type == ASTType::VARIABLE_DECL) {
       auto* statementNode = static_cast<ASTVariableDeclaration*>(statement);
 
       BlockScope::Variable var = BlockScope::Variable();
-      var.offset = scope.totalLocalBytes;
-      var.location = new Location();
+      unsigned int bytes = bytesOf(statementNode->dataType);
+      var.offset = alignedOffset(frameOffset + scope.totalLocalBytes, bytes);
+      auto promoted = promotedLocals.find(statementNode);
+      var.location = promoted != promotedLocals.end() ? promoted->second.second : new Location();
       var.dataType = statementNode->dataType;
-      var.stackHeight = scope.stackHeight;
       scope.variables.insert_or_assign(statementNode->ident, var);
 
-      scope.totalLocalBytes += bytesOf(statementNode->dataType);
+      if (promoted == promotedLocals.end()) {
+        scope.totalLocalBytes = var.offset + bytes - frameOffset;
+      }
     }
   }
 
@@ -288,10 +269,6 @@ void Generator::walkBlock(ASTBlock* node,
     initCallback(scope);
   }
 
-  if (scope.totalLocalBytes) {
-    output() << "sub rsp, " << scope.totalLocalBytes << "\n";
-  }
-
   blockScopeStack.push(scope);
 
   // Perform block
@@ -300,19 +277,547 @@ void Generator::walkBlock(ASTBlock* node,
   }
 
   // Cleanup
-
   blockScopeStack.pop();
 
-  if (!isEntrypoint) {
-    // Reset stackbase pointer & Dealloc local var space on stack
-    output() << "mov rsp, rbp\n";
-    output() << "pop rbp\n";
+  exitNode(node, "Block");
+}
+
+unsigned int Generator::layoutFrame(ASTStatement* node, unsigned int frameOffset) {
+  switch (node->type) {
+    case BLOCK: {
+      auto* block = static_cast<ASTBlock*>(node);
+      frameOffsets.insert_or_assign(block, frameOffset);
+
+      // The block's own locals sit below anything its parents own
+      unsigned int localsEnd = frameOffset;
+      for (auto statement : block->statements) {
+        if (statement->type == ASTType::VARIABLE_DECL && !promotedLocals.count(static_cast<ASTVariableDeclaration*>(statement))) {
+          unsigned int bytes = bytesOf(static_cast<ASTVariableDeclaration*>(statement)->dataType);
+          localsEnd = alignedOffset(localsEnd, bytes) + bytes;
+        }
+      }
+
+      // Sibling scopes are never alive at the same time, so they share the space after the locals
+      unsigned int highWaterMark = localsEnd;
+      for (auto statement : block->statements) {
+        highWaterMark = std::max(highWaterMark, layoutFrame(statement, localsEnd));
+      }
+      return highWaterMark;
+    }
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      unsigned int highWaterMark = layoutFrame(ifNode->trueStatement, frameOffset);
+      if (ifNode->falseStatement) {
+        highWaterMark = std::max(highWaterMark, layoutFrame(ifNode->falseStatement, frameOffset));
+      }
+      return highWaterMark;
+    }
+    case WHILE:
+      return layoutFrame(static_cast<ASTWhile*>(node)->body, frameOffset);
+    default:
+      return frameOffset;
+  }
+}
+
+// Numbers the statements in walk order and records the last index each ident is read at
+unsigned int Generator::analyseLiveness(ASTStatement* node, unsigned int index) {
+  statementIndices.insert_or_assign(node, index);
+  unsigned int useWeight = 1u << (3 * std::min(loopDepth, 5u));
+
+  switch (node->type) {
+    case BLOCK: {
+      index++;
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        index = analyseLiveness(statement, index);
+      }
+      return index;
+    }
+    case PROC_CALL: {
+      for (auto parameter : static_cast<ASTProcedureCall*>(node)->parameters) {
+        recordReads(parameter, index);
+      }
+      return index + 1;
+    }
+    case VARIABLE_DECL: {
+      auto* declaration = static_cast<ASTVariableDeclaration*>(node);
+      recordReads(declaration->initialValueExpression, index);
+      localDeclarations.push_back(declaration);
+      useWeights[declaration->ident] += useWeight;
+      return index + 1;
+    }
+    case VARIABLE_ASSIGNMENT: {
+      auto* assignment = static_cast<ASTVariableAssignment*>(node);
+      recordReads(assignment->newValueExpression, index);
+      useWeights[assignment->ident] += useWeight;
+      return index + 1;
+    }
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      recordReads(ifNode->conditional, index);
+      index = analyseLiveness(ifNode->trueStatement, index + 1);
+      if (ifNode->falseStatement) {
+        index = analyseLiveness(ifNode->falseStatement, index);
+      }
+      return index;
+    }
+    case WHILE: {
+      auto* whileNode = static_cast<ASTWhile*>(node);
+      unsigned int loopStart = index;
+      loopDepth++;
+      recordReads(whileNode->conditional, index);
+      index = analyseLiveness(whileNode->body, index + 1);
+      loopDepth--;
+
+      // Anything read in the loop is needed again by the next iteration
+      for (auto& lastRead : lastReads) {
+        if (lastRead.second >= loopStart) {
+          lastRead.second = index;
+        }
+      }
+      return index + 1;
+    }
+    default:
+      return index + 1;
+  }
+}
+
+void Generator::recordReads(ASTExpression* node, unsigned int index) {
+  switch (node->type) {
+    case BIN_OP:
+      recordReads(static_cast<ASTBinOp*>(node)->left, index);
+      recordReads(static_cast<ASTBinOp*>(node)->right, index);
+      break;
+    case UNARY_OP:
+      recordReads(static_cast<ASTUnaryOp*>(node)->child, index);
+      break;
+    case VARIABLE: {
+      auto* variable = static_cast<ASTVariableIdent*>(node);
+      lastReads.insert_or_assign(variable->ident, index);
+      useWeights[variable->ident] += 1u << (3 * std::min(loopDepth, 5u));
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static bool readsVariable(ASTExpression* node, const std::string& ident) {
+  switch (node->type) {
+    case BIN_OP:
+      return readsVariable(static_cast<ASTBinOp*>(node)->left, ident)
+          || readsVariable(static_cast<ASTBinOp*>(node)->right, ident);
+    case UNARY_OP:
+      return readsVariable(static_cast<ASTUnaryOp*>(node)->child, ident);
+    case VARIABLE:
+      return static_cast<ASTVariableIdent*>(node)->ident == ident;
+    default:
+      return false;
+  }
+}
+
+static bool endsInJump(ASTStatement* node) {
+  switch (node->type) {
+    case BLOCK: {
+      auto& statements = static_cast<ASTBlock*>(node)->statements;
+      return !statements.empty() && endsInJump(statements.back());
+    }
+    case BREAK:
+    case CONTINUE:
+    case RETURN:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static void collectAssignedIdents(ASTStatement* node, std::set<std::string>& idents) {
+  switch (node->type) {
+    case BLOCK:
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        collectAssignedIdents(statement, idents);
+      }
+      break;
+    case VARIABLE_DECL:
+      idents.insert(static_cast<ASTVariableDeclaration*>(node)->ident);
+      break;
+    case VARIABLE_ASSIGNMENT:
+      idents.insert(static_cast<ASTVariableAssignment*>(node)->ident);
+      break;
+    case IF:
+      collectAssignedIdents(static_cast<ASTIf*>(node)->trueStatement, idents);
+      if (static_cast<ASTIf*>(node)->falseStatement) {
+        collectAssignedIdents(static_cast<ASTIf*>(node)->falseStatement, idents);
+      }
+      break;
+    case WHILE:
+      collectAssignedIdents(static_cast<ASTWhile*>(node)->body, idents);
+      break;
+    default:
+      break;
+  }
+}
+
+// Value numbering over the procedure's structured control flow. `available` holds the expressions whose
+// value is known on every path to the current statement, so each one computed again can be reused instead.
+// Only stores invalidate them: callees can't reach this frame, and the values are kept in frame slots, so
+// they survive calls.
+void Generator::numberExpressions(ASTStatement* node, AvailableExpressions& available) {
+  switch (node->type) {
+    case BLOCK: {
+      auto* block = static_cast<ASTBlock*>(node);
+      for (auto statement : block->statements) {
+        numberExpressions(statement, available);
+      }
+      // Leaving the scope uncovers any variables its locals shadowed
+      for (auto statement : block->statements) {
+        if (statement->type == ASTType::VARIABLE_DECL) {
+          killExpressions(available, static_cast<ASTVariableDeclaration*>(statement)->ident);
+        }
+      }
+      break;
+    }
+    case PROC_CALL:
+      for (auto parameter : static_cast<ASTProcedureCall*>(node)->parameters) {
+        numberValue(parameter, available, false);
+      }
+      break;
+    case VARIABLE_DECL: {
+      auto* declaration = static_cast<ASTVariableDeclaration*>(node);
+      numberValue(declaration->initialValueExpression, available, false);
+      killExpressions(available, declaration->ident);
+      break;
+    }
+    case VARIABLE_ASSIGNMENT: {
+      auto* assignment = static_cast<ASTVariableAssignment*>(node);
+      numberValue(assignment->newValueExpression, available, false);
+      killExpressions(available, assignment->ident);
+      break;
+    }
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      numberCondition(ifNode->conditional, available, false);
+
+      AvailableExpressions availableTrue = available;
+      AvailableExpressions availableFalse = available;
+      numberExpressions(ifNode->trueStatement, availableTrue);
+      if (ifNode->falseStatement) {
+        numberExpressions(ifNode->falseStatement, availableFalse);
+      }
+
+      // Only what both arms that reach the join agree on is still known after it
+      bool trueJoins = !endsInJump(ifNode->trueStatement);
+      bool falseJoins = !ifNode->falseStatement || !endsInJump(ifNode->falseStatement);
+      if (trueJoins && !falseJoins) {
+        available = availableTrue;
+      } else if (falseJoins && !trueJoins) {
+        available = availableFalse;
+      } else if (trueJoins && falseJoins) {
+        available.clear();
+        for (auto& entry : availableTrue) {
+          auto other = availableFalse.find(entry.first);
+          if (other != availableFalse.end() && other->second == entry.second) {
+            available.insert(entry);
+          }
+        }
+      }
+      break;
+    }
+    case WHILE: {
+      auto* whileNode = static_cast<ASTWhile*>(node);
+
+      // Anything the loop assigns may differ from one iteration to the next
+      std::set<std::string> assigned;
+      collectAssignedIdents(whileNode->body, assigned);
+      for (auto& ident : assigned) {
+        killExpressions(available, ident);
+      }
+
+      // Whatever else it computes is the same every time, so the preheader computes it once. This holds
+      // after the loop too, as the preheader runs even when the loop doesn't
+      if (passManager.isEnabled(Pass::HOIST)) {
+        std::vector<ASTExpression*> invariants;
+        collectInvariantsInCondition(whileNode->conditional, assigned, true, invariants);
+        collectInvariants(whileNode->body, assigned, invariants);
+        for (auto* invariant : invariants) {
+          std::string number = valueNumber(invariant);
+          if (available.count(number) > 0) continue;
+
+          available.insert_or_assign(number, invariant);
+          expressionSlots.emplace(invariant, expressionSlots.size());
+          loopInvariants[whileNode].push_back(invariant);
+        }
+      }
+
+      // The condition runs before every iteration and before leaving the loop
+      numberCondition(whileNode->conditional, available, false);
+      AvailableExpressions availableBody = available;
+      numberExpressions(whileNode->body, availableBody);
+
+      for (auto& ident : assigned) {
+        killExpressions(available, ident);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static bool mayTrap(ASTExpression* node) {
+  switch (node->type) {
+    case BIN_OP: {
+      auto* binOp = static_cast<ASTBinOp*>(node);
+      return binOp->op == ExpressionOperatorType::DIVIDE || mayTrap(binOp->left) || mayTrap(binOp->right);
+    }
+    case UNARY_OP:
+      return mayTrap(static_cast<ASTUnaryOp*>(node)->child);
+    default:
+      return false;
+  }
+}
+
+// Adds the largest expressions under `node` that read nothing in `assigned` to `invariants`. Those that may
+// trap (divide by zero) are only moved if the loop would have evaluated them before doing anything else
+void Generator::collectInvariants(ASTExpression* node,
+                                  const std::set<std::string>& assigned,
+                                  bool isAlwaysEvaluated,
+                                  std::vector<ASTExpression*>& invariants) {
+  if (node->type == ASTType::BIN_OP) {
+    auto op = static_cast<ASTBinOp*>(node)->op;
+    if (op == ExpressionOperatorType::LOGICAL_AND || op == ExpressionOperatorType::LOGICAL_OR) {
+      collectInvariantsInCondition(node, assigned, isAlwaysEvaluated, invariants);
+      return;
+    }
+  } else if (node->type != ASTType::UNARY_OP) {
+    return;
+  }
+
+  bool isInvariant = !valueNumber(node).empty() && (isAlwaysEvaluated || !mayTrap(node))
+      && std::none_of(assigned.begin(), assigned.end(), [node](const std::string& ident) {
+        return readsVariable(node, ident);
+      });
+  if (isInvariant) {
+    invariants.push_back(node);
+  } else if (node->type == ASTType::BIN_OP) {
+    collectInvariants(static_cast<ASTBinOp*>(node)->left, assigned, isAlwaysEvaluated, invariants);
+    collectInvariants(static_cast<ASTBinOp*>(node)->right, assigned, isAlwaysEvaluated, invariants);
   } else {
-    // Dealloc local var space on stack
-    output() << "add rsp, " << scope.totalLocalBytes << "\n";
+    collectInvariants(static_cast<ASTUnaryOp*>(node)->child, assigned, isAlwaysEvaluated, invariants);
   }
+}
 
-  exitNode(node, "Block");
+void Generator::collectInvariantsInCondition(ASTExpression* node,
+                                             const std::set<std::string>& assigned,
+                                             bool isAlwaysEvaluated,
+                                             std::vector<ASTExpression*>& invariants) {
+  if (node->type == ASTType::UNARY_OP && static_cast<ASTUnaryOp*>(node)->op == ExpressionOperatorType::LOGICAL_NOT) {
+    collectInvariantsInCondition(static_cast<ASTUnaryOp*>(node)->child, assigned, isAlwaysEvaluated, invariants);
+    return;
+  }
+
+  if (node->type == ASTType::BIN_OP) {
+    auto* binOp = static_cast<ASTBinOp*>(node);
+    switch (binOp->op) {
+      case ExpressionOperatorType::LOGICAL_AND:
+      case ExpressionOperatorType::LOGICAL_OR:
+        collectInvariantsInCondition(binOp->left, assigned, isAlwaysEvaluated, invariants);
+        collectInvariantsInCondition(binOp->right, assigned, false, invariants);
+        return;
+      case ExpressionOperatorType::EQUALS:
+      case ExpressionOperatorType::NOT_EQUALS:
+      case ExpressionOperatorType::LESS_THAN:
+      case ExpressionOperatorType::LESS_THAN_OR_EQUAL:
+      case ExpressionOperatorType::GREATER_THAN:
+      case ExpressionOperatorType::GREATER_THAN_OR_EQUAL:
+        collectInvariants(binOp->left, assigned, isAlwaysEvaluated, invariants);
+        collectInvariants(binOp->right, assigned, isAlwaysEvaluated, invariants);
+        return;
+      default:
+        break;
+    }
+  }
+
+  collectInvariants(node, assigned, isAlwaysEvaluated, invariants);
+}
+
+void Generator::collectInvariants(ASTStatement* node,
+                                  const std::set<std::string>& assigned,
+                                  std::vector<ASTExpression*>& invariants) {
+  switch (node->type) {
+    case BLOCK:
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        collectInvariants(statement, assigned, invariants);
+      }
+      break;
+    case PROC_CALL:
+      for (auto parameter : static_cast<ASTProcedureCall*>(node)->parameters) {
+        collectInvariants(parameter, assigned, false, invariants);
+      }
+      break;
+    case VARIABLE_DECL:
+      collectInvariants(static_cast<ASTVariableDeclaration*>(node)->initialValueExpression, assigned, false, invariants);
+      break;
+    case VARIABLE_ASSIGNMENT:
+      collectInvariants(static_cast<ASTVariableAssignment*>(node)->newValueExpression, assigned, false, invariants);
+      break;
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      collectInvariantsInCondition(ifNode->conditional, assigned, false, invariants);
+      collectInvariants(ifNode->trueStatement, assigned, invariants);
+      if (ifNode->falseStatement) {
+        collectInvariants(ifNode->falseStatement, assigned, invariants);
+      }
+      break;
+    }
+    case WHILE:
+      collectInvariantsInCondition(static_cast<ASTWhile*>(node)->conditional, assigned, false, invariants);
+      collectInvariants(static_cast<ASTWhile*>(node)->body, assigned, invariants);
+      break;
+    default:
+      break;
+  }
+}
+
+// Mirrors walkCondition: comparisons and logical operators there branch rather than produce a value
+void Generator::numberCondition(ASTExpression* node, AvailableExpressions& available, bool isConditional) {
+  if (node->type == ASTType::UNARY_OP && static_cast<ASTUnaryOp*>(node)->op == ExpressionOperatorType::LOGICAL_NOT) {
+    numberCondition(static_cast<ASTUnaryOp*>(node)->child, available, isConditional);
+    return;
+  }
+
+  if (node->type == ASTType::BIN_OP) {
+    auto* binOp = static_cast<ASTBinOp*>(node);
+    switch (binOp->op) {
+      case ExpressionOperatorType::LOGICAL_AND:
+      case ExpressionOperatorType::LOGICAL_OR:
+        // The right side doesn't always run, so nothing it computes can be relied on afterwards
+        numberCondition(binOp->left, available, isConditional);
+        numberCondition(binOp->right, available, true);
+        return;
+      case ExpressionOperatorType::EQUALS:
+      case ExpressionOperatorType::NOT_EQUALS:
+      case ExpressionOperatorType::LESS_THAN:
+      case ExpressionOperatorType::LESS_THAN_OR_EQUAL:
+      case ExpressionOperatorType::GREATER_THAN:
+      case ExpressionOperatorType::GREATER_THAN_OR_EQUAL:
+        numberValue(binOp->left, available, isConditional);
+        numberValue(binOp->right, available, isConditional);
+        return;
+      default:
+        break;
+    }
+  }
+
+  numberValue(node, available, isConditional);
+}
+
+void Generator::numberValue(ASTExpression* node, AvailableExpressions& available, bool isConditional) {
+  if (node->type == ASTType::BIN_OP) {
+    auto op = static_cast<ASTBinOp*>(node)->op;
+    if (op == ExpressionOperatorType::LOGICAL_AND || op == ExpressionOperatorType::LOGICAL_OR) {
+      numberCondition(node, available, isConditional);
+      return;
+    }
+  } else if (node->type != ASTType::UNARY_OP) {
+    return;
+  }
+
+  std::string number = valueNumber(node);
+  auto first = available.find(number);
+  if (!number.empty() && first != available.end()) {
+    reusedExpressions.insert_or_assign(node, first->second);
+    expressionSlots.emplace(first->second, expressionSlots.size());
+    return;
+  }
+
+  if (node->type == ASTType::BIN_OP) {
+    numberValue(static_cast<ASTBinOp*>(node)->left, available, isConditional);
+    numberValue(static_cast<ASTBinOp*>(node)->right, available, isConditional);
+  } else {
+    numberValue(static_cast<ASTUnaryOp*>(node)->child, available, isConditional);
+  }
+
+  if (!number.empty() && !isConditional) {
+    available.insert_or_assign(number, node);
+  }
+}
+
+// Expressions computing the same value from the same variables get the same number; empty if it can't be reused
+std::string Generator::valueNumber(ASTExpression* node) {
+  std::stringstream ss;
+  switch (node->type) {
+    case VARIABLE:
+      return static_cast<ASTVariableIdent*>(node)->ident;
+    case LITERAL: {
+      auto* literal = static_cast<ASTLiteral*>(node);
+      if (literal->valueType != ASTLiteral::ValueType::INTEGER) return "";
+      ss << "#" << literal->value.integerData;
+      return ss.str();
+    }
+    case UNARY_OP: {
+      auto* unaryOp = static_cast<ASTUnaryOp*>(node);
+      std::string child = valueNumber(unaryOp->child);
+      if (child.empty() || unaryOp->op == ExpressionOperatorType::ADD) return "";
+      ss << "(" << unaryOp->op << " " << child << ")";
+      return ss.str();
+    }
+    case BIN_OP: {
+      auto* binOp = static_cast<ASTBinOp*>(node);
+      if (binOp->op == ExpressionOperatorType::LOGICAL_AND || binOp->op == ExpressionOperatorType::LOGICAL_OR) {
+        return "";
+      }
+      std::string left = valueNumber(binOp->left);
+      std::string right = valueNumber(binOp->right);
+      if (left.empty() || right.empty()) return "";
+
+      bool isCommutative = binOp->op == ExpressionOperatorType::ADD || binOp->op == ExpressionOperatorType::MULTIPLY
+          || binOp->op == ExpressionOperatorType::EQUALS || binOp->op == ExpressionOperatorType::NOT_EQUALS;
+      if (isCommutative && right < left) {
+        std::swap(left, right);
+      }
+      ss << "(" << binOp->op << " " << left << " " << right << ")";
+      return ss.str();
+    }
+    default:
+      return "";
+  }
+}
+
+void Generator::killExpressions(AvailableExpressions& available, const std::string& ident) {
+  for (auto it = available.begin(); it != available.end();) {
+    it = readsVariable(it->second, ident) ? available.erase(it) : std::next(it);
+  }
+}
+
+// Gives the most used locals a register of their own for the whole procedure
+void Generator::promoteLocals() {
+  promotedLocals.clear();
+
+  unsigned int totalPromoted = std::min((unsigned int) TOTAL_REGISTERS - MIN_TEMPORARY_REGISTERS,
+                                        (unsigned int) TOTAL_PROMOTED_LOCAL_REGISTERS);
+
+  std::vector<ASTVariableDeclaration*> candidates = localDeclarations;
+  std::stable_sort(candidates.begin(), candidates.end(), [&](ASTVariableDeclaration* a, ASTVariableDeclaration* b) {
+    return useWeights[a->ident] > useWeights[b->ident];
+  });
+
+  for (size_t i = 0; i < candidates.size() && i < totalPromoted; ++i) {
+    Register reg = promotedLocalRegisterOrder[i];
+    auto* location = new Location();
+    location->isPromoted = true;
+    promotedLocals.insert_or_assign(candidates[i], std::make_pair(reg, location));
+    registerResidentIdents.insert_or_assign(location, candidates[i]->ident);
+
+    registerContents[reg] = location;
+    locationMap.insert_or_assign(location, reg);
+    ready({
+              .mode = Data::Mode::CODE_GEN,
+              .type = Data::Type::SPECIFIC,
+              .codeGenState = Data::CodeGenState::SET_REG_AND_LOC,
+              .reg = reg,
+              .loc = location,
+          });
+  }
 }
 
 void Generator::walkStatement(ASTStatement* node) {
@@ -374,11 +879,19 @@ void Generator::walkStatement(ASTStatement* node) {
 }
 
 Location* Generator::walkExpression(ASTExpression* node) {
+  auto reused = reusedExpressions.find(node);
+  if (reused != reusedExpressions.end()) {
+    return recallExpression(node, reused->second);
+  }
+
+  Location* location;
   switch (node->type) {
     case BIN_OP:
-      return walkBinOp(static_cast<ASTBinOp*>(node));
+      location = walkBinOp(static_cast<ASTBinOp*>(node));
+      break;
     case UNARY_OP:
-      return walkUnaryOp(static_cast<ASTUnaryOp*>(node));
+      location = walkUnaryOp(static_cast<ASTUnaryOp*>(node));
+      break;
     case LITERAL:
       return walkLiteral(static_cast<ASTLiteral*>(node));
     case VARIABLE:
@@ -395,13 +908,20 @@ Location* Generator::walkExpression(ASTExpression* node) {
       file->fileStream->close();
       throw std::exception();
   }
+
+  // Later occurrences read it back rather than computing it again
+  auto slot = expressionSlots.find(node);
+  if (slot != expressionSlots.end()) {
+    emit("mov", {expressionSlot(slot->second), locationMap.at(location)}, "kept for reuse");
+  }
+  return location;
 }
 
 void Generator::walkVariableDeclaration(ASTVariableDeclaration* node) {
   enterNode(node, "VariableDeclaration");
 
   Location* loc = walkExpression(node->initialValueExpression);
-  moveToMem(node->ident, loc, bytesOf(node->dataType));
+  assignVariable(node->ident, loc, bytesOf(node->dataType));
 
   removeLocation(loc);
 
@@ -409,6 +929,13 @@ void Generator::walkVariableDeclaration(ASTVariableDeclaration* node) {
 }
 
 void Generator::walkProcedureDeclaration(ASTProcedure* node) {
+  // Each internal procedure gets its own buffer so the peephole pass never looks across procedures, and the layout
+  // can move it as a whole
+  std::string enclosingProcedure = codeBuffers.back().procedure;
+  if (!node->isExternal) {
+    codeBuffers.push_back(CodeBuffer{node->ident});
+  }
+
   enterNode(node, "ProcedureDeclaration");
 
   if (node->isExternal) {
@@ -452,16 +979,83 @@ void Generator::walkProcedureDeclaration(ASTProcedure* node) {
 
   } else {
 
-    std::vector<Location*> parameterLocations;
+    Label labelEpilogue;
+
+    statementIndices.clear();
+    lastReads.clear();
+    useWeights.clear();
+    localDeclarations.clear();
+    registerResidentIdents.clear();
+
+    // Register parameters are copied out of their argument registers on entry, so compete with the locals for a
+    // register of their own and otherwise live in the frame like them
+    unsigned int totalParamsInRegisters = std::min(node->parameters.size(), (size_t) TOTAL_PROC_CALL_REGISTERS);
+    for (unsigned int i = 0; i < totalParamsInRegisters; ++i) {
+      localDeclarations.push_back(node->parameters[i]);
+      useWeights[node->parameters[i]->ident]++;
+    }
+    analyseLiveness(node->block, 0);
+    if (passManager.isEnabled(Pass::PROMOTE_LOCALS)) {
+      promoteLocals();
+    }
+
+    unsigned int parameterHomesSize = 0;
+    for (unsigned int i = 0; i < totalParamsInRegisters; ++i) {
+      if (!promotedLocals.count(node->parameters[i])) {
+        unsigned int bytes = bytesOf(node->parameters[i]->dataType);
+        parameterHomesSize = alignedOffset(parameterHomesSize, bytes) + bytes;
+      }
+    }
 
-    // Write head
-    output() << node->ident << ":\n";
+    expressionSlots.clear();
+    sharedReads.clear();
+    reusedExpressions.clear();
+    loopInvariants.clear();
+    if (passManager.isEnabled(Pass::VALUE_NUMBERING)) {
+      AvailableExpressions available;
+      numberExpressions(node->block, available);
+    }
+
+    // Lay out every block's other locals in one frame, followed by the slots for reused expressions and
+    // for saving registers
+    frameOffsets.clear();
+    unsigned int localsSize = layoutFrame(node->block, parameterHomesSize);
+    expressionSlotOffset = (localsSize + 7) & ~7u;
+    callSaveOffset = expressionSlotOffset + expressionSlots.size() * 8;
+    callSaveSlots = 0;
+
+    abiCompliantProcedures.insert(node->ident);
+    internalProcedures.insert(node->ident);
+
+    // main still sets the exit code after its last statement, and arguments passed on the stack would need the
+    // caller's own argument area
+    tailCalls.clear();
+    tailCallIndices.clear();
+    if (node->ident != "main" && node->parameters.size() <= TOTAL_PROC_CALL_REGISTERS) {
+      ASTStatement* body = node->block;
+      std::vector<ASTStatement**> calls;
+      TailCalls::find(body, calls);
+      for (auto slot : calls) {
+        auto* call = static_cast<ASTProcedureCall*>(*slot);
+        if (internalProcedures.count(call->ident) && call->parameters.size() <= TOTAL_PROC_CALL_REGISTERS) {
+          tailCalls.insert(call);
+        }
+      }
+    }
+
+    CodeBuffer& buffer = codeBuffers.back();
+
+    // Write head; the frame is allocated once the body is known. There is no frame pointer: the body addresses
+    // the frame from rbp as if there were one, and rsp never moves after the head, so those operands are rebased
+    // onto rsp at the end
+    emitLabel(node->ident);
+    size_t frameAllocationIndex = buffer.instructions.size();
 
     // Write block
     walkBlock(node->block, false, [&](BlockScope& scope) -> void {
       scope.isProcedureBlock = true;
-      // TODO set scope.endLabel (required for `return`)
-      // What do we do for procs with return data types?
+      scope.endLabel = labelEpilogue;
+      // TODO What do we do for procs with return data types?
 
       // Add procedure to block's scope
       BlockScope::Procedure proc = BlockScope::Procedure();
@@ -469,15 +1063,12 @@ void Generator::walkProcedureDeclaration(ASTProcedure* node) {
       // Add parameters to block's scope
       unsigned int totalParamStackBytes = 0;
       unsigned int totalParamsInRegisters = 0;
+      unsigned int parameterHomesEnd = 0;
       for (auto parameter : node->parameters) {
         BlockScope::Variable var = BlockScope::Variable();
         BlockScope::Procedure::Parameter* param = new BlockScope::Procedure::Parameter(); //@LEAK
 
-        var.parameter = param;
-        var.location = new Location();
-        var.location->isParameter = true;
         var.dataType = parameter->dataType;
-        var.stackHeight = scope.stackHeight;
 
         param->dataType = parameter->dataType;
 
@@ -492,23 +1083,31 @@ void Generator::walkProcedureDeclaration(ASTProcedure* node) {
         switch (param->paramClass) {
           case MEMORY: {
             // Use stack
+            var.parameter = param;
+            var.location = new Location();
             var.offset = totalParamStackBytes;
-            totalParamStackBytes += bytesOf(parameter->dataType);
+            totalParamStackBytes += 8; // Each takes a whole eightbyte
             break;
           }
           case INTEGER: {
-            // Use register
+            // Use register, only until it is copied to the parameter's own home; the argument registers are then
+            // free for anything else
             param->paramRegister = procCallRegisterOrder[totalParamsInRegisters++];
-
-            registerContents[param->paramRegister] = var.location;
-            locationMap.insert_or_assign(var.location, param->paramRegister);
-            ready({
-                      .mode = Data::Mode::CODE_GEN,
-                      .type = Data::Type::SPECIFIC,
-                      .codeGenState = Data::CodeGenState::SET_REG_AND_LOC,
-                      .reg = param->paramRegister,
-                      .loc = var.location,
-                  });
+            unsigned int bytes = bytesOf(parameter->dataType);
+
+            auto promoted = promotedLocals.find(parameter);
+            if (promoted != promotedLocals.end()) {
+              Register home = promoted->second.first;
+              var.location = promoted->second.second;
+              // Only the low bytes of an argument register are defined
+              emitSignExtend(home, Operand(param->paramRegister, bytes), "parameter " + parameter->ident);
+            } else {
+              var.location = new Location();
+              var.offset = alignedOffset(parameterHomesEnd, bytes);
+              parameterHomesEnd = var.offset + bytes;
+              emit("mov", {addressOfVariable(var), Operand(param->paramRegister, bytes)},
+                   "parameter " + parameter->ident);
+            }
             break;
           }
           default:
@@ -518,8 +1117,6 @@ void Generator::walkProcedureDeclaration(ASTProcedure* node) {
 
         proc.parameters.push_back(param);
         scope.variables.insert_or_assign(parameter->ident, var);
-
-        parameterLocations.push_back(var.location);
       }
 
       if (scope.parent) {
@@ -537,21 +1134,101 @@ void Generator::walkProcedureDeclaration(ASTProcedure* node) {
       }
     });
 
+    // Callee saved registers the body touched get a slot after the call save slots
+    std::vector<Register> usedCalleSaved;
+    for (auto reg : calleSavedRegisters) {
+      for (auto& instruction : buffer.instructions) {
+        bool isUsed = false;
+        for (auto& operand : instruction.operands) {
+          isUsed |= operand.registersRead() & registerMask(reg);
+        }
+        if (isUsed) {
+          usedCalleSaved.push_back(reg);
+          break;
+        }
+      }
+    }
+    unsigned int calleSaveOffset = callSaveOffset + callSaveSlots * 8;
+    auto calleSaveSlot = [&](size_t i) {
+      return Operand::memory(Register::RBP, -(long long) (calleSaveOffset + (i + 1) * 8));
+    };
+
+    // Leaf procedures keep a frame that fits in the red zone without moving rsp. Otherwise rsp has to stay 16 byte
+    // aligned for calls, and it is 8 bytes off on entry because of the return address.
+    unsigned int frameSize = calleSaveOffset + usedCalleSaved.size() * 8;
+    bool isLeaf = passManager.isEnabled(Pass::RED_ZONE) && std::none_of(buffer.instructions.begin(), buffer.instructions.end(), [](const Instruction& i) {
+      return i.isInstruction() && i.mnemonic == "call";
+    });
+    unsigned int allocation = 0;
+    if (!isLeaf || frameSize > RED_ZONE_SIZE) {
+      allocation = ((frameSize + 8 + 15) & ~15u) - 8;
+    }
+
+    std::vector<Instruction> teardown;
+    for (size_t i = 0; i < usedCalleSaved.size(); ++i) {
+      Instruction restore;
+      restore.mnemonic = "mov";
+      restore.operands = {usedCalleSaved[i], calleSaveSlot(i)};
+      teardown.push_back(restore);
+    }
+    if (allocation) {
+      Instruction deallocate;
+      deallocate.mnemonic = "add";
+      deallocate.operands = {Register::RSP, (long long) allocation};
+      teardown.push_back(deallocate);
+    }
+
     // Write tail
+    emitLabel(labelEpilogue);
     if (node->ident == "main") {
       comment("BEGIN main exit boilerplate");
-      output() << "mov rax, 1\n"
-             << "xor rdi, rdi\n"
-             << "syscall\n";
+      emit("xor", {Register::RAX, Register::RAX}); // Exit code
       comment("END main exit boilerplate");
-    } else {
-      output() << "ret\n";
     }
+    for (const auto& instruction : teardown) {
+      emitInstruction(instruction);
+    }
+    emit("ret");
+
+    // Tail calls leave the same way, leaving rsp where the callee expects its return address
+    for (auto index = tailCallIndices.rbegin(); index != tailCallIndices.rend(); ++index) {
+      buffer.instructions.insert(buffer.instructions.begin() + *index, teardown.begin(), teardown.end());
+    }
+
+    // Finish the head now the frame is complete
+    std::vector<Instruction> head;
+    if (allocation) {
+      Instruction allocate;
+      allocate.mnemonic = "sub";
+      allocate.operands = {Register::RSP, (long long) allocation};
+      head.push_back(allocate);
+    }
+    for (size_t i = 0; i < usedCalleSaved.size(); ++i) {
+      Instruction save;
+      save.mnemonic = "mov";
+      save.operands = {calleSaveSlot(i), usedCalleSaved[i]};
+      head.push_back(save);
+    }
+    buffer.instructions.insert(buffer.instructions.begin() + frameAllocationIndex, head.begin(), head.end());
+
+    // Where rbp would have pointed is the entry rsp less the return address, which is now rsp plus the allocation
+    for (auto& instruction : buffer.instructions) {
+      for (auto& operand : instruction.operands) {
+        if (operand.type == Operand::Type::MEMORY && operand.reg == Register::RBP) {
+          operand.reg = Register::RSP;
+          // Stack parameters were past a saved rbp that is no longer pushed
+          operand.value += (long long) allocation - (operand.value > 0 ? 8 : 0);
+        }
+      }
+    }
+
+    codeBuffers.push_back(CodeBuffer{enclosingProcedure});
 
-    // Remove params from internal map
-    for (auto* loc : parameterLocations) {
-      removeLocation(loc, true);
+    // Remove promoted locals (and parameters) from internal map
+    for (auto& promoted : promotedLocals) {
+      removeLocation(promoted.second.second, true);
     }
+    promotedLocals.clear();
 
   }
 
@@ -615,7 +1292,15 @@ void Generator::walkProcedureCall(ASTProcedureCall* node) {
       case INTEGER: {
         // Use register
         Register reg = procCallRegisterOrder[registersUsed++];
-        moveToRegister(reg, paramLocs[i], requiredRegistersForParams);
+        bool isShared = std::find(paramLocs.begin(), paramLocs.begin() + i, paramLocs[i]) != paramLocs.begin() + i;
+        if ((paramLocs[i]->isPinned() || isShared) && locationMap.at(paramLocs[i]) != reg) {
+          // Pinned values, and values already passed in another register, stay where they are; the callee gets a copy
+          auto* copyLoc = new Location();
+          copyToRegister(reg, paramLocs[i], copyLoc, requiredRegistersForParams);
+          paramLocs[i] = copyLoc;
+        } else {
+          moveToRegister(reg, paramLocs[i], requiredRegistersForParams);
+        }
         break;
       }
       default:
@@ -623,11 +1308,19 @@ void Generator::walkProcedureCall(ASTProcedureCall* node) {
         throw std::exception();
     }
   }
-  output() << "xor rax, rax\n"; //zero rax because printf is varargs & no floats
-
-  auto savedRegisters = pushCallerSaved();
+  // Nothing in this procedure runs after a tail call, so nothing needs saving and the callee returns straight to
+  // our caller; the frame is torn down in front of the jump once its size is known
+  bool isTailCall = tailCalls.count(node) > 0;
+  std::vector<std::pair<Register, Location*>> savedRegisters;
+  if (isTailCall) {
+    tailCallIndices.push_back(codeBuffers.back().instructions.size());
+    emit("jmp", {Operand::symbolic(node->ident)}, "tail call");
+  } else {
+    savedRegisters = saveCallerSaved(statementIndices.at(node));
 
-  output() << "call " << node->ident << "\n";
+    emit("xor", {Register::RAX, Register::RAX}); //zero rax because printf is varargs & no floats
+    emit("call", {Operand::symbolic(node->ident)});
+  }
 
   for (size_t i = 0; i < paramLocs.size(); ++i) {
     if (i < TOTAL_PROC_CALL_REGISTERS) {
@@ -639,7 +1332,16 @@ void Generator::walkProcedureCall(ASTProcedureCall* node) {
     }
   }
 
-  popCallerSaved(savedRegisters);
+  // Whatever is left in a caller saved register was dead and has now been clobbered. Pinned values
+  // keep their register as nothing reads them again
+  for (int i = 0; i < TOTAL_REGISTERS; ++i) {
+    auto reg = (Register) i;
+    if (registerContents[reg] != nullptr && !isCalleSaved(reg) && !registerContents[reg]->isPinned()) {
+      removeLocation(reg, nullptr, true);
+    }
+  }
+
+  restoreCallerSaved(savedRegisters);
 
   // Remove params from internal map
   for (auto* loc : paramLocs) {
@@ -654,7 +1356,7 @@ void Generator::walkVariableAssignment(ASTVariableAssignment* node) {
 
   auto var = blockScopeStack.top().searchForVariable(node->ident);
   Location* loc = walkExpression(node->newValueExpression);
-  moveToMem(node->ident, loc, bytesOf(var.dataType));
+  assignVariable(node->ident, loc, bytesOf(var.dataType));
 
   removeLocation(loc);
 
@@ -664,68 +1366,182 @@ void Generator::walkVariableAssignment(ASTVariableAssignment* node) {
 void Generator::walkIf(ASTIf* node) {
   enterNode(node, "If");
 
+  if (passManager.isEnabled(Pass::IF_CONVERT) && walkIfAsSelect(node)) {
+    exitNode(node, "If");
+    return;
+  }
+
   Label labelFalse(node->falseStatement), labelEnd;
 
   // Condition
-  walkExpression(node->conditional);
-  auto* tempLoc = new Location();
-  Register regConditionalResult = getRegisterForCopy(node->conditional->location, tempLoc);
-
-  output() << "test " << regConditionalResult << ", " << regConditionalResult << "\n";
-  removeLocation(regConditionalResult, tempLoc);
-  removeLocation(node->conditional->location, false);
-
-  if (node->falseStatement) {
-    output() << "jz " << labelFalse << "\n";
-  } else {
-    output() << "jz " << labelEnd << "\n";
-  }
+  walkCondition(node->conditional, node->falseStatement ? labelFalse : labelEnd, false);
 
   // True
   walkStatement(node->trueStatement);
 
   // False
   if (node->falseStatement) {
-    output() << "jmp " << labelEnd << "\n";
-    output() << labelFalse << ":\n";
+    emit("jmp", {labelEnd});
+    emitLabel(labelFalse);
 
     walkStatement(node->falseStatement);
   }
 
   // End
-  output() << labelEnd << ":\n";
+  emitLabel(labelEnd);
 
   exitNode(node, "If");
 }
 
-void Generator::walkWhile(ASTWhile* node) {
-  enterNode(node, "While");
+// The statement when it is a single assignment, alone or in a block of its own
+static ASTVariableAssignment* onlyAssignment(ASTStatement* node) {
+  while (node && node->type == ASTType::BLOCK && static_cast<ASTBlock*>(node)->statements.size() == 1) {
+    node = static_cast<ASTBlock*>(node)->statements[0];
+  }
+  if (!node || node->type != ASTType::VARIABLE_ASSIGNMENT) return nullptr;
+  return static_cast<ASTVariableAssignment*>(node);
+}
+
+// Whether `node` can be computed when its value isn't wanted: it mustn't fault, and branching inside it would
+// defeat the point
+static bool isSafeToSpeculate(ASTExpression* node) {
+  switch (node->type) {
+    case ASTType::BIN_OP: {
+      auto* binOp = static_cast<ASTBinOp*>(node);
+      if (binOp->op == ExpressionOperatorType::LOGICAL_AND || binOp->op == ExpressionOperatorType::LOGICAL_OR) {
+        return false;
+      }
+      unsigned long long divisor;
+      if (binOp->op == ExpressionOperatorType::DIVIDE
+          && !(InstructionSelector::isIntegerLiteral(binOp->right, divisor) && divisor != 0)) {
+        return false;
+      }
+      return isSafeToSpeculate(binOp->left) && isSafeToSpeculate(binOp->right);
+    }
+    case ASTType::UNARY_OP:
+      return isSafeToSpeculate(static_cast<ASTUnaryOp*>(node)->child);
+    default:
+      return true;
+  }
+}
 
-  Label labelStart, labelEnd;
+// `if (c) { x = a; } else { x = b; }` and `if (c) { x = a; }` compute both values and pick one with cmov, instead of
+// branching on what may be hard to predict, when both are cheap and safe to compute either way. Nothing between the
+// cmp and the cmov may touch the flags, so the values are computed before the condition.
+bool Generator::walkIfAsSelect(ASTIf* node) {
+  ASTVariableAssignment* trueArm = onlyAssignment(node->trueStatement);
+  ASTVariableAssignment* falseArm = onlyAssignment(node->falseStatement);
+  if (!trueArm || (node->falseStatement && (!falseArm || falseArm->ident != trueArm->ident))) return false;
+
+  if (node->conditional->type == ASTType::BIN_OP) {
+    auto op = static_cast<ASTBinOp*>(node->conditional)->op;
+    if (op == ExpressionOperatorType::LOGICAL_AND || op == ExpressionOperatorType::LOGICAL_OR) return false;
+  } else if (node->conditional->type == ASTType::UNARY_OP
+      && static_cast<ASTUnaryOp*>(node->conditional)->op == ExpressionOperatorType::LOGICAL_NOT) {
+    return false;
+  }
+
+  unsigned int cost = 0;
+  for (auto arm : {trueArm, falseArm}) {
+    if (!arm) continue;
+    if (!isSafeToSpeculate(arm->newValueExpression)) return false;
+    cost += selector.select(arm->newValueExpression).cost;
+  }
+  if (cost > IF_CONVERSION_COST_LIMIT) return false;
+
+  BlockScope::Variable var = blockScopeStack.top().searchForVariable(trueArm->ident);
+  unsigned int bytes = bytesOf(var.dataType);
+  // A register variable with no register at the moment is never read again, which assignVariable deals with
+  if (var.location->isPinned() && !locationMap.count(var.location)) return false;
+
+  comment("if converted to cmov");
+
+  // The true value is picked over in place, so it has to be a copy
+  enterNode(trueArm, "VariableAssignment");
+  Location* trueLocation = walkExpression(trueArm->newValueExpression);
+  if (!isTemporary(trueArm->newValueExpression)) {
+    auto* copy = new Location();
+    getRegisterForCopy(trueLocation, copy);
+    removeLocation(trueLocation, false);
+    trueLocation = copy;
+  }
+  exitNode(trueArm, "VariableAssignment");
+
+  // Without an else the variable keeps its value
+  Location* falseLocation;
+  if (falseArm) {
+    enterNode(falseArm, "VariableAssignment");
+    falseLocation = walkExpression(falseArm->newValueExpression);
+    exitNode(falseArm, "VariableAssignment");
+  } else if (var.location->isPinned()) {
+    falseLocation = var.location;
+  } else {
+    falseLocation = recallFromMem(trueArm->ident, bytes);
+  }
 
-  // Condition
-  output() << labelStart << ":\n";
+  std::string conditionCode = emitComparison(node->conditional);
+  Register regTrue = getRegisterFor(trueLocation);
+  Register regFalse = getRegisterFor(falseLocation);
+  emit("cmov" + invertConditionCode(conditionCode), {regTrue, regFalse});
 
-  walkExpression(node->conditional);
-  auto* tempLoc = new Location();
-  Register regConditionalResult = getRegisterForCopy(node->conditional->location, tempLoc);
+  assignVariable(trueArm->ident, trueLocation, bytes);
+  removeLocation(falseLocation, false);
+  removeLocation(trueLocation);
+  return true;
+}
+
+void Generator::walkWhile(ASTWhile* node) {
+  enterNode(node, "While");
 
-  output() << "test " << regConditionalResult << ", " << regConditionalResult << "\n";
-  removeLocation(regConditionalResult, tempLoc);
-  removeLocation(node->conditional->location, false);
+  Label labelBody, labelContinue, labelEnd;
+
+  // Preheader, computing what is the same on every iteration once
+  auto invariants = loopInvariants.find(node);
+  if (invariants != loopInvariants.end()) {
+    comment("BEGIN preheader");
+    for (auto* invariant : invariants->second) {
+      Location* location = invariant->type == ASTType::BIN_OP
+          ? walkBinOp(static_cast<ASTBinOp*>(invariant))
+          : walkUnaryOp(static_cast<ASTUnaryOp*>(invariant));
+      emit("mov", {expressionSlot(expressionSlots.at(invariant)), locationMap.at(location)}, "loop invariant");
+      removeLocation(location);
+    }
+    comment("END preheader");
+  }
 
-  output() << "jz " << labelEnd << "\n";
+  // Rotated into a guarded do-while, so each iteration only takes the backedge: the condition is tested once
+  // on entry, then again at the bottom of every iteration. Otherwise it is tested at the top, and the bottom
+  // jumps back to it
+  bool isRotated = passManager.isEnabled(Pass::ROTATE_LOOPS);
+  if (isRotated) {
+    walkCondition(node->conditional, labelEnd, false);
+  }
 
   // Body
-  walkBlock(node->body, false, [labelStart, labelEnd](BlockScope& scope) -> void {
-    scope.startLabel = labelStart;
+  if (passManager.isEnabled(Pass::ALIGN_LOOPS)) {
+    emitDirective("align 16");
+  }
+  if (isRotated) {
+    emitLabel(labelBody);
+  } else {
+    emitLabel(labelContinue);
+    walkCondition(node->conditional, labelEnd, false);
+  }
+  walkBlock(node->body, false, [labelContinue, labelEnd](BlockScope& scope) -> void {
+    scope.startLabel = labelContinue;
     scope.endLabel = labelEnd;
   });
 
-  output() << "jmp " << labelStart << "\n";
+  // Condition
+  if (isRotated) {
+    emitLabel(labelContinue);
+    walkCondition(node->conditional, labelBody, true);
+  } else {
+    emit("jmp", {labelContinue});
+  }
 
   // End
-  output() << labelEnd << ":\n";
+  emitLabel(labelEnd);
 
   exitNode(node, "While");
 }
@@ -739,16 +1555,8 @@ void Generator::walkContinue(ASTContinue* node) {
       break;
     }
     if (scope->startLabel.exists()) {
-      // Cleanly end blocks before jump
-      unsigned int stackHeightDist = blockScopeStack.top().stackHeight - scope->stackHeight + 1;
-      for (unsigned int i = 0; i < stackHeightDist; ++i) {
-        // Reset stackbase pointer & Dealloc local var space on stack
-        output() << "mov rsp, rbp\n";
-        output() << "pop rbp\n";
-      }
-
-      // Jump
-      output() << "jmp " << scope->startLabel << "\n";
+      // Every block shares the procedure's frame, so there is nothing to unwind
+      emit("jmp", {scope->startLabel});
       break;
     } else {
       scope = scope->parent;
@@ -767,16 +1575,8 @@ void Generator::walkBreak(ASTBreak* node) {
       break;
     }
     if (scope->endLabel.exists()) {
-      // Cleanly end blocks before jump
-      unsigned int stackHeightDist = blockScopeStack.top().stackHeight - scope->stackHeight + 1;
-      for (unsigned int i = 0; i < stackHeightDist; ++i) {
-        // Reset stackbase pointer & Dealloc local var space on stack
-        output() << "mov rsp, rbp\n";
-        output() << "pop rbp\n";
-      }
-
-      // Jump
-      output() << "jmp " << scope->endLabel << "\n";
+      // Every block shares the procedure's frame, so there is nothing to unwind
+      emit("jmp", {scope->endLabel});
       break;
     } else {
       scope = scope->parent;
@@ -793,16 +1593,8 @@ void Generator::walkReturn(ASTReturn* node) {
   while (scope) {
     if (scope->isProcedureBlock) {
       if (scope->endLabel.exists()) {
-        // Cleanly end blocks before jump
-        unsigned int stackHeightDist = blockScopeStack.top().stackHeight - scope->stackHeight + 1;
-        for (unsigned int i = 0; i < stackHeightDist; ++i) {
-          // Reset stackbase pointer & Dealloc local var space on stack
-          output() << "mov rsp, rbp\n";
-          output() << "pop rbp\n";
-        }
-
-        // Jump
-        output() << "jmp " << scope->endLabel << "\n";
+        // Jump to the procedure's epilogue
+        emit("jmp", {scope->endLabel});
         break;
       }
       break;
@@ -813,48 +1605,186 @@ void Generator::walkReturn(ASTReturn* node) {
   exitNode(node, "Return");
 }
 
-Location* Generator::walkBinOp(ASTBinOp* node) {
-  enterNode(node, "BinOp");
-  //DEFER: comment("END BinOp");
+// Condition code that holds after `cmp left, right` when the comparison is true; empty if it isn't one
+static std::string conditionCodeOf(ExpressionOperatorType op) {
+  switch (op) {
+    case ExpressionOperatorType::EQUALS:
+      return "z";
+    case ExpressionOperatorType::NOT_EQUALS:
+      return "nz";
+    case ExpressionOperatorType::LESS_THAN:
+      return "l";
+    case ExpressionOperatorType::LESS_THAN_OR_EQUAL:
+      return "le";
+    case ExpressionOperatorType::GREATER_THAN:
+      return "g";
+    case ExpressionOperatorType::GREATER_THAN_OR_EQUAL:
+      return "ge";
+    default:
+      return "";
+  }
+}
+
+// Branches to `target` when the condition's truth matches `jumpIfTrue`, otherwise falls through
+void Generator::walkCondition(ASTExpression* node, const Label& target, bool jumpIfTrue) {
+  // Decided already, so either always taken or never
+  unsigned long long constant;
+  if (InstructionSelector::isIntegerLiteral(node, constant)) {
+    if ((constant != 0) == jumpIfTrue) {
+      emit("jmp", {target});
+    }
+    return;
+  }
 
-  // Special case for Logical Or: Don't walk right side if left is true
-  if (node->op == ExpressionOperatorType::LOGICAL_OR) {
-    walkExpression(node->left);
-    auto* tempLeftLoc = new Location();
-    Register regLeft = getRegisterForCopy(node->left->location, tempLeftLoc);
+  if (node->type == ASTType::UNARY_OP) {
+    auto* unaryOp = static_cast<ASTUnaryOp*>(node);
+    if (unaryOp->op == ExpressionOperatorType::LOGICAL_NOT) {
+      enterNode(unaryOp, "UnaryOp");
+      walkCondition(unaryOp->child, target, !jumpIfTrue);
+      exitNode(unaryOp, "UnaryOp");
+      return;
+    }
+  }
 
-    walkExpression(node->right);
-    Register regRight = getRegisterFor(node->right->location);
+  if (node->type == ASTType::BIN_OP) {
+    auto* binOp = static_cast<ASTBinOp*>(node);
 
-    removeLocation(node->left->location, false);
+    // The right side is only reached when the left side hasn't already decided the result
+    if (binOp->op == ExpressionOperatorType::LOGICAL_AND || binOp->op == ExpressionOperatorType::LOGICAL_OR) {
+      enterNode(binOp, "BinOp");
 
-    std::cout << "LOGICAL_OR not implemented" << std::endl;
-    file->fileStream->close();
-    throw std::exception();
+      // `a && b` is false as soon as `a` is, and `a || b` is true as soon as `a` is
+      bool shortCircuitsOn = binOp->op == ExpressionOperatorType::LOGICAL_OR;
+      if (InstructionSelector::isIntegerLiteral(binOp->left, constant)) {
+        // Either the left side decides it, or it all comes down to the right
+        walkCondition((constant != 0) == shortCircuitsOn ? binOp->left : binOp->right, target, jumpIfTrue);
+      } else if (shortCircuitsOn == jumpIfTrue) {
+        walkCondition(binOp->left, target, jumpIfTrue);
+        walkCondition(binOp->right, target, jumpIfTrue);
+      } else {
+        Label labelDecided;
+        walkCondition(binOp->left, labelDecided, shortCircuitsOn);
+        walkCondition(binOp->right, target, jumpIfTrue);
+        emitLabel(labelDecided);
+      }
+
+      exitNode(binOp, "BinOp");
+      return;
+    }
+  }
+
+  // Whether this runs depends on the tests before it, so it mustn't leave anything where only its path would find
+  // it: every jump and the fall through see the registers as they were
+  RegisterState saved = saveRegisters();
+  std::string conditionCode = emitComparison(node);
+  restoreRegisters(saved);
+  emit("j" + (jumpIfTrue ? conditionCode : invertConditionCode(conditionCode)), {target});
+}
+
+// Sets the flags from `node`, which mustn't be a logical operator, and returns the condition code that holds when it
+// is true
+std::string Generator::emitComparison(ASTExpression* node) {
+  if (node->type == ASTType::BIN_OP) {
+    auto* binOp = static_cast<ASTBinOp*>(node);
+    std::string conditionCode = conditionCodeOf(binOp->op);
+    if (!conditionCode.empty()) {
+      enterNode(binOp, "BinOp");
+
+      // cmp leaves both sides intact, so neither needs copying
+      const InstructionSelector::Choice& choice = selector.select(binOp);
+      bool hasOperand = choice.rule == InstructionSelector::Rule::OP_IMM
+          || choice.rule == InstructionSelector::Rule::OP_MEM;
+      if (hasOperand) {
+        walkExpression(choice.first);
+        emit("cmp", {getRegisterFor(choice.first->location), operandFor(choice.second, choice.secondAs)});
+        removeLocation(choice.first->location, false);
+      } else {
+        walkExpression(binOp->left);
+        walkExpression(binOp->right);
+        Register regLeft = getRegisterFor(binOp->left->location);
+        Register regRight = getRegisterFor(binOp->right->location);
+
+        emit("cmp", {regLeft, regRight});
+        removeLocation(regRight, binOp->right->location);
+        removeLocation(binOp->left->location, false);
+      }
+
+      exitNode(binOp, "BinOp");
+      return conditionCode;
+    }
+  }
+
+  // Anything else is evaluated to a value and compared against zero
+  walkExpression(node);
+  Register regConditionalResult = getRegisterFor(node->location);
+
+  emit("test", {regConditionalResult, regConditionalResult});
+  removeLocation(node->location, false);
+  return "nz";
+}
+
+Location* Generator::walkBinOp(ASTBinOp* node) {
+  // Logical operators short circuit, so they are lowered as branches and the 0/1 result set after
+  if (node->op == ExpressionOperatorType::LOGICAL_AND || node->op == ExpressionOperatorType::LOGICAL_OR) {
+    Label labelEnd;
+
+    // Set before any branch, so every path reaches the end with the result in the same register
+    Register regResult = getRegisterForConst(node->location, 0ULL);
+    walkCondition(node, labelEnd, false);
+    emit("mov", {regResult, 1LL});
+    emitLabel(labelEnd);
 
-    exitNode(node, "BinOp");
     return node->location;
   }
 
+  const InstructionSelector::Choice& choice = selector.select(node);
+  switch (choice.rule) {
+    case InstructionSelector::Rule::LEA:
+      return walkLea(node, choice);
+    case InstructionSelector::Rule::OP_IMM:
+    case InstructionSelector::Rule::OP_MEM:
+    case InstructionSelector::Rule::INC:
+    case InstructionSelector::Rule::DEC:
+      return walkBinOpWithOperand(node, choice);
+    case InstructionSelector::Rule::MUL_CONST:
+    case InstructionSelector::Rule::DIV_CONST: {
+      unsigned long long constant = 0;
+      InstructionSelector::isIntegerLiteral(choice.second, constant);
+      return walkBinOpByConstant(node, choice.first, constant);
+    }
+    default:
+      break;
+  }
+
+  enterNode(node, "BinOp");
+  //DEFER: comment("END BinOp");
+
   walkExpression(node->left);
   walkExpression(node->right);
-  auto* tempLeftLoc = new Location();
-  Register regLeft = getRegisterForCopy(node->left->location, tempLeftLoc);
+  Location* tempLeftLoc = node->left->location;
+  Register regLeft;
+  if (isTemporary(node->left) && node->left->location != node->right->location) {
+    // Nothing else reads a temporary, so the result can overwrite it
+    regLeft = getRegisterFor(tempLeftLoc);
+  } else {
+    tempLeftLoc = new Location();
+    regLeft = getRegisterForCopy(node->left->location, tempLeftLoc);
+  }
   Register regRight = getRegisterFor(node->right->location);
 
   switch (node->op) {
     case ExpressionOperatorType::ADD:
-      output() << "add " << regLeft << ", " << regRight << "\n";
+      emit("add", {regLeft, regRight});
       swapLocation(regLeft, tempLeftLoc, node->location);
       removeLocation(regRight, node->right->location);
       break;
     case ExpressionOperatorType::MINUS:
-      output() << "sub " << regLeft << ", " << regRight << "\n";
+      emit("sub", {regLeft, regRight});
       swapLocation(regLeft, tempLeftLoc, node->location);
       removeLocation(regRight, node->right->location);
       break;
     case ExpressionOperatorType::MULTIPLY: {
-      output() << "imul " << regLeft << ", " << regRight << "\n";
+      emit("imul", {regLeft, regRight});
       swapLocation(regLeft, tempLeftLoc, node->location);
       removeLocation(regRight, node->right->location);
       break;
@@ -865,15 +1795,19 @@ Location* Generator::walkBinOp(ASTBinOp* node) {
 
       // Zero result for remainder
       requireRegistersFree({Register::RDX});
-      output() << "xor " << Register::RDX << ", " << Register::RDX << " ";
-      comment("zero");
-
-      // Sign extend above two
-      output() << "cdq ";
-      comment("sign extend EAX into EDX");
-
-      // Divide by divisor
-      output() << "idiv " << registerTo32BitEquivalent(regRight) << "\n";
+      emit("xor", {Register::RDX, Register::RDX}, "zero");
+      // Either move may have relocated the divisor
+      regRight = locationMap.at(node->right->location);
+
+      // Sign extend above two, and divide by divisor; 32 bit values keep the cheaper 32 bit divide
+      if (isWide(node)) {
+        emit("cqo", {}, "sign extend RAX into RDX");
+        emit("idiv", {regRight});
+      } else {
+        emit("cdq", {}, "sign extend EAX into EDX");
+        emit("idiv", {Operand(regRight, 4)});
+        emitSignExtend(Register::RAX, Operand(Register::RAX, 4));
+      }
 
       // Extract quotient
       swapLocation(Register::RAX, tempLeftLoc, node->location);
@@ -881,64 +1815,53 @@ Location* Generator::walkBinOp(ASTBinOp* node) {
       break;
     }
     case ExpressionOperatorType::EQUALS: {
-      output() << "cmp " << regLeft << ", " << regRight << "\n";
-      std::string regLeft8BitStr = registerTo8BitEquivalent(regLeft);
-      output() << "setz " << regLeft8BitStr << "\n";
-      output() << "movzx " << regLeft << ", " << regLeft8BitStr << "\n";
+      emit("cmp", {regLeft, regRight});
+      emit("setz", {Operand(regLeft, 1)});
+      emit("movzx", {regLeft, Operand(regLeft, 1)});
       swapLocation(regLeft, tempLeftLoc, node->location);
       removeLocation(regRight, node->right->location);
       break;
     }
     case ExpressionOperatorType::NOT_EQUALS: {
-      output() << "cmp " << regLeft << ", " << regRight << "\n";
-      std::string regLeft8BitStr = registerTo8BitEquivalent(regLeft);
-      output() << "setnz " << regLeft8BitStr << "\n";
-      output() << "movzx " << regLeft << ", " << regLeft8BitStr << "\n";
+      emit("cmp", {regLeft, regRight});
+      emit("setnz", {Operand(regLeft, 1)});
+      emit("movzx", {regLeft, Operand(regLeft, 1)});
       swapLocation(regLeft, tempLeftLoc, node->location);
       removeLocation(regRight, node->right->location);
       break;
     }
     case ExpressionOperatorType::LESS_THAN: {
-      output() << "cmp " << regLeft << ", " << regRight << "\n";
-      std::string regLeft8BitStr = registerTo8BitEquivalent(regLeft);
-      output() << "setl " << regLeft8BitStr << "\n";
-      output() << "movzx " << regLeft << ", " << regLeft8BitStr << "\n";
+      emit("cmp", {regLeft, regRight});
+      emit("setl", {Operand(regLeft, 1)});
+      emit("movzx", {regLeft, Operand(regLeft, 1)});
       swapLocation(regLeft, tempLeftLoc, node->location);
       removeLocation(regRight, node->right->location);
       break;
     }
     case ExpressionOperatorType::LESS_THAN_OR_EQUAL: {
-      output() << "cmp " << regLeft << ", " << regRight << "\n";
-      std::string regLeft8BitStr = registerTo8BitEquivalent(regLeft);
-      output() << "setle " << regLeft8BitStr << "\n";
-      output() << "movzx " << regLeft << ", " << regLeft8BitStr << "\n";
+      emit("cmp", {regLeft, regRight});
+      emit("setle", {Operand(regLeft, 1)});
+      emit("movzx", {regLeft, Operand(regLeft, 1)});
       swapLocation(regLeft, tempLeftLoc, node->location);
       removeLocation(regRight, node->right->location);
       break;
     }
     case ExpressionOperatorType::GREATER_THAN: {
-      output() << "cmp " << regLeft << ", " << regRight << "\n";
-      std::string regLeft8BitStr = registerTo8BitEquivalent(regLeft);
-      output() << "setg " << regLeft8BitStr << "\n";
-      output() << "movzx " << regLeft << ", " << regLeft8BitStr << "\n";
+      emit("cmp", {regLeft, regRight});
+      emit("setg", {Operand(regLeft, 1)});
+      emit("movzx", {regLeft, Operand(regLeft, 1)});
       swapLocation(regLeft, tempLeftLoc, node->location);
       removeLocation(regRight, node->right->location);
       break;
     }
     case ExpressionOperatorType::GREATER_THAN_OR_EQUAL: {
-      output() << "cmp " << regLeft << ", " << regRight << "\n";
-      std::string regLeft8BitStr = registerTo8BitEquivalent(regLeft);
-      output() << "setge " << regLeft8BitStr << "\n";
-      output() << "movzx " << regLeft << ", " << regLeft8BitStr << "\n";
+      emit("cmp", {regLeft, regRight});
+      emit("setge", {Operand(regLeft, 1)});
+      emit("movzx", {regLeft, Operand(regLeft, 1)});
       swapLocation(regLeft, tempLeftLoc, node->location);
       removeLocation(regRight, node->right->location);
       break;
     }
-    case ExpressionOperatorType::LOGICAL_AND: {
-      std::cout << "LOGICAL_AND not implemented" << std::endl;
-      file->fileStream->close();
-      throw std::exception();
-    }
     case ExpressionOperatorType::UNINITIALISED: {
       std::stringstream ssError;
       ssError << "BinOp UNINITIALISED";
@@ -972,28 +1895,280 @@ Location* Generator::walkBinOp(ASTBinOp* node) {
   return node->location;
 }
 
+// Only the other operand is evaluated; the literal is folded into the instructions that replace imul or idiv
+Location* Generator::walkBinOpByConstant(ASTBinOp* node, ASTExpression* operand, unsigned long long constant) {
+  enterNode(node, "BinOp");
+
+  walkExpression(operand);
+  Location* tempLoc = operand->location;
+  Register reg;
+  if (isTemporary(operand)) {
+    reg = getRegisterFor(tempLoc);
+  } else {
+    tempLoc = new Location();
+    reg = getRegisterForCopy(operand->location, tempLoc);
+  }
+
+  if (node->op == ExpressionOperatorType::MULTIPLY) {
+    emitMultiplyByConstant(reg, constant);
+  } else {
+    emitDivideByConstant(reg, constant);
+  }
+  swapLocation(reg, tempLoc, node->location);
+
+  removeLocation(operand->location, false);
+
+  exitNode(node, "BinOp");
+
+  return node->location;
+}
+
+// 64 bit multiply, as imul would do
+void Generator::emitMultiplyByConstant(Register reg, unsigned long long constant) {
+  if (constant == 0) {
+    emit("xor", {Operand(reg, 4), Operand(reg, 4)}, "* 0");
+    return;
+  }
+
+  // constant = odd * 2^shift, where an odd factor of 3, 5 or 9 is a single lea
+  unsigned int shift = 0;
+  unsigned long long odd = constant;
+  while (!(odd & 1)) {
+    odd >>= 1;
+    shift++;
+  }
+
+  if (odd == 1 || odd == 3 || odd == 5 || odd == 9) {
+    if (odd != 1) {
+      emit("lea", {reg, Operand::memory(reg, reg, (unsigned int) odd - 1, 0)}, "* " + std::to_string(odd));
+    }
+    if (shift) {
+      emit("shl", {reg, (long long) shift}, "* " + std::to_string(1ULL << shift));
+    }
+  } else if (constant <= INT32_MAX) {
+    emit("imul", {reg, (long long) constant});
+  } else {
+    Register scratch = getAvailableRegister();
+    emit("mov", {scratch, (long long) constant});
+    emit("imul", {reg, scratch});
+  }
+}
+
+// Same result as cdq; idiv, a 32 bit signed quotient sign extended into the whole register
+void Generator::emitDivideByConstant(Register reg, unsigned long long divisor) {
+  Operand reg32(reg, 4);
+  if (divisor == 1) {
+    emitSignExtend(reg, reg32, "/ 1");
+    return;
+  }
+
+  Register scratch = getAvailableRegister();
+  Operand scratch32(scratch, 4);
+
+  unsigned int log = 0;
+  while ((1ULL << log) < divisor) {
+    log++;
+  }
+
+  if ((1ULL << log) == divisor) {
+    // An arithmetic shift rounds down, so negative dividends are first biased by divisor - 1
+    emit("mov", {scratch32, reg32});
+    if (log > 1) {
+      emit("sar", {scratch32, 31LL});
+    }
+    emit("shr", {scratch32, (long long) (32 - log)});
+    emit("add", {reg32, scratch32});
+    emit("sar", {reg32, (long long) log});
+    emitSignExtend(reg, reg32, "/ " + std::to_string(divisor));
+    return;
+  }
+
+  // x / divisor == (x * multiplier) >> shift, rounded toward zero by adding 1 when x is negative
+  unsigned long long magic = divisionMagic(divisor);
+  unsigned int shift = 31 + log;
+  emit("movsxd", {reg, reg32});
+  emit("mov", {scratch, (long long) magic});
+  emit("imul", {scratch, reg});
+  emit("sar", {scratch, (long long) shift});
+  emit("shr", {reg, 63LL});
+  emit("add", {reg, scratch});
+  emitSignExtend(reg, reg32, "/ " + std::to_string(divisor));
+}
+
+// ceil(2^(31 + ceil(log2 divisor)) / divisor); at most 2^32, so every signed 32 bit dividend's product fits in 64 bits
+unsigned long long Generator::divisionMagic(unsigned long long divisor) {
+  unsigned int log = 0;
+  while ((1ULL << log) < divisor) {
+    log++;
+  }
+  return ((1ULL << (31 + log)) + divisor - 1) / divisor;
+}
+
+// The operand other than the register one is an immediate or a memory operand, so needs no register of its own
+Location* Generator::walkBinOpWithOperand(ASTBinOp* node, const InstructionSelector::Choice& choice) {
+  enterNode(node, "BinOp");
+
+  walkExpression(choice.first);
+  Location* tempLoc = choice.first->location;
+  Register reg;
+  if (isTemporary(choice.first)) {
+    reg = getRegisterFor(tempLoc);
+  } else {
+    tempLoc = new Location();
+    reg = getRegisterForCopy(choice.first->location, tempLoc);
+  }
+  Operand source = operandFor(choice.second, choice.secondAs);
+
+  switch (choice.rule) {
+    case InstructionSelector::Rule::INC:
+      emit("inc", {reg});
+      break;
+    case InstructionSelector::Rule::DEC:
+      emit("dec", {reg});
+      break;
+    default:
+      switch (node->op) {
+        case ExpressionOperatorType::ADD:
+          emit("add", {reg, source});
+          break;
+        case ExpressionOperatorType::MINUS:
+          emit("sub", {reg, source});
+          break;
+        case ExpressionOperatorType::MULTIPLY:
+          emit("imul", {reg, source});
+          break;
+        default:
+          emit("cmp", {reg, source});
+          emit("set" + conditionCodeOf(node->op), {Operand(reg, 1)});
+          emit("movzx", {reg, Operand(reg, 1)});
+          break;
+      }
+      break;
+  }
+  swapLocation(reg, tempLoc, node->location);
+
+  removeLocation(choice.first->location, false);
+
+  exitNode(node, "BinOp");
+
+  return node->location;
+}
+
+// Sums of registers, scaled registers and a literal are a single lea, which needs no copy of its operands
+Location* Generator::walkLea(ASTBinOp* node, const InstructionSelector::Choice& choice) {
+  enterNode(node, "BinOp");
+
+  Address address;
+  walkAddress(node, choice.firstAs, address);
+  Register regBase = getRegisterFor(address.base->location);
+  Register regIndex = address.index ? getRegisterFor(address.index->location) : Register::NONE;
+
+  // A temporary operand's register can take the result
+  Location* overwritten = nullptr;
+  Register reg;
+  if (isTemporary(address.base) && (!address.index || address.index->location != address.base->location)) {
+    overwritten = address.base->location;
+    reg = regBase;
+  } else if (address.index && isTemporary(address.index)) {
+    overwritten = address.index->location;
+    reg = regIndex;
+  } else {
+    reg = getAvailableRegister();
+  }
+
+  emit("lea", {reg, Operand::memory(regBase, regIndex, address.scale, address.displacement)});
+  swapLocation(reg, overwritten, node->location);
+
+  removeLocation(address.base->location, false);
+  if (address.index) {
+    removeLocation(address.index->location, false);
+  }
+
+  exitNode(node, "BinOp");
+
+  return node->location;
+}
+
+// Walks the leaves of an address tree into registers, collecting how they combine
+void Generator::walkAddress(ASTExpression* node, InstructionSelector::Nonterminal as, Address& address) {
+  const InstructionSelector::Choice& choice = selector.select(node, as);
+  unsigned long long constant = 0;
+
+  switch (choice.rule) {
+    case InstructionSelector::Rule::SCALE:
+      walkExpression(choice.first);
+      address.index = choice.first;
+      InstructionSelector::isIntegerLiteral(choice.second, constant);
+      address.scale = (unsigned int) constant;
+      break;
+    case InstructionSelector::Rule::BASE_PLUS_INDEX:
+      walkExpression(choice.first);
+      address.base = choice.first;
+      if (choice.secondAs == InstructionSelector::Nonterminal::INDEX) {
+        enterNode(choice.second, "BinOp");
+        walkAddress(choice.second, choice.secondAs, address);
+        exitNode(choice.second, "BinOp");
+      } else {
+        walkExpression(choice.second);
+        address.index = choice.second;
+      }
+      break;
+    case InstructionSelector::Rule::PLUS_DISPLACEMENT:
+    case InstructionSelector::Rule::MINUS_DISPLACEMENT:
+      if (choice.firstAs == InstructionSelector::Nonterminal::BASE_INDEX) {
+        enterNode(choice.first, "BinOp");
+        walkAddress(choice.first, choice.firstAs, address);
+        exitNode(choice.first, "BinOp");
+      } else {
+        walkExpression(choice.first);
+        address.base = choice.first;
+      }
+      InstructionSelector::isIntegerLiteral(choice.second, constant);
+      address.displacement = choice.rule == InstructionSelector::Rule::PLUS_DISPLACEMENT
+          ? (long long) constant : -(long long) constant;
+      break;
+    default:
+      break;
+  }
+}
+
+// An immediate or memory operand, which takes no instructions of its own
+Operand Generator::operandFor(ASTExpression* node, InstructionSelector::Nonterminal as) {
+  if (as == InstructionSelector::Nonterminal::MEM) {
+    auto var = blockScopeStack.top().searchForVariable(static_cast<ASTVariableIdent*>(node)->ident);
+    return addressOfVariable(var);
+  }
+
+  unsigned long long constant = 0;
+  InstructionSelector::isIntegerLiteral(node, constant);
+  return Operand((long long) constant);
+}
+
 Location* Generator::walkUnaryOp(ASTUnaryOp* node) {
   enterNode(node, "UnaryOp");
 
   walkExpression(node->child);
-  auto* tempChildLoc = new Location();
-  Register regChild = getRegisterForCopy(node->child->location, tempChildLoc);
+  Location* tempChildLoc = node->child->location;
+  Register regChild;
+  if (isTemporary(node->child)) {
+    regChild = getRegisterFor(tempChildLoc);
+  } else {
+    tempChildLoc = new Location();
+    regChild = getRegisterForCopy(node->child->location, tempChildLoc);
+  }
 
   switch (node->op) {
     case ExpressionOperatorType::ADD:
       swapLocation(regChild, tempChildLoc, node->location);
       break;
     case ExpressionOperatorType::MINUS:
-      output() << "xor " << Register::R15 << ", " << Register::R15 << ";zero\n";
-      output() << "sub " << Register::R15 << ", " << regChild << "\n";
-      output() << "mov " << regChild << ", " << Register::R15 << "\n";
+      emit("neg", {regChild});
       swapLocation(regChild, tempChildLoc, node->location);
       break;
     case ExpressionOperatorType::LOGICAL_NOT: {
-      output() << "cmp " << regChild << ", " << 0 << "\n";
-      std::string regChild8BitStr = registerTo8BitEquivalent(regChild);
-      output() << "sete " << regChild8BitStr << "\n";
-      output() << "movzx " << regChild << ", " << regChild8BitStr << "\n";
+      emit("cmp", {regChild, 0LL});
+      emit("sete", {Operand(regChild, 1)});
+      emit("movzx", {regChild, Operand(regChild, 1)});
       swapLocation(regChild, tempChildLoc, node->location);
       break;
     }
@@ -1050,7 +2225,6 @@ Location* Generator::walkLiteral(ASTLiteral* node) {
                 .isNew = ret.second
             });
       getRegisterForConst(node->location, id);
-//      output() << "mov rdi, " << id << "\n";
       break;
     }
     case ASTLiteral::ValueType::INTEGER: {
@@ -1075,140 +2249,233 @@ Location* Generator::walkVariableIdent(ASTVariableIdent* node) {
     node->dataType = var.dataType;
   }
 
-  if (var.parameter) {
-    switch (var.parameter->paramClass) {
-      case MEMORY: { // Use stack
-        node->location = recallFromMem(node->ident, bytesOf(node->dataType));
-        break;
-      }
-      case INTEGER: { // Use register
-        node->location = var.location;
-        break;
-      }
-      default:
-        std::cout << "Not implemented" << std::endl;
-        throw std::exception();
-    }
+  if (var.location->isPromoted) {
+    node->location = var.location;
   } else {
     node->location = recallFromMem(node->ident, bytesOf(node->dataType));
   }
 
-  exitNode(node, "VariableIdent");
+  exitNode(node, "VariableIdent");
+
+  return node->location;
+}
+
+// Expressions other than variable reads produce a fresh location that only their parent reads
+bool Generator::isTemporary(ASTExpression* node) {
+  return node->type != ASTType::VARIABLE;
+}
+
+// Values are computed in 64 bit registers either way; this only decides whether dividing needs the 64 bit idiv
+bool Generator::isWide(ASTExpression* node) {
+  switch (node->type) {
+    case ASTType::LITERAL: {
+      unsigned long long value;
+      return InstructionSelector::isIntegerLiteral(node, value)
+          && ((long long) value < INT32_MIN || (long long) value > INT32_MAX);
+    }
+    case ASTType::VARIABLE: {
+      auto variable = static_cast<ASTVariableIdent*>(node);
+      return bytesOf(blockScopeStack.top().searchForVariable(variable->ident).dataType) == 8;
+    }
+    case ASTType::BIN_OP: {
+      auto binOp = static_cast<ASTBinOp*>(node);
+      switch (binOp->op) {
+        case ExpressionOperatorType::ADD:
+        case ExpressionOperatorType::MINUS:
+        case ExpressionOperatorType::MULTIPLY:
+        case ExpressionOperatorType::DIVIDE:
+          return isWide(binOp->left) || isWide(binOp->right);
+        default:
+          return false; // 0 or 1
+      }
+    }
+    case ASTType::UNARY_OP: {
+      auto unaryOp = static_cast<ASTUnaryOp*>(node);
+      return unaryOp->op != ExpressionOperatorType::LOGICAL_NOT && isWide(unaryOp->child);
+    }
+    default:
+      return false;
+  }
+}
+
+unsigned int Generator::alignedOffset(unsigned int offset, unsigned int bytes) {
+  if (bytes == 0) return offset;
+  return (offset + bytes - 1) / bytes * bytes;
+}
+
+// Promoted locals and parameters are the only values kept in registers between statements; other
+// locals always have their value in memory, and temporaries are consumed by the statement that made them
+bool Generator::isLiveAfter(Location* location, unsigned int index) {
+  auto resident = registerResidentIdents.find(location);
+  if (resident == registerResidentIdents.end()) return false;
+
+  auto lastRead = lastReads.find(resident->second);
+  return lastRead != lastReads.end() && lastRead->second > index;
+}
+
+Operand Generator::callSaveSlot(unsigned int slot) {
+  return Operand::memory(Register::RBP, -(long long) (callSaveOffset + (slot + 1) * 8));
+}
+
+Operand Generator::expressionSlot(unsigned int slot) {
+  return Operand::memory(Register::RBP, -(long long) (expressionSlotOffset + (slot + 1) * 8));
+}
+
+Location* Generator::recallExpression(ASTExpression* node, ASTExpression* firstOccurrence) {
+  enterNode(node, "ReusedExpression");
+
+  Register reg = getAvailableRegister();
+  emit("mov", {reg, expressionSlot(expressionSlots.at(firstOccurrence))});
+
+  registerContents[reg] = node->location;
+  locationMap.insert_or_assign(node->location, reg);
+  ready({
+            .mode = Data::Mode::CODE_GEN,
+            .type = Data::Type::SPECIFIC,
+            .codeGenState = Data::CodeGenState::SET_REG_AND_LOC,
+            .reg = reg,
+            .loc = node->location,
+        });
+
+  exitNode(node, "ReusedExpression");
 
   return node->location;
 }
 
-std::vector<std::pair<Register, Location*>> Generator::pushCallerSaved() {
-  comment("BEGIN pushCallerSaved");
+std::vector<std::pair<Register, Location*>> Generator::saveCallerSaved(unsigned int callIndex) {
+  comment("BEGIN saveCallerSaved");
 
   std::vector<std::pair<Register, Location*>> savedRegisters;
 
   for (int i = 0; i < TOTAL_REGISTERS; ++i) {
     auto reg = (Register) i;
 
-    // TODO if 'reg' is in 'calleSavedRegister', then 'continue'.
-    // This is because calle saved registers must be
-    // preserved in all functions and won't be over ridden
-
     Location* loc = registerContents[reg];
-    if (loc != nullptr) {
-      output() << "push " << reg;
-      if (genComments) {
-        output() << "; with " << loc;
-      }
-      output() << "\n";
-      savedRegisters.emplace_back(reg, loc);
-    }
+    if (loc == nullptr) continue;
+
+    // Every callee preserves these for us
+    if (isCalleSaved(reg)) continue;
+
+    // Nothing reads it again, so the call is free to clobber it
+    if (passManager.isEnabled(Pass::LIVE_CALL_SAVES) && !isLiveAfter(loc, callIndex)) continue;
+
+    std::stringstream ssComment;
+    ssComment << " with " << *loc;
+    emit("mov", {callSaveSlot(savedRegisters.size()), reg}, ssComment.str());
+    savedRegisters.emplace_back(reg, loc);
   }
 
-  comment("END pushCallerSaved");
+  callSaveSlots = std::max(callSaveSlots, (unsigned int) savedRegisters.size());
+
+  comment("END saveCallerSaved");
 
   return savedRegisters;
 }
 
-void Generator::popCallerSaved(std::vector<std::pair<Register, Location*>> savedRegisters) {
-  comment("BEGIN popCallerSaved");
+void Generator::restoreCallerSaved(const std::vector<std::pair<Register, Location*>>& savedRegisters) {
+  comment("BEGIN restoreCallerSaved");
 
-  for (size_t i = savedRegisters.size() - 1; savedRegisters.size() > i; --i) {
+  for (size_t i = 0; i < savedRegisters.size(); ++i) {
     Register reg = savedRegisters[i].first;
     Location* loc = savedRegisters[i].second;
 
-    output() << "pop " << reg;
-    if (genComments) {
-      output() << "; with " << loc;
-    }
-    output() << "\n";
-
+    std::stringstream ssComment;
+    ssComment << " with " << *loc;
+    emit("mov", {reg, callSaveSlot(i)}, ssComment.str());
 
     swapLocation(reg, registerContents[reg], loc);
   }
 
-  comment("END popCallerSaved");
+  comment("END restoreCallerSaved");
 }
 
-Register Generator::registerWithAddressForVariable(BlockScope::Variable variable) {
-  Register reg = Register::R15;
+Operand Generator::addressOfVariable(const BlockScope::Variable& variable) {
+  if (variable.parameter) {
+    // Skips over the saved stackbase pointer and procedure's return address on the stack
+    constexpr unsigned int parameterOffset = 16;
 
-  unsigned int stackHeightDist = blockScopeStack.top().stackHeight - variable.stackHeight;
-  unsigned int offset = variable.offset;
+    return Operand::memory(Register::RBP, parameterOffset + variable.offset);
+  } else {
+    // Locals grow down from rbp, so the variable's lowest byte is its full size below the offset
+    return Operand::memory(Register::RBP, -(long long) (variable.offset + bytesOf(variable.dataType)));
+  }
+}
 
-#ifndef NDEBUG
-  dumpRegisters(true);
-#endif
+void Generator::assignVariable(const std::string& ident, Location* location, unsigned int bytes) {
+  BlockScope::Variable var = blockScopeStack.top().searchForVariable(ident);
+  if (!var.location->isPinned()) {
+    moveToMem(ident, location, bytes);
+    return;
+  }
 
-  if (stackHeightDist > 0) {
-    output() << "mov " << reg << ", [rbp]\n";
-    for (unsigned int i = 0; i < stackHeightDist - 1; ++i) {
-      output() << "mov " << reg << ", [" << reg << "]\n";
-    }
-  } else {
-    output() << "mov " << reg << ", rbp\n";
+  auto home = locationMap.find(var.location);
+  if (home == locationMap.end()) {
+    // Dropped at a call it wasn't live across, so nothing reads it again
+    comment("dead store to " + ident);
+    return;
   }
 
-  if (variable.parameter) {
-    // Skips over procedure's return address and stackbase pointer on the stack
-    constexpr unsigned int parameterOffset = 8;
+  Register varRegister = home->second;
+  Register locRegister = locationMap.at(location);
+
+  // Match what a store and reload through memory would have left
+  emitSignExtend(varRegister, Operand(locRegister, bytes));
+}
 
-    output() << "add " << reg << ", " << (parameterOffset + offset) << "\n";
+// Fills the whole of reg from the narrower source, the way every variable narrower than 8 bytes is read
+void Generator::emitSignExtend(Register reg, const Operand& source, const std::string& trailingComment) {
+  if (source.bytes == 8) {
+    if (!source.isRegister(reg)) {
+      emit("mov", {reg, source}, trailingComment);
+    }
+  } else if (source.bytes == 4) {
+    emit("movsxd", {reg, source}, trailingComment);
   } else {
-    offset += 1; // + 1 because we're using rbp instead of rsp
-    output() << "sub " << reg << ", " << offset << "\n";
+    emit("movsx", {reg, source}, trailingComment);
   }
-
-  return reg;
 }
 
 void Generator::moveToMem(const std::string& ident, Location* location, unsigned int bytes) {
   BlockScope::Variable var = blockScopeStack.top().searchForVariable(ident);
 
   Register locRegister = locationMap.at(location);
-  std::string locRegisterStr = registerToByteEquivalent(locRegister, bytes);
   if (genComments) {
-    output() << ";mov " << *location << " to mem(ident: " << ident << ")\n";
+    std::stringstream ssComment;
+    ssComment << "mov " << *location << " to mem(ident: " << ident << ")";
+    comment(ssComment.str());
+  }
+  emit("mov", {addressOfVariable(var), Operand(locRegister, bytes)});
+
+  // A copy of the old value still in a register is stale now
+  if (location != var.location && !var.location->isPinned()) {
+    removeLocation(var.location, true);
   }
-  Register varRegister = registerWithAddressForVariable(var);
-  output() << "mov [" << varRegister << "], " << locRegisterStr << "\n";
 }
 
 Location* Generator::recallFromMem(const std::string& ident, unsigned int bytes) {
   BlockScope::Variable var = blockScopeStack.top().searchForVariable(ident);
 
+  // Already loaded earlier in this statement
+  auto loaded = locationMap.find(var.location);
+  if (loaded != locationMap.end() && registerContents[loaded->second] == var.location) {
+    sharedReads[var.location]++;
+    return var.location;
+  }
+
 #ifndef NDEBUG
   dumpRegisters(true);
 #endif
 
-  Register varRegister = registerWithAddressForVariable(var);
-
+  // Narrow values are sign extended as they are loaded, so the whole register is written and nothing later has
+  // to merge with what was left above them
   Register locRegister = getAvailableRegister();
-  std::string locRegisterStr = registerToByteEquivalent(locRegister, bytes);
-  if (bytes != 8) {
-    // Zero 64bit register if only a part of it will be filled
-    output() << "xor " << locRegister << ", " << locRegister << "\n";
-  }
-  output() << "mov " << locRegisterStr << ", [" << varRegister << "]\n";
+  Operand source = addressOfVariable(var);
+  source.bytes = bytes;
+  emitSignExtend(locRegister, source);
 
   registerContents[locRegister] = var.location;
   locationMap.insert_or_assign(var.location, locRegister);
+  sharedReads[var.location] = 1;
   ready({
             .mode = Data::Mode::CODE_GEN,
             .type = Data::Type::SPECIFIC,
@@ -1234,9 +2501,11 @@ void Generator::recallFromParamRegister(Location* location) {
         });
 
   if (genComments) {
-    output() << ";mov " << location << " (in " << exitingRegister << ") to " << newRegister << "\n";
+    std::stringstream ssComment;
+    ssComment << "mov " << *location << " (in " << exitingRegister << ") to " << newRegister;
+    comment(ssComment.str());
   }
-  output() << "mov " << newRegister << ", " << exitingRegister << "\n";
+  emit("mov", {newRegister, exitingRegister});
 
   registerContents[newRegister] = location;
   locationMap.insert_or_assign(location, newRegister);
@@ -1249,6 +2518,87 @@ void Generator::recallFromParamRegister(Location* location) {
         });
 }
 
+Generator::RegisterState Generator::saveRegisters() const {
+  return {std::vector<Location*>(registerContents, registerContents + TOTAL_REGISTERS), locationMap};
+}
+
+// Moves each saved location that is still held back to the register it was saved in, and forgets whatever was
+// loaded since. Only emits moves, so the flags survive it. What was saved but has since been dropped is forgotten
+// too, as its register may have been reused.
+void Generator::restoreRegisters(const RegisterState& state) {
+  auto currentRegister = [this](Location* location) {
+    auto found = locationMap.find(location);
+    if (found == locationMap.end() || registerContents[found->second] != location) return Register::NONE;
+    return found->second;
+  };
+
+  std::vector<Location*> contents = state.contents;
+  std::map<Location*, Register> locations = state.locations;
+  std::vector<std::pair<Register, Register>> moves; // (to, from)
+  for (int i = 0; i < TOTAL_REGISTERS; ++i) {
+    if (!contents[i]) continue;
+    Register from = currentRegister(contents[i]);
+    if (from == Register::NONE) {
+      locations.erase(contents[i]);
+      contents[i] = nullptr;
+    } else if (from != (Register) i) {
+      moves.emplace_back((Register) i, from);
+    }
+  }
+
+  // A move can go once nothing still to move is read from where it writes; a cycle is broken through a register
+  // nothing wants
+  auto isReadByMove = [&moves](Register reg) {
+    return std::any_of(moves.begin(), moves.end(), [reg](const std::pair<Register, Register>& move) {
+      return move.second == reg;
+    });
+  };
+  while (!moves.empty()) {
+    auto next = std::find_if(moves.begin(), moves.end(), [&isReadByMove](const std::pair<Register, Register>& move) {
+      return !isReadByMove(move.first);
+    });
+    if (next != moves.end()) {
+      emit("mov", {next->first, next->second}, "restore");
+      moves.erase(next);
+      continue;
+    }
+
+    Register scratch = Register::NONE;
+    for (int i = 0; i < TOTAL_REGISTERS && scratch == Register::NONE; ++i) {
+      if (!contents[i] && !isReadByMove((Register) i)) {
+        scratch = (Register) i;
+      }
+    }
+    if (scratch == Register::NONE) {
+      std::stringstream ssError;
+      ssError << "No available register!";
+      std::cout << ssError.str() << std::endl;
+      ready({
+                .mode = Data::Mode::ERROR,
+                .type = Data::Type::MODE_CHANGE,
+                .string = ssError.str(),
+            });
+      file->fileStream->close();
+      throw std::exception();
+    }
+    emit("mov", {scratch, moves.front().second}, "restore");
+    moves.front().second = scratch;
+  }
+
+  for (int i = 0; i < TOTAL_REGISTERS; ++i) {
+    if (registerContents[i] == contents[i]) continue;
+    registerContents[i] = contents[i];
+    ready({
+              .mode = Data::Mode::CODE_GEN,
+              .type = Data::Type::SPECIFIC,
+              .codeGenState = contents[i] ? Data::CodeGenState::SET_REG_AND_LOC : Data::CodeGenState::SET_REG,
+              .reg = (Register) i,
+              .loc = contents[i],
+          });
+  }
+  locationMap = locations;
+}
+
 void Generator::requireRegistersFree(const std::vector<Register>& registers) {
   for (auto reg : registers) {
     // If register is not empty
@@ -1259,6 +2609,38 @@ void Generator::requireRegistersFree(const std::vector<Register>& registers) {
   }
 }
 
+// Moves whatever is in `reg` to a free register
+void Generator::relocate(Register reg, const std::vector<Register>& excludingRegisters) {
+  Register freeRegister = getAvailableRegister(excludingRegisters);
+  Location* existingLoc = registerContents[reg];
+
+  ready({
+            .mode = Data::Mode::CODE_GEN,
+            .type = Data::Type::SPECIFIC,
+            .codeGenState = Data::CodeGenState::MOVE_REG,
+            .reg = reg,
+            .reg2 = freeRegister,
+            .keep = true,
+        });
+
+  if (genComments) {
+    std::stringstream ssComment;
+    ssComment << "mov " << *existingLoc << " to " << freeRegister << " (relocation)";
+    comment(ssComment.str());
+  }
+  emit("mov", {freeRegister, reg});
+
+  registerContents[freeRegister] = existingLoc;
+  locationMap.insert_or_assign(existingLoc, freeRegister);
+  ready({
+            .mode = Data::Mode::CODE_GEN,
+            .type = Data::Type::SPECIFIC,
+            .codeGenState = Data::CodeGenState::SET_REG_AND_LOC,
+            .reg = freeRegister,
+            .loc = existingLoc,
+        });
+}
+
 void Generator::moveToRegister(Register newRegister,
                                Location* location,
                                const std::vector<Register>& excludingRegisters) {
@@ -1287,38 +2669,15 @@ void Generator::moveToRegister(Register newRegister,
               << ") when asked to make way for " << *location
               << " (Relocating)" << std::endl;
 
-    Register freeRegister = getAvailableRegister(excludingRegisters);
-    Location* existingLoc = registerContents[newRegister];
-
-    ready({
-              .mode = Data::Mode::CODE_GEN,
-              .type = Data::Type::SPECIFIC,
-              .codeGenState = Data::CodeGenState::MOVE_REG,
-              .reg = newRegister,
-              .reg2 = freeRegister,
-              .keep = true,
-          });
-
-    if (genComments) {
-      output() << ";mov " << *existingLoc << " to " << freeRegister << " (relocation)" << "\n";
-    }
-    output() << "mov " << freeRegister << ", " << newRegister << "\n";
-
-    registerContents[freeRegister] = existingLoc;
-    locationMap.insert_or_assign(existingLoc, freeRegister);
-    ready({
-              .mode = Data::Mode::CODE_GEN,
-              .type = Data::Type::SPECIFIC,
-              .codeGenState = Data::CodeGenState::SET_REG_AND_LOC,
-              .reg = freeRegister,
-              .loc = existingLoc,
-          });
+    relocate(newRegister, excludingRegisters);
   }
 
   if (genComments) {
-    output() << ";mov " << *location << " to " << newRegister << "\n";
+    std::stringstream ssComment;
+    ssComment << "mov " << *location << " to " << newRegister;
+    comment(ssComment.str());
   }
-  output() << "mov " << newRegister << ", " << oldRegister << "\n";
+  emit("mov", {newRegister, oldRegister});
 
   registerContents[oldRegister] = nullptr;
   ready({
@@ -1338,6 +2697,44 @@ void Generator::moveToRegister(Register newRegister,
         });
 }
 
+// Like moveToRegister, but `location` keeps its register and the copy becomes `copyLocation`
+void Generator::copyToRegister(Register newRegister,
+                               Location* location,
+                               Location* copyLocation,
+                               const std::vector<Register>& excludingRegisters) {
+  if (registerContents[newRegister] != nullptr) {
+    relocate(newRegister, excludingRegisters);
+  }
+
+  Register oldRegister = locationMap.at(location);
+
+  ready({
+            .mode = Data::Mode::CODE_GEN,
+            .type = Data::Type::SPECIFIC,
+            .codeGenState = Data::CodeGenState::MOVE_REG,
+            .reg = oldRegister,
+            .reg2 = newRegister,
+            .keep = true,
+        });
+
+  if (genComments) {
+    std::stringstream ssComment;
+    ssComment << "copy " << *location << " to " << newRegister;
+    comment(ssComment.str());
+  }
+  emit("mov", {newRegister, oldRegister});
+
+  registerContents[newRegister] = copyLocation;
+  locationMap.insert_or_assign(copyLocation, newRegister);
+  ready({
+            .mode = Data::Mode::CODE_GEN,
+            .type = Data::Type::SPECIFIC,
+            .codeGenState = Data::CodeGenState::SET_REG_AND_LOC,
+            .reg = newRegister,
+            .loc = copyLocation,
+        });
+}
+
 void Generator::swapLocation(Register reg, Location* oldLoc, Location* newLoc, bool forceRmParam) {
   registerContents[reg] = newLoc;
   ready({
@@ -1348,7 +2745,7 @@ void Generator::swapLocation(Register reg, Location* oldLoc, Location* newLoc, b
             .loc = newLoc,
         });
 
-  if (oldLoc && (!oldLoc->isParameter || forceRmParam)) {
+  if (oldLoc && (!oldLoc->isPinned() || forceRmParam)) {
     locationMap.erase(oldLoc);
     ready({
               .mode = Data::Mode::CODE_GEN,
@@ -1372,11 +2769,17 @@ void Generator::removeLocation(Register reg, Location* oldLoc, bool forceRmParam
 
   if (!forceRmParam) {
     if (oldLoc) {
-      if (oldLoc->isParameter) return;
+      if (oldLoc->isPinned()) return;
     } else {
-      if (existingLoc->isParameter) return;
+      if (existingLoc->isPinned()) return;
     }
   }
+  // Forced when the register is clobbered, so other reads sharing it lose it too
+  if (forceRmParam) {
+    sharedReads.erase(oldLoc ? oldLoc : existingLoc);
+  } else if (isStillRead(oldLoc ? oldLoc : existingLoc)) {
+    return;
+  }
 
   registerContents[reg] = nullptr;
   ready({
@@ -1406,7 +2809,12 @@ void Generator::removeLocation(Register reg, Location* oldLoc, bool forceRmParam
 }
 
 void Generator::removeLocation(Location* oldLoc, bool forceRmParam) {
-  if (oldLoc->isParameter && !forceRmParam) {
+  if (oldLoc->isPinned() && !forceRmParam) {
+    return;
+  }
+  if (forceRmParam) {
+    sharedReads.erase(oldLoc);
+  } else if (isStillRead(oldLoc)) {
     return;
   }
 
@@ -1433,6 +2841,15 @@ void Generator::removeLocation(Location* oldLoc, bool forceRmParam) {
         });
 }
 
+// Consumes one read of `location`; whether another read sharing its register is still to be consumed
+bool Generator::isStillRead(Location* location) {
+  auto shared = sharedReads.find(location);
+  if (shared == sharedReads.end()) return false;
+  if (--shared->second > 0) return true;
+  sharedReads.erase(shared);
+  return false;
+}
+
 Register Generator::getAvailableRegister() {
   Register availableRegister = Register::NONE;
 
@@ -1496,16 +2913,14 @@ Register Generator::getAvailableRegister(const std::vector<Register>& excludingR
 }
 
 Register Generator::getRegisterForConst(Location* location, unsigned long long constant) {
-  std::stringstream ss;
-  ss << constant;
-  return getRegisterFor(location, true, ss.str());
+  return getRegisterFor(location, true, Operand((long long) constant));
 }
 
 Register Generator::getRegisterForConst(Location* location, const std::string& constant) {
-  return getRegisterFor(location, true, constant);
+  return getRegisterFor(location, true, Operand::symbolic(constant));
 }
 
-Register Generator::getRegisterFor(Location* location, bool isConstant, const std::string& constant) {
+Register Generator::getRegisterFor(Location* location, bool isConstant, const Operand& constant) {
   Register availableRegister = Register::NONE;
 
   // Already exists?
@@ -1537,7 +2952,7 @@ Register Generator::getRegisterFor(Location* location, bool isConstant, const st
                 .reg = availableRegister,
             });
 
-      output() << "mov " << availableRegister << ", " << constant << "\n";
+      emit("mov", {availableRegister, constant});
       registerContents[availableRegister] = location;
       locationMap.insert_or_assign(location, availableRegister);
       ready({
@@ -1584,17 +2999,19 @@ Register Generator::getRegisterForCopy(Location* location, Location* newLocation
         });
 
   if (genComments) {
-    output() << ";mov " << *location << " to " << newRegister << "\n";
+    std::stringstream ssComment;
+    ssComment << "mov " << *location << " to " << newRegister;
+    comment(ssComment.str());
   }
-  output() << "mov " << newRegister << ", " << oldRegister << "\n";
+  emit("mov", {newRegister, oldRegister});
 
-  registerContents[newRegister] = location;
+  registerContents[newRegister] = newLocation;
   ready({
             .mode = Data::Mode::CODE_GEN,
             .type = Data::Type::SPECIFIC,
             .codeGenState = Data::CodeGenState::SET_REG,
             .reg = newRegister,
-            .loc = location,
+            .loc = newLocation,
         });
   locationMap.insert_or_assign(newLocation, newRegister);
   ready({
@@ -1608,10 +3025,48 @@ Register Generator::getRegisterForCopy(Location* location, Location* newLocation
   return newRegister;
 }
 
+void Generator::emit(const std::string& mnemonic,
+                     const std::vector<Operand>& operands,
+                     const std::string& trailingComment) {
+  Instruction instruction;
+  instruction.mnemonic = mnemonic;
+  instruction.operands = operands;
+  if (genComments) {
+    instruction.comment = trailingComment;
+  }
+  emitInstruction(instruction);
+}
+
+void Generator::emitLabel(const Label& label) {
+  emitInstruction(Instruction::label(label));
+}
+
+void Generator::emitLabel(const std::string& name) {
+  emitInstruction(Instruction::label(name));
+}
+
+void Generator::emitDirective(const std::string& text) {
+  emitInstruction(Instruction::directive(text));
+}
+
+void Generator::emitInstruction(const Instruction& instruction) {
+  codeBuffers.back().instructions.push_back(instruction);
+
+  // The visualisation follows generation, so it sees the code from before the peephole pass
+  std::stringstream ss;
+  ss << instruction << "\n";
+  ready({
+            .mode = Data::Mode::CODE_GEN,
+            .type = Data::Type::SPECIFIC,
+            .codeGenState = Data::CodeGenState::OUTPUT,
+            .string = ss.str(),
+        });
+}
+
 void Generator::comment(const std::string& comment) {
   if (!genComments) return;
 
-  output() << ";" << comment << "\n";
+  emitInstruction(Instruction::commentLine(comment));
 }
 
 void Generator::dumpRegisters(bool mismatchCheckOnly) {
@@ -1641,42 +3096,46 @@ void Generator::dumpRegisters(bool mismatchCheckOnly) {
   }
 
   // Print registers
-  if (genComments) {
-    output() << ";Dump registers:\n";
-  }
+  comment("Dump registers:");
   std::cout << "Dump registers:" << std::endl;
   for (int i = 0; i < TOTAL_REGISTERS; ++i) {
     auto reg = (Register) i;
     Location* loc = registerContents[reg];
     if (loc) {
       if (genComments) {
-        output() << "; - " << reg << ": " << loc->id << "\n";
+        std::stringstream ssComment;
+        ssComment << " - " << reg << ": " << loc->id;
+        comment(ssComment.str());
       }
       std::cout << "- " << reg << ": " << loc->id << std::endl;
     } else {
       if (genComments) {
-        output() << "; - " << reg << ": -" << "\n";
+        std::stringstream ssComment;
+        ssComment << " - " << reg << ": -";
+        comment(ssComment.str());
       }
       std::cout << "- " << reg << ": -" << std::endl;
     }
   }
 
   // Print locations
-  if (genComments) {
-    output() << ";Dump locations:\n";
-  }
+  comment("Dump locations:");
   std::cout << "Dump locations:" << std::endl;
   for (auto pair : locationMap) {
     Location* loc = pair.first;
     Register reg = pair.second;
     if (reg != Register::NONE) {
       if (genComments) {
-        output() << "; - " << loc->id << ": " << reg << "\n";
+        std::stringstream ssComment;
+        ssComment << " - " << loc->id << ": " << reg;
+        comment(ssComment.str());
       }
       std::cout << "- " << loc->id << ": " << reg << std::endl;
     } else {
       if (genComments) {
-        output() << "; - " << loc->id << ": -" << "\n";
+        std::stringstream ssComment;
+        ssComment << " - " << loc->id << ": -";
+        comment(ssComment.str());
       }
       std::cout << "- " << loc->id << ": -" << std::endl;
     }
@@ -1684,30 +3143,296 @@ void Generator::dumpRegisters(bool mismatchCheckOnly) {
 
   // Print mismatch
   if (locCount != regCount) {
-    if (genComments) {
-      output() << "; !!!MISMATCH!!!\n";
-      output() << "; !!!MISMATCH!!!\n";
-    }
+    comment(" !!!MISMATCH!!!");
+    comment(" !!!MISMATCH!!!");
     std::cout << "!!!MISMATCH!!!" << std::endl;
   }
 }
 
-Generator::StreamHelper& Generator::output() {
-  flushOutput();
-  _isOutputFlushed = false;
-  return _output;
+void Generator::runTailCalls(ASTBlock* block) {
+  TailCalls tailCalls(block);
+  tailCalls.run();
+
+  std::cout << "Tail calls: " << tailCalls.getLoops().size() << " recursive procedures looped" << std::endl;
+  for (const auto& procedure : tailCalls.getLoops()) {
+    std::cout << "- " << procedure << std::endl;
+  }
 }
 
-void Generator::flushOutput() {
-  if (!_isOutputFlushed) {
-    ready({
-              .mode = Data::Mode::CODE_GEN,
-              .type = Data::Type::SPECIFIC,
-              .codeGenState = Data::CodeGenState::OUTPUT,
-              .string = _output.ss.str(),
-          });
-    _output.ss.str(std::string());
-    _isOutputFlushed = true;
+void Generator::runInliner(ASTBlock* block) {
+  Inliner inliner(block);
+  inliner.run();
+
+  const auto& decisions = inliner.getDecisions();
+  auto inlined = std::count_if(decisions.begin(), decisions.end(), [](const Inliner::Decision& decision) {
+    return decision.isInlined;
+  });
+  std::cout << "Inliner: " << inlined << " of " << decisions.size() << " calls inlined" << std::endl;
+  for (const auto& decision : decisions) {
+    std::cout << "- " << decision.callee << " into " << decision.caller;
+    if (!decision.isInlined) {
+      std::cout << ": not inlined, " << decision.reason;
+    }
+    std::cout << std::endl;
+  }
+}
+
+void Generator::runUnroller(ASTBlock* block) {
+  Unroller unroller(block, options.unrollFactor, options.unrollBudget);
+  unroller.run();
+
+  const auto& decisions = unroller.getDecisions();
+  auto unrolled = std::count_if(decisions.begin(), decisions.end(), [](const Unroller::Decision& decision) {
+    return decision.isUnrolled;
+  });
+  std::cout << "Unroller: " << unrolled << " of " << decisions.size() << " loops unrolled" << std::endl;
+  for (const auto& decision : decisions) {
+    std::cout << "- loop in " << decision.procedure;
+    if (!decision.variable.empty()) {
+      std::cout << " on " << decision.variable;
+    }
+    std::cout << ": " << decision.outcome << std::endl;
+  }
+}
+
+void Generator::runBranchFolder(ASTBlock* block) {
+  BranchFolder branchFolder(block);
+  branchFolder.run();
+
+  unsigned int folds = 0;
+  for (const auto& hit : branchFolder.getHits()) {
+    folds += hit.second;
+  }
+  std::cout << "Branch folding: " << folds << " folds" << std::endl;
+  for (const auto& hit : branchFolder.getHits()) {
+    std::cout << "- " << hit.first << ": " << hit.second << std::endl;
+  }
+}
+
+void Generator::runDeadProcedures(ASTBlock* block) {
+  DeadProcedures deadProcedures(block);
+  deadProcedures.run();
+
+  std::cout << "Dead procedures: " << deadProcedures.getRemoved().size() << " removed" << std::endl;
+  for (const auto& procedure : deadProcedures.getRemoved()) {
+    std::cout << "- " << procedure << std::endl;
+  }
+}
+
+void Generator::runLayout(ASTBlock* block) {
+  ProcedureLayout::Profile profile;
+  if (!options.profileFilepath.empty()) {
+    std::string error;
+    if (!ProcedureLayout::readProfile(options.profileFilepath, profile, error)) {
+      std::cout << error << std::endl;
+      ready({
+                .mode = Data::Mode::ERROR,
+                .type = Data::Type::MODE_CHANGE,
+                .string = error,
+            });
+      file->fileStream->close();
+      throw std::exception();
+    }
+  }
+
+  ProcedureLayout layout(block, options.profileFilepath.empty() ? nullptr : &profile);
+  layout.run();
+
+  // A procedure's buffer is followed by the ones holding what comes after it, up to the next procedure
+  std::vector<CodeBuffer> leading;
+  std::map<std::string, std::vector<CodeBuffer>> procedureBuffers;
+  std::string current;
+  for (auto& buffer : codeBuffers) {
+    if (!buffer.procedure.empty()) {
+      current = buffer.procedure;
+    }
+    (current.empty() ? leading : procedureBuffers[current]).push_back(std::move(buffer));
+  }
+
+  codeBuffers = std::move(leading);
+  bool isInColdSection = false;
+  unsigned int coldCount = 0;
+  for (const auto& procedure : layout.getOrder()) {
+    if (layout.isCold(procedure) && !isInColdSection) {
+      codeBuffers.emplace_back();
+      emitDirective("section .text.unlikely progbits alloc exec nowrite align=16");
+      isInColdSection = true;
+    }
+    coldCount += layout.isCold(procedure);
+
+    auto& buffers = procedureBuffers[procedure];
+    std::move(buffers.begin(), buffers.end(), std::back_inserter(codeBuffers));
+    procedureBuffers.erase(procedure);
+  }
+
+  std::cout << "Layout: " << layout.getOrder().size() << " procedures, " << coldCount << " cold" << std::endl;
+  for (const auto& procedure : layout.getOrder()) {
+    std::cout << "- " << procedure << (layout.isCold(procedure) ? " (cold)" : "") << std::endl;
+  }
+}
+
+void Generator::runProcedurePasses() {
+  // What the passes did to one buffer; each is worked on by its own passes, so none of them are shared
+  struct Outcome {
+    unsigned int rewrites = 0;
+    unsigned int eliminations = 0;
+    unsigned int deadStores = 0;
+    std::map<std::string, unsigned int> peepholeHits;
+    std::map<std::string, unsigned int> redundancyHits;
+    std::map<std::string, unsigned int> deadStoreHits;
+  };
+  std::vector<Outcome> outcomes(codeBuffers.size());
+
+  auto optimise = [this, &outcomes](size_t index) {
+    std::vector<Instruction>& code = codeBuffers[index].instructions;
+    Outcome& outcome = outcomes[index];
+    Peephole peephole(abiCompliantProcedures);
+    RedundancyElimination redundancyElimination;
+    DeadStoreElimination deadStoreElimination;
+    auto codeSize = [&code]() {
+      return (long long) code.size();
+    };
+
+    // Each can expose more work for the others
+    bool changed = true;
+    while (changed) {
+      unsigned int rewrites = 0;
+      unsigned int eliminations = 0;
+      unsigned int deadStores = 0;
+      passManager.run(Pass::PEEPHOLE, [&]() {
+        rewrites = peephole.run(code);
+      }, codeSize);
+      passManager.run(Pass::REDUNDANCY_ELIMINATION, [&]() {
+        eliminations = redundancyElimination.run(code);
+      }, codeSize);
+      passManager.run(Pass::DEAD_STORE_ELIMINATION, [&]() {
+        deadStores = deadStoreElimination.run(code);
+      }, codeSize);
+      outcome.rewrites += rewrites;
+      outcome.eliminations += eliminations;
+      outcome.deadStores += deadStores;
+      changed = rewrites > 0 || eliminations > 0 || deadStores > 0;
+    }
+
+    outcome.peepholeHits = peephole.getHits();
+    outcome.redundancyHits = redundancyElimination.getHits();
+    outcome.deadStoreHits = deadStoreElimination.getHits();
+  };
+
+  unsigned int threads = options.jobs > 0 ? options.jobs : std::thread::hardware_concurrency();
+  if (threads > 1 && codeBuffers.size() > 1) {
+    // Largest first, so one long procedure doesn't start last and leave the other threads waiting on it
+    std::vector<size_t> order(codeBuffers.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+      return codeBuffers[a].instructions.size() > codeBuffers[b].instructions.size();
+    });
+
+    ThreadPool pool(std::min<size_t>(threads, codeBuffers.size()));
+    std::vector<std::future<void>> done;
+    for (auto index : order) {
+      done.push_back(pool.submit([&optimise, index]() {
+        optimise(index);
+      }));
+    }
+    for (auto& future : done) {
+      future.get();
+    }
+  } else {
+    for (size_t index = 0; index < codeBuffers.size(); ++index) {
+      optimise(index);
+    }
+  }
+
+  // Added up in buffer order, so the report doesn't depend on which thread finished first
+  unsigned int totalRewrites = 0;
+  unsigned int totalEliminations = 0;
+  unsigned int totalDeadStores = 0;
+  std::map<std::string, unsigned int> peepholeHits;
+  std::map<std::string, unsigned int> redundancyHits;
+  std::map<std::string, unsigned int> deadStoreHits;
+  for (const auto& outcome : outcomes) {
+    totalRewrites += outcome.rewrites;
+    totalEliminations += outcome.eliminations;
+    totalDeadStores += outcome.deadStores;
+    for (const auto& hit : outcome.peepholeHits) {
+      peepholeHits[hit.first] += hit.second;
+    }
+    for (const auto& hit : outcome.redundancyHits) {
+      redundancyHits[hit.first] += hit.second;
+    }
+    for (const auto& hit : outcome.deadStoreHits) {
+      deadStoreHits[hit.first] += hit.second;
+    }
+  }
+
+  if (passManager.isEnabled(Pass::PEEPHOLE)) {
+    std::cout << "Peephole: " << totalRewrites << " rewrites" << std::endl;
+    for (const auto& hit : peepholeHits) {
+      std::cout << "- " << hit.first << ": " << hit.second << std::endl;
+    }
+  }
+  if (passManager.isEnabled(Pass::REDUNDANCY_ELIMINATION)) {
+    std::cout << "Redundancy elimination: " << totalEliminations << " rewrites" << std::endl;
+    for (const auto& hit : redundancyHits) {
+      std::cout << "- " << hit.first << ": " << hit.second << std::endl;
+    }
+  }
+  if (passManager.isEnabled(Pass::DEAD_STORE_ELIMINATION)) {
+    std::cout << "Dead store elimination: " << totalDeadStores << " stores removed" << std::endl;
+    for (const auto& hit : deadStoreHits) {
+      std::cout << "- " << hit.first << ": " << hit.second << std::endl;
+    }
+  }
+}
+
+void Generator::dumpDataflow() {
+  for (const auto& buffer : codeBuffers) {
+    if (buffer.procedure.empty()) continue;
+
+    ControlFlowGraph graph(buffer.instructions);
+    DominatorTree dominators(graph);
+    Liveness liveness(graph, buffer.instructions);
+    ReachingDefinitions reachingDefinitions(graph, buffer.instructions);
+
+    std::cout << "Dataflow: " << buffer.procedure << ", " << graph.getBlocks().size() << " blocks, "
+              << reachingDefinitions.getDefinitions().size() << " definitions" << std::endl;
+    for (size_t block = 0; block < graph.getBlocks().size(); ++block) {
+      const BasicBlock& basicBlock = graph.getBlocks()[block];
+      std::cout << "- block " << block;
+      if (!basicBlock.label.empty()) {
+        std::cout << " " << basicBlock.label;
+      }
+      std::cout << " ->";
+      for (auto successor : basicBlock.successors) {
+        std::cout << " " << successor;
+      }
+      if (basicBlock.isExit) {
+        std::cout << " exit";
+      }
+
+      size_t dominator = dominators.immediateDominator(block);
+      std::cout << ", idom ";
+      if (dominator == DominatorTree::NONE) {
+        std::cout << "-";
+      } else {
+        std::cout << dominator;
+      }
+
+      std::cout << ", live in ";
+      printRegisters(std::cout, liveness.liveIn(block));
+      std::cout << " out ";
+      printRegisters(std::cout, liveness.liveOut(block));
+      std::cout << ", " << reachingDefinitions.reachingIn(block).count() << " definitions reach" << std::endl;
+    }
+  }
+}
+
+void Generator::writeOutput() {
+  for (const auto& buffer : codeBuffers) {
+    for (const auto& instruction : buffer.instructions) {
+      *file->fileStream << instruction << "\n";
+    }
   }
 }
 
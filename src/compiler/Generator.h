@@ -6,32 +6,17 @@
 #define COMPILER_VISUALIZATION_GENERATOR_H
 
 #include "AST.h"
+#include "Instruction.h"
+#include "InstructionSelector.h"
+#include "PassManager.h"
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <set>
 #include <utility>
 
 struct Data;
 
-enum Register {
-  NONE = 1000,
-
-  RAX = 0,
-  RBX = 1,
-  RCX = 2,
-  RDX = 3,
-  R8 = 4,
-  R9 = 5,
-  R10 = 6,
-  R11 = 7,
-  RSI = 8,
-  RDI = 9,
-
-  R15 = 15,
-};
-#define TOTAL_REGISTERS 10
-std::ostream& operator<<(std::ostream& os, const Register& reg);
-
 #define TOTAL_PROC_CALL_REGISTERS 6
 constexpr static Register procCallRegisterOrder[] = {
     Register::RDI,
@@ -46,39 +31,33 @@ constexpr static Register procCallReturnRegisterOrder[] = {
     Register::RAX,
     Register::RDX,
 };
-#define TOTAL_CALLE_SAVED_REGISTERS 2
+#define TOTAL_CALLE_SAVED_REGISTERS 5
 constexpr static Register calleSavedRegisters[] = { // Must be preserved across proc calls
     Register::RBX,
-    //Register::R12, Register::R13, Register::R14,
+    Register::R12, Register::R13, Register::R14,
     Register::R15,
     //Register::RSP, Register::RBP,
 };
 
-std::string registerToByteEquivalent(Register reg, unsigned int bytes);
-std::string registerTo8BitEquivalent(Register reg);
-std::string registerTo16BitEquivalent(Register reg);
-std::string registerTo32BitEquivalent(Register reg);
-
-struct Label {
-  unsigned int id;
-
-  explicit Label(bool exists = true) {
-    if (exists) {
-      this->id = idCount++;
-    } else {
-      this->id = 0;
-    }
-  }
-
-  bool exists() {
-    return id != 0;
-  }
-
-private:
-  static unsigned int idCount;
-
+#define TOTAL_PROMOTED_LOCAL_REGISTERS 7
+constexpr static Register promotedLocalRegisterOrder[] = { // Never needed for arguments or division
+    // Survive calls, so only cost a save and restore in the procedure's head and tail
+    Register::RBX,
+    Register::R12,
+    Register::R13,
+    Register::R14,
+    Register::R15,
+    Register::R10,
+    Register::R11,
 };
-std::ostream& operator<<(std::ostream& os, const Label& location);
+// Registers left over for evaluating expressions before any local is promoted
+#define MIN_TEMPORARY_REGISTERS 5
+
+// Bytes below rsp that signal handlers leave alone, so a procedure that makes no calls can keep its frame there
+#define RED_ZONE_SIZE 128
+// Most computing both arms of an if may cost (as the instruction selector counts it) to pick one with cmov instead
+// of branching
+#define IF_CONVERSION_COST_LIMIT 8
 
 enum ParameterClass {
   NO_CLASS = 0,
@@ -97,6 +76,17 @@ struct OutputFile {
   std::ofstream* fileStream;
 };
 
+// Set from the command line
+struct GeneratorOptions {
+  std::string profileFilepath; // Call counts to lay procedures out by; estimated from the loops when empty
+  unsigned int unrollFactor = 4; // Copies of a counted loop's body per iteration; 1 turns partial unrolling off
+  unsigned int unrollBudget = 192; // Most AST nodes the copies of one unrolled loop may add up to
+  bool dumpDataflow = false; // Print each procedure's control flow graph, dominators and liveness once optimised
+  PassSet passes = PassSet().set(); // Optional passes to run; all of them, as at -O2, unless told otherwise
+  bool timePasses = false; // Print the time, size change and memory of each pass that ran
+  unsigned int jobs = 0; // Threads the per-procedure passes run on; 0 for one per core
+};
+
 struct BlockScope {
   struct Procedure {
     struct Parameter {
@@ -109,8 +99,7 @@ struct BlockScope {
     DataType returnDataType;
   };
   struct Variable {
-    unsigned int stackHeight;
-    unsigned int offset = 0;
+    unsigned int offset = 0; // From the procedure's frame base (or its stack params for stack parameters)
     Location* location;
     DataType dataType;
 
@@ -118,7 +107,6 @@ struct BlockScope {
   };
 
   BlockScope* parent = nullptr;
-  unsigned int stackHeight;
 
   unsigned int totalLocalBytes = 0;
 
@@ -155,19 +143,20 @@ struct BlockScope {
   }
 };
 
-class Generator {
-public:
-  struct StreamHelper {
-    StreamHelper() = default;
-    StreamHelper(std::ostream* fileOut)
-      : _fileOut(fileOut) {}
-    std::ostream* _fileOut = nullptr;
-    std::stringstream ss;
-  };
+// Operands of a lea, as the expressions whose values are the base and index
+struct Address {
+  ASTExpression* base = nullptr;
+  ASTExpression* index = nullptr;
+  unsigned int scale = 1;
+  long long displacement = 0;
+};
 
+class Generator {
 private:
   ASTNode* astRoot;
   OutputFile* file;
+  GeneratorOptions options;
+  PassManager passManager;
 
   bool genComments = true;
 
@@ -176,19 +165,65 @@ private:
 
   Location* registerContents[TOTAL_REGISTERS] = { nullptr };
   std::map<Location*, Register> locationMap;
+  // Reads of a local loaded from its frame slot that share one register, as they are in the same statement; the
+  // register is freed once the last of them is consumed
+  std::map<Location*, unsigned int> sharedReads;
 
   std::stack<BlockScope> blockScopeStack;
+  std::map<ASTBlock*, unsigned int> frameOffsets; // Current procedure's block -> offset of its locals
+
+  // Current procedure's liveness: statement -> its index in walk order, ident -> index of its last read
+  std::map<ASTNode*, unsigned int> statementIndices;
+  std::map<std::string, unsigned int> lastReads;
+  std::map<std::string, unsigned int> useWeights; // Uses, with those in loops weighted higher
+  std::vector<ASTVariableDeclaration*> localDeclarations;
+  unsigned int loopDepth = 0;
+
+  // Current procedure's values that live in registers rather than memory
+  std::map<ASTVariableDeclaration*, std::pair<Register, Location*>> promotedLocals;
+  std::map<Location*, std::string> registerResidentIdents; // Promoted locals and parameters
+
+  // Current procedure's repeated expressions; later occurrences reload the first one's result from a frame slot
+  typedef std::map<std::string, ASTExpression*> AvailableExpressions; // Value number -> first occurrence
+  std::map<ASTExpression*, unsigned int> expressionSlots; // First occurrence -> its slot
+  std::map<ASTExpression*, ASTExpression*> reusedExpressions; // Later occurrence -> first occurrence
+  unsigned int expressionSlotOffset = 0; // Frame offset of the current procedure's expression slots
+  std::map<ASTWhile*, std::vector<ASTExpression*>> loopInvariants; // Loop -> expressions its preheader computes
+
+  unsigned int callSaveOffset = 0; // Frame offset of the current procedure's call save slots
+  unsigned int callSaveSlots = 0; // Most slots any one call in the current procedure needs
+
+  // Current procedure's calls that jump to their callee after tearing the frame down, and where each jump is
+  std::set<ASTProcedureCall*> tailCalls;
+  std::vector<size_t> tailCallIndices;
+  std::set<std::string> internalProcedures;
+
+  InstructionSelector selector;
+
+  std::vector<CodeBuffer> codeBuffers; // Emitted in order; written out once the per-procedure passes have run
+  std::set<std::string> abiCompliantProcedures; // Preserve the callee saved registers
 
-  bool _isOutputFlushed = true;
-  StreamHelper _output;
   const std::function<void(const Data&)>& ready;
 
 public:
-  Generator(const std::function<void(const Data&)>& ready, ASTNode* astRoot, std::string filepath);
+  Generator(const std::function<void(const Data&)>& ready, ASTNode* astRoot, std::string filepath,
+            GeneratorOptions options = GeneratorOptions());
   ~Generator();
 
   void generate();
   void walkBlock(ASTBlock* node, bool isEntrypoint = false, const std::function<void(BlockScope&)>& initCallback = nullptr);
+  unsigned int layoutFrame(ASTStatement* node, unsigned int frameOffset);
+  unsigned int analyseLiveness(ASTStatement* node, unsigned int index);
+  void recordReads(ASTExpression* node, unsigned int index);
+  void promoteLocals();
+  void numberExpressions(ASTStatement* node, AvailableExpressions& available);
+  void numberCondition(ASTExpression* node, AvailableExpressions& available, bool isConditional);
+  void numberValue(ASTExpression* node, AvailableExpressions& available, bool isConditional);
+  static void collectInvariants(ASTStatement* node, const std::set<std::string>& assigned, std::vector<ASTExpression*>& invariants);
+  static void collectInvariants(ASTExpression* node, const std::set<std::string>& assigned, bool isAlwaysEvaluated, std::vector<ASTExpression*>& invariants);
+  static void collectInvariantsInCondition(ASTExpression* node, const std::set<std::string>& assigned, bool isAlwaysEvaluated, std::vector<ASTExpression*>& invariants);
+  static std::string valueNumber(ASTExpression* node);
+  static void killExpressions(AvailableExpressions& available, const std::string& ident);
   void walkStatement(ASTStatement* node);
   Location* walkExpression(ASTExpression* node);
   void walkVariableDeclaration(ASTVariableDeclaration* node);
@@ -196,41 +231,85 @@ public:
   void walkProcedureCall(ASTProcedureCall* node);
   void walkVariableAssignment(ASTVariableAssignment* node);
   void walkIf(ASTIf* node);
+  bool walkIfAsSelect(ASTIf* node);
   void walkWhile(ASTWhile* node);
   void walkContinue(ASTContinue* node);
   void walkBreak(ASTBreak* node);
   void walkReturn(ASTReturn* node);
+  void walkCondition(ASTExpression* node, const Label& target, bool jumpIfTrue);
+  std::string emitComparison(ASTExpression* node);
   Location* walkBinOp(ASTBinOp* node);
+  Location* walkBinOpByConstant(ASTBinOp* node, ASTExpression* operand, unsigned long long constant);
+  Location* walkBinOpWithOperand(ASTBinOp* node, const InstructionSelector::Choice& choice);
+  Location* walkLea(ASTBinOp* node, const InstructionSelector::Choice& choice);
+  void walkAddress(ASTExpression* node, InstructionSelector::Nonterminal as, Address& address);
+  Operand operandFor(ASTExpression* node, InstructionSelector::Nonterminal as);
   Location* walkUnaryOp(ASTUnaryOp* node);
   Location* walkLiteral(ASTLiteral* node);
   Location* walkVariableIdent(ASTVariableIdent* node);
 
-  void writeStringLiteralList(const std::string& str);
-  std::vector<std::pair<Register, Location*>> pushCallerSaved();
-  void popCallerSaved(std::vector<std::pair<Register, Location*>> savedRegisters);
+  void writeStringLiteralList(std::ostream& os, const std::string& str);
+  bool isLiveAfter(Location* location, unsigned int index);
+  Operand callSaveSlot(unsigned int slot);
+  Operand expressionSlot(unsigned int slot);
+  Location* recallExpression(ASTExpression* node, ASTExpression* firstOccurrence);
+  std::vector<std::pair<Register, Location*>> saveCallerSaved(unsigned int callIndex);
+  void restoreCallerSaved(const std::vector<std::pair<Register, Location*>>& savedRegisters);
 
   void swapLocation(Register reg, Location* oldLoc, Location* newLoc, bool forceRmParam = false);
   void removeLocation(Register reg, Location* oldLoc = nullptr, bool forceRmParam = false);
   void removeLocation(Location* oldLoc, bool forceRmParam = false);
+  bool isStillRead(Location* location);
+  // What every register holds, to put back after code that only some paths run
+  struct RegisterState {
+    std::vector<Location*> contents;
+    std::map<Location*, Register> locations;
+  };
+  RegisterState saveRegisters() const;
+  void restoreRegisters(const RegisterState& state);
+
   void requireRegistersFree(const std::vector<Register>& registers);
+  void relocate(Register reg, const std::vector<Register>& excludingRegisters = {});
   void moveToRegister(Register reg, Location* location, const std::vector<Register>& excludingRegisters = {});
+  void copyToRegister(Register reg, Location* location, Location* copyLocation, const std::vector<Register>& excludingRegisters = {});
   Register getAvailableRegister();
   Register getAvailableRegister(const std::vector<Register>& excludingRegisters);
   Register getRegisterForConst(Location* location, unsigned long long constant);
   Register getRegisterForConst(Location* location, const std::string& constant);
-  Register getRegisterFor(Location* location, bool isConstant = false, const std::string& constant = "");
+  Register getRegisterFor(Location* location, bool isConstant = false, const Operand& constant = Operand());
   Register getRegisterForCopy(Location* location, Location* newLocation);
-
-  Register registerWithAddressForVariable(BlockScope::Variable variable);
+  static bool isTemporary(ASTExpression* node);
+  bool isWide(ASTExpression* node);
+  // Offset of a local of `bytes` from the frame base, rounded so that it is naturally aligned
+  static unsigned int alignedOffset(unsigned int offset, unsigned int bytes);
+  static unsigned long long divisionMagic(unsigned long long divisor);
+  void emitMultiplyByConstant(Register reg, unsigned long long constant);
+  void emitDivideByConstant(Register reg, unsigned long long divisor);
+
+  Operand addressOfVariable(const BlockScope::Variable& variable);
+  void assignVariable(const std::string& ident, Location* loc, unsigned int bytes);
+  void emitSignExtend(Register reg, const Operand& source, const std::string& trailingComment = "");
   void moveToMem(const std::string& ident, Location* loc, unsigned int bytes);
   Location* recallFromMem(const std::string& ident, unsigned int bytes);
   void recallFromParamRegister(Location* location);
 
+  void emit(const std::string& mnemonic, const std::vector<Operand>& operands = {}, const std::string& trailingComment = "");
+  void emitLabel(const Label& label);
+  void emitLabel(const std::string& name);
+  void emitDirective(const std::string& text);
+  void emitInstruction(const Instruction& instruction);
   void comment(const std::string& comment);
   void dumpRegisters(bool mismatchCheckOnly = false);
 
-  StreamHelper& output();
-  void flushOutput();
+  void runTailCalls(ASTBlock* block);
+  void runInliner(ASTBlock* block);
+  void runUnroller(ASTBlock* block);
+  void runBranchFolder(ASTBlock* block);
+  void runDeadProcedures(ASTBlock* block);
+  void runLayout(ASTBlock* block);
+  void runProcedurePasses();
+  void dumpDataflow();
+  void writeOutput();
 
   void enterNode(ASTNode* node, const std::string& commentName);
   void exitNode(ASTNode* node, const std::string& commentName);
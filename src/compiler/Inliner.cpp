@@ -0,0 +1,241 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <algorithm>
+#include <functional>
+#include "Inliner.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cppcoreguidelines-pro-type-static-cast-downcast"
+
+// Calls the visitors on every statement and expression in `node`, parents first
+static void visit(ASTStatement* node, const std::function<void(ASTStatement*)>& onStatement,
+                  const std::function<void(ASTExpression*)>& onExpression) {
+  std::function<void(ASTExpression*)> visitExpression = [&](ASTExpression* expression) {
+    if (!expression) return;
+    onExpression(expression);
+    if (expression->type == ASTType::BIN_OP) {
+      visitExpression(static_cast<ASTBinOp*>(expression)->left);
+      visitExpression(static_cast<ASTBinOp*>(expression)->right);
+    } else if (expression->type == ASTType::UNARY_OP) {
+      visitExpression(static_cast<ASTUnaryOp*>(expression)->child);
+    }
+  };
+
+  if (!node) return;
+  onStatement(node);
+  switch (node->type) {
+    case BLOCK:
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        visit(statement, onStatement, onExpression);
+      }
+      break;
+    case PROC_CALL:
+      for (auto parameter : static_cast<ASTProcedureCall*>(node)->parameters) {
+        visitExpression(parameter);
+      }
+      break;
+    case VARIABLE_DECL:
+      visitExpression(static_cast<ASTVariableDeclaration*>(node)->initialValueExpression);
+      break;
+    case VARIABLE_ASSIGNMENT:
+      visitExpression(static_cast<ASTVariableAssignment*>(node)->newValueExpression);
+      break;
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      visitExpression(ifNode->conditional);
+      visit(ifNode->trueStatement, onStatement, onExpression);
+      visit(ifNode->falseStatement, onStatement, onExpression);
+      break;
+    }
+    case WHILE: {
+      auto* whileNode = static_cast<ASTWhile*>(node);
+      visitExpression(whileNode->conditional);
+      visit(whileNode->body, onStatement, onExpression);
+      break;
+    }
+    case RETURN:
+      visitExpression(static_cast<ASTReturn*>(node)->expression);
+      break;
+    default:
+      break;
+  }
+}
+
+Inliner::Inliner(ASTBlock* root)
+    : root(root) {
+}
+
+void Inliner::run() {
+  for (auto& statement : root->statements) {
+    if (statement->type != ASTType::PROC_DECL) continue;
+    auto* procedure = static_cast<ASTProcedure*>(statement);
+    if (procedure->isExternal) continue;
+
+    collectCalls(procedure->block, callGraph[procedure->ident]);
+
+    // Only procedures declared before it are visible to it, so this is final
+    Callee callee;
+    callee.procedure = procedure;
+    std::set<std::string> visited;
+    callee.isRecursive = reaches(procedure->ident, procedure->ident, visited);
+    callees[procedure->ident] = callee;
+
+    ASTStatement* body = procedure->block;
+    unsigned int depth = 0;
+    inlineCalls(body, procedure, nullptr, depth);
+
+    Callee& inlined = callees.at(procedure->ident);
+    inlined.size = sizeOf(procedure->block);
+    inlined.depth = depth;
+    inlined.hasReturn = hasReturn(procedure->block);
+  }
+}
+
+void Inliner::inlineCalls(ASTStatement*& node, ASTProcedure* caller, ASTBlock* parent, unsigned int& depth) {
+  switch (node->type) {
+    case BLOCK: {
+      auto* block = static_cast<ASTBlock*>(node);
+      for (auto& statement : block->statements) {
+        inlineCalls(statement, caller, block, depth);
+      }
+      break;
+    }
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      inlineCalls(ifNode->trueStatement, caller, parent, depth);
+      if (ifNode->falseStatement) {
+        inlineCalls(ifNode->falseStatement, caller, parent, depth);
+      }
+      break;
+    }
+    case WHILE: {
+      auto* whileNode = static_cast<ASTWhile*>(node);
+      for (auto& statement : whileNode->body->statements) {
+        inlineCalls(statement, caller, whileNode->body, depth);
+      }
+      break;
+    }
+    case PROC_CALL: {
+      auto* call = static_cast<ASTProcedureCall*>(node);
+      auto callee = callees.find(call->ident);
+      if (callee == callees.end()) break; // External
+
+      Decision decision;
+      decision.caller = caller->ident;
+      decision.callee = call->ident;
+      if (isInlinable(call, callee->second, decision.reason)) {
+        node = expand(call, callee->second, parent);
+        depth = std::max(depth, callee->second.depth + 1);
+        decision.isInlined = true;
+      }
+      decisions.push_back(decision);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+bool Inliner::isInlinable(ASTProcedureCall* call, const Callee& callee, std::string& reason) const {
+  ASTProcedure* procedure = callee.procedure;
+  if (callee.isRecursive) {
+    reason = "recursive";
+  } else if (callee.hasReturn) {
+    reason = "returns early";
+  } else if (call->parameters.size() != procedure->parameters.size()) {
+    reason = "wrong number of arguments";
+  } else if (std::any_of(procedure->parameters.begin(), procedure->parameters.end(),
+                         [](ASTVariableDeclaration* parameter) { return bytesOf(parameter->dataType) == 0; })) {
+    reason = "void parameter";
+  } else if (callee.size > INLINE_SIZE_LIMIT) {
+    reason = "too large (" + std::to_string(callee.size) + " nodes)";
+  } else if (callee.depth + 1 > INLINE_DEPTH_LIMIT) {
+    reason = "too deep";
+  } else {
+    return true;
+  }
+  return false;
+}
+
+ASTBlock* Inliner::expand(ASTProcedureCall* call, const Callee& callee, ASTBlock* parent) {
+  ASTProcedure* procedure = callee.procedure;
+  cloner.suffix = "." + std::to_string(++expansions);
+  const std::string& suffix = cloner.suffix;
+
+  auto* block = new ASTBlock();
+  block->nodeId = call->nodeId;
+  block->parent = parent;
+
+  for (size_t i = 0; i < procedure->parameters.size(); ++i) {
+    ASTVariableDeclaration* parameter = procedure->parameters[i];
+    ASTExpression* argument = call->parameters[i];
+
+    // A literal the parameter's type holds as is, when nothing else can be bound to the parameter's name
+    unsigned int bytes = bytesOf(parameter->dataType);
+    auto* literal = static_cast<ASTLiteral*>(argument);
+    if (argument->type == ASTType::LITERAL && literal->valueType == ASTLiteral::ValueType::INTEGER
+        && literal->value.integerData < (1ULL << (8 * bytes - 1)) && !isRebound(procedure->block, parameter->ident)) {
+      cloner.constants[parameter->ident + suffix] = literal->value.integerData;
+      continue;
+    }
+
+    auto* declaration = new ASTVariableDeclaration();
+    declaration->nodeId = parameter->nodeId;
+    declaration->dataType = parameter->dataType;
+    declaration->ident = parameter->ident + suffix;
+    declaration->initialValueExpression = argument;
+    block->statements.push_back(declaration);
+  }
+
+  block->statements.push_back(cloner.cloneBlock(procedure->block, block));
+  return block;
+}
+
+bool Inliner::reaches(const std::string& from, const std::string& to, std::set<std::string>& visited) const {
+  auto calls = callGraph.find(from);
+  if (calls == callGraph.end()) return false;
+
+  for (const auto& callee : calls->second) {
+    if (callee == to) return true;
+    if (visited.insert(callee).second && reaches(callee, to, visited)) return true;
+  }
+  return false;
+}
+
+unsigned int Inliner::sizeOf(ASTStatement* node) {
+  unsigned int size = 0;
+  visit(node, [&size](ASTStatement*) { size++; }, [&size](ASTExpression*) { size++; });
+  return size;
+}
+
+void Inliner::collectCalls(ASTStatement* node, std::set<std::string>& calls) {
+  visit(node, [&calls](ASTStatement* statement) {
+    if (statement->type == ASTType::PROC_CALL) {
+      calls.insert(static_cast<ASTProcedureCall*>(statement)->ident);
+    }
+  }, [](ASTExpression*) {});
+}
+
+bool Inliner::hasReturn(ASTStatement* node) {
+  bool found = false;
+  visit(node, [&found](ASTStatement* statement) {
+    found |= statement->type == ASTType::RETURN;
+  }, [](ASTExpression*) {});
+  return found;
+}
+
+bool Inliner::isRebound(ASTStatement* node, const std::string& ident) {
+  bool found = false;
+  visit(node, [&found, &ident](ASTStatement* statement) {
+    if (statement->type == ASTType::VARIABLE_ASSIGNMENT) {
+      found |= static_cast<ASTVariableAssignment*>(statement)->ident == ident;
+    } else if (statement->type == ASTType::VARIABLE_DECL) {
+      found |= static_cast<ASTVariableDeclaration*>(statement)->ident == ident;
+    }
+  }, [](ASTExpression*) {});
+  return found;
+}
+
+#pragma clang diagnostic pop
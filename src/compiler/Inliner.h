@@ -0,0 +1,80 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_INLINER_H
+#define COMPILER_VISUALIZATION_INLINER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "AST.h"
+#include "Cloner.h"
+
+// Bodies larger than this many AST nodes are left as calls
+#define INLINE_SIZE_LIMIT 40
+// Longest chain of procedures inlined into each other
+#define INLINE_DEPTH_LIMIT 3
+
+// Replaces calls to small internal procedures with a copy of their body, so the argument shuffling, the caller
+// saved registers, the call and the callee's frame all go. Procedures are visited in the order they are declared,
+// so a callee has already had its own calls inlined by the time it is copied into its callers.
+//
+// The copy is a block declaring the parameters as locals initialised with the arguments, followed by the body.
+// Every variable in the copy gets the same new suffix, so it can't capture or shadow anything the arguments read.
+// Parameters that are given an integer literal and never assigned are replaced by the literal instead.
+class Inliner {
+public:
+  struct Decision {
+    std::string caller;
+    std::string callee;
+    bool isInlined = false;
+    std::string reason; // Why it wasn't
+  };
+
+private:
+  struct Callee {
+    ASTProcedure* procedure = nullptr;
+    unsigned int size = 0; // AST nodes in the body
+    unsigned int depth = 0; // Longest chain of procedures inlined into it
+    bool isRecursive = false;
+    bool hasReturn = false;
+  };
+
+  ASTBlock* root;
+  // Internal procedures declared so far, which are the only ones a procedure can call
+  std::map<std::string, Callee> callees;
+  std::map<std::string, std::set<std::string>> callGraph;
+  std::vector<Decision> decisions;
+  unsigned int expansions = 0;
+
+  // Makes the copy being made, renaming every variable in it
+  Cloner cloner;
+
+public:
+  explicit Inliner(ASTBlock* root);
+
+  void run();
+
+  const std::vector<Decision>& getDecisions() const {
+    return decisions;
+  }
+
+private:
+  // Inlines the calls in `node`, which is replaced when it is a call itself; `depth` grows to the longest chain
+  // inlined
+  void inlineCalls(ASTStatement*& node, ASTProcedure* caller, ASTBlock* parent, unsigned int& depth);
+  bool isInlinable(ASTProcedureCall* call, const Callee& callee, std::string& reason) const;
+  ASTBlock* expand(ASTProcedureCall* call, const Callee& callee, ASTBlock* parent);
+
+  bool reaches(const std::string& from, const std::string& to, std::set<std::string>& visited) const;
+
+  static unsigned int sizeOf(ASTStatement* node);
+  static void collectCalls(ASTStatement* node, std::set<std::string>& calls);
+  static bool hasReturn(ASTStatement* node);
+  // Whether `ident` is assigned or declared again anywhere in `node`
+  static bool isRebound(ASTStatement* node, const std::string& ident);
+};
+
+#endif //COMPILER_VISUALIZATION_INLINER_H
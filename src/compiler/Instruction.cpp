@@ -0,0 +1,475 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <iostream>
+#include <sstream>
+#include <map>
+#include "Instruction.h"
+
+unsigned int Label::idCount = 1;
+
+std::string registerToByteEquivalent(Register reg, unsigned int bytes) {
+  if (bytes == 1) {
+    return registerTo8BitEquivalent(reg);
+  } else if (bytes == 2) {
+    return registerTo16BitEquivalent(reg);
+  } else if (bytes == 4) {
+    return registerTo32BitEquivalent(reg);
+  } else if (bytes == 8) {
+    std::stringstream ss;
+    ss << reg;
+    return ss.str();
+  } else {
+    std::cout << "Byte amount not supported!" << std::endl;
+    throw std::exception();
+  }
+}
+
+std::string registerTo8BitEquivalent(Register reg) {
+  switch (reg) {
+    case NONE:
+      return "REGISTER_NONE";
+    case RAX:
+      return "al";
+    case RBX:
+      return "bl";
+    case RCX:
+      return "cl";
+    case RDX:
+      return "dl";
+    case RSI:
+      return "sil";
+    case RDI:
+      return "dil";
+    case RBP:
+      return "bpl";
+    case RSP:
+      return "spl";
+    case R8:
+    case R9:
+    case R10:
+    case R11:
+    case R12:
+    case R13:
+    case R14:
+    case R15: {
+      std::stringstream ss;
+      ss << reg << "b";
+      return ss.str();
+    }
+  }
+  throw std::exception();
+}
+
+std::string registerTo16BitEquivalent(Register reg) {
+  switch (reg) {
+    case NONE:
+      return "REGISTER_NONE";
+    case RAX:
+      return "ax";
+    case RBX:
+      return "bx";
+    case RCX:
+      return "cx";
+    case RDX:
+      return "dx";
+    case RSI:
+      return "si";
+    case RDI:
+      return "di";
+    case RBP:
+      return "bp";
+    case RSP:
+      return "sp";
+    case R8:
+    case R9:
+    case R10:
+    case R11:
+    case R12:
+    case R13:
+    case R14:
+    case R15: {
+      std::stringstream ss;
+      ss << reg << "w";
+      return ss.str();
+    }
+  }
+  throw std::exception();
+}
+
+std::string registerTo32BitEquivalent(Register reg) {
+  switch (reg) {
+    case NONE:
+      return "REGISTER_NONE";
+    case RAX:
+      return "eax";
+    case RBX:
+      return "ebx";
+    case RCX:
+      return "ecx";
+    case RDX:
+      return "edx";
+    case RSI:
+      return "esi";
+    case RDI:
+      return "edi";
+    case RBP:
+      return "ebp";
+    case RSP:
+      return "esp";
+    case R8:
+    case R9:
+    case R10:
+    case R11:
+    case R12:
+    case R13:
+    case R14:
+    case R15: {
+      std::stringstream ss;
+      ss << reg << "d";
+      return ss.str();
+    }
+  }
+  throw std::exception();
+}
+
+RegisterMask registerMask(Register reg) {
+  if (reg == Register::NONE) return 0;
+  return 1u << (unsigned int) reg;
+}
+
+Operand::Operand(const Label& label)
+    : type(Type::SYMBOL) {
+  std::stringstream ss;
+  ss << label;
+  symbol = ss.str();
+}
+
+Operand Operand::memory(Register base, long long displacement, unsigned int bytes) {
+  Operand operand;
+  operand.type = Type::MEMORY;
+  operand.reg = base;
+  operand.value = displacement;
+  operand.bytes = bytes;
+  return operand;
+}
+
+Operand Operand::memory(Register base, Register index, unsigned int scale, long long displacement, unsigned int bytes) {
+  Operand operand = memory(base, displacement, bytes);
+  operand.index = index;
+  operand.scale = scale;
+  return operand;
+}
+
+Operand Operand::symbolic(const std::string& symbol) {
+  Operand operand;
+  operand.type = Type::SYMBOL;
+  operand.symbol = symbol;
+  return operand;
+}
+
+RegisterMask Operand::registersRead() const {
+  switch (type) {
+    case Type::REGISTER:
+      return registerMask(reg);
+    case Type::MEMORY:
+      return registerMask(reg) | registerMask(index);
+    default:
+      return 0;
+  }
+}
+
+bool Operand::operator==(const Operand& other) const {
+  return type == other.type
+      && reg == other.reg
+      && bytes == other.bytes
+      && value == other.value
+      && index == other.index
+      && scale == other.scale
+      && symbol == other.symbol;
+}
+
+std::ostream& operator<<(std::ostream& os, const Operand& operand) {
+  switch (operand.type) {
+    case Operand::Type::NONE:
+      break;
+    case Operand::Type::REGISTER:
+      os << registerToByteEquivalent(operand.reg, operand.bytes);
+      break;
+    case Operand::Type::IMMEDIATE:
+      os << operand.value;
+      break;
+    case Operand::Type::SYMBOL:
+      os << operand.symbol;
+      break;
+    case Operand::Type::MEMORY:
+      switch (operand.bytes) {
+        case 1: os << "byte "; break;
+        case 2: os << "word "; break;
+        case 4: os << "dword "; break;
+        case 8: os << "qword "; break;
+        default: break;
+      }
+      os << "[" << operand.reg;
+      if (operand.index != Register::NONE) {
+        os << " + " << operand.index;
+        if (operand.scale != 1) {
+          os << "*" << operand.scale;
+        }
+      }
+      if (operand.value > 0) {
+        os << " + " << operand.value;
+      } else if (operand.value < 0) {
+        os << " - " << -operand.value;
+      }
+      os << "]";
+      break;
+  }
+  return os;
+}
+
+Instruction Instruction::label(const Label& label) {
+  return Instruction::label(Operand(label).symbol);
+}
+
+Instruction Instruction::label(const std::string& name) {
+  Instruction instruction;
+  instruction.type = Type::LABEL;
+  instruction.mnemonic = name;
+  return instruction;
+}
+
+Instruction Instruction::directive(const std::string& text) {
+  Instruction instruction;
+  instruction.type = Type::DIRECTIVE;
+  instruction.mnemonic = text;
+  return instruction;
+}
+
+Instruction Instruction::commentLine(const std::string& text) {
+  Instruction instruction;
+  instruction.type = Type::COMMENT;
+  instruction.mnemonic = text;
+  return instruction;
+}
+
+bool Instruction::isUnconditionalJump() const {
+  return isInstruction() && mnemonic == "jmp";
+}
+
+bool Instruction::isConditionalJump() const {
+  return isInstruction() && mnemonic.size() > 1 && mnemonic[0] == 'j' && mnemonic != "jmp";
+}
+
+bool Instruction::isBarrier() const {
+  return isUnconditionalJump() || (isInstruction() && mnemonic == "ret");
+}
+
+std::string Instruction::jumpTarget() const {
+  if ((isUnconditionalJump() || isConditionalJump())
+      && !operands.empty() && operands[0].type == Operand::Type::SYMBOL) {
+    return operands[0].symbol;
+  }
+  return "";
+}
+
+static const RegisterMask procCallArgumentsMask = (1u << RDI) | (1u << RSI) | (1u << RDX)
+    | (1u << RCX) | (1u << R8) | (1u << R9) | (1u << RAX);
+static const RegisterMask procCallClobberedMask = (1u << RAX) | (1u << RCX) | (1u << RDX)
+    | (1u << RSI) | (1u << RDI) | (1u << R8) | (1u << R9) | (1u << R10) | (1u << R11);
+static const RegisterMask procReturnMask = (1u << RAX) | (1u << RBX) | (1u << R12) | (1u << R13)
+    | (1u << R14) | (1u << R15) | (1u << RBP) | (1u << RSP);
+
+static bool startsWith(const std::string& str, const std::string& prefix) {
+  return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+static bool isTwoOperandArithmetic(const std::string& mnemonic) {
+  return mnemonic == "add" || mnemonic == "sub" || mnemonic == "and" || mnemonic == "or"
+      || mnemonic == "xor" || mnemonic == "adc" || mnemonic == "sbb" || mnemonic == "imul"
+      || mnemonic == "shl" || mnemonic == "shr" || mnemonic == "sar" || startsWith(mnemonic, "cmov");
+}
+
+RegisterMask Instruction::registersRead() const {
+  if (!isInstruction()) return 0;
+
+  RegisterMask mask = 0;
+  for (auto& operand : operands) {
+    if (operand.type == Operand::Type::MEMORY) {
+      mask |= operand.registersRead();
+    }
+  }
+  auto readOperand = [&](size_t i) {
+    if (i < operands.size() && operands[i].type == Operand::Type::REGISTER) {
+      mask |= operands[i].registersRead();
+    }
+  };
+
+  if (mnemonic == "mov" || mnemonic == "movzx" || mnemonic == "movsx" || mnemonic == "movsxd"
+      || mnemonic == "lea") {
+    readOperand(1);
+    if (!operands.empty() && operands[0].type == Operand::Type::REGISTER && operands[0].bytes < 4) {
+      readOperand(0); // Merges into the rest of the register
+    }
+  } else if (mnemonic == "xor" && operands.size() == 2 && operands[0] == operands[1]) {
+    // Zeroing idiom
+  } else if (mnemonic == "imul" && operands.size() == 3) {
+    readOperand(1);
+  } else if (mnemonic == "imul" && operands.size() == 1) {
+    mask |= registerMask(RAX);
+    readOperand(0);
+  } else if (isTwoOperandArithmetic(mnemonic) || mnemonic == "cmp" || mnemonic == "test") {
+    readOperand(0);
+    readOperand(1);
+  } else if (startsWith(mnemonic, "set")) {
+    readOperand(0); // Partial write keeps the upper bits
+  } else if (mnemonic == "neg" || mnemonic == "not" || mnemonic == "inc" || mnemonic == "dec") {
+    readOperand(0);
+  } else if (mnemonic == "push") {
+    readOperand(0);
+    mask |= registerMask(RSP);
+  } else if (mnemonic == "pop") {
+    mask |= registerMask(RSP);
+  } else if (mnemonic == "cdq" || mnemonic == "cqo") {
+    mask |= registerMask(RAX);
+  } else if (mnemonic == "idiv" || mnemonic == "div") {
+    mask |= registerMask(RAX) | registerMask(RDX);
+    readOperand(0);
+  } else if (mnemonic == "call") {
+    mask |= procCallArgumentsMask | registerMask(RSP);
+  } else if (mnemonic == "ret") {
+    mask |= procReturnMask;
+  } else if (isUnconditionalJump() || isConditionalJump()) {
+    // Only flags
+  } else {
+    // Unknown to us, so assume the worst
+    mask = ALL_REGISTERS_MASK;
+  }
+
+  return mask;
+}
+
+RegisterMask Instruction::registersWritten() const {
+  if (!isInstruction()) return 0;
+
+  auto fullyWrittenOperand = [&]() -> RegisterMask {
+    if (!operands.empty() && operands[0].type == Operand::Type::REGISTER && operands[0].bytes >= 4) {
+      return registerMask(operands[0].reg);
+    }
+    return 0;
+  };
+
+  if (mnemonic == "mov" || mnemonic == "movzx" || mnemonic == "movsx" || mnemonic == "movsxd"
+      || mnemonic == "lea" || mnemonic == "pop" || isTwoOperandArithmetic(mnemonic)
+      || mnemonic == "neg" || mnemonic == "not" || mnemonic == "inc" || mnemonic == "dec") {
+    if (mnemonic == "imul" && operands.size() == 1) {
+      return registerMask(RAX) | registerMask(RDX);
+    }
+    return fullyWrittenOperand();
+  } else if (mnemonic == "cdq" || mnemonic == "cqo") {
+    return registerMask(RDX);
+  } else if (mnemonic == "idiv" || mnemonic == "div") {
+    return registerMask(RAX) | registerMask(RDX);
+  } else if (mnemonic == "call") {
+    return procCallClobberedMask;
+  }
+
+  return 0;
+}
+
+std::ostream& operator<<(std::ostream& os, const Instruction& instruction) {
+  switch (instruction.type) {
+    case Instruction::Type::LABEL:
+      os << instruction.mnemonic << ":";
+      break;
+    case Instruction::Type::DIRECTIVE:
+      os << instruction.mnemonic;
+      break;
+    case Instruction::Type::COMMENT:
+      os << ";" << instruction.mnemonic;
+      break;
+    case Instruction::Type::INSTRUCTION:
+      os << instruction.mnemonic;
+      for (size_t i = 0; i < instruction.operands.size(); ++i) {
+        os << (i == 0 ? " " : ", ") << instruction.operands[i];
+      }
+      if (!instruction.comment.empty()) {
+        os << " ;" << instruction.comment;
+      }
+      break;
+  }
+  return os;
+}
+
+std::string invertConditionCode(const std::string& conditionCode) {
+  static const std::map<std::string, std::string> inverse = {
+      {"z", "nz"}, {"nz", "z"},
+      {"e", "ne"}, {"ne", "e"},
+      {"l", "ge"}, {"ge", "l"},
+      {"le", "g"}, {"g", "le"},
+      {"b", "ae"}, {"ae", "b"},
+      {"be", "a"}, {"a", "be"},
+  };
+  return inverse.at(conditionCode);
+}
+
+static size_t findLabel(const std::vector<Instruction>& code, const std::string& name) {
+  for (size_t i = 0; i < code.size(); ++i) {
+    if (code[i].type == Instruction::Type::LABEL && code[i].mnemonic == name) {
+      return i;
+    }
+  }
+  return code.size();
+}
+
+static bool isLiveFrom(const std::vector<Instruction>& code,
+                       size_t start,
+                       RegisterMask mask,
+                       std::vector<bool>& visited) {
+  for (size_t i = start; i < code.size(); ++i) {
+    const Instruction& instruction = code[i];
+
+    if (instruction.type == Instruction::Type::LABEL) {
+      // Already being followed along another path
+      if (visited[i]) return false;
+      visited[i] = true;
+      continue;
+    }
+    if (!instruction.isInstruction()) continue;
+
+    if (instruction.registersRead() & mask) return true;
+    if (instruction.registersWritten() & mask) return false;
+
+    if (instruction.isConditionalJump() || instruction.isUnconditionalJump()) {
+      size_t target = findLabel(code, instruction.jumpTarget());
+      if (target == code.size()) return true; // Leaves this procedure
+
+      if (instruction.isUnconditionalJump()) {
+        i = target - 1;
+        continue;
+      }
+      if (isLiveFrom(code, target, mask, visited)) return true;
+    } else if (instruction.isBarrier()) {
+      return false;
+    }
+  }
+
+  // Fell off the end of what we can see
+  return true;
+}
+
+bool isRegisterLiveAfter(const std::vector<Instruction>& code, size_t index, Register reg) {
+  std::vector<bool> visited(code.size(), false);
+  const Instruction& instruction = code[index];
+  RegisterMask mask = registerMask(reg);
+
+  if (instruction.isConditionalJump() || instruction.isUnconditionalJump()) {
+    size_t target = findLabel(code, instruction.jumpTarget());
+    if (target == code.size() || isLiveFrom(code, target, mask, visited)) return true;
+    if (instruction.isUnconditionalJump()) return false;
+  } else if (instruction.isBarrier()) {
+    return false;
+  }
+  return isLiveFrom(code, index + 1, mask, visited);
+}
@@ -0,0 +1,153 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_INSTRUCTION_H
+#define COMPILER_VISUALIZATION_INSTRUCTION_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum Register {
+  NONE = 1000,
+
+  RAX = 0,
+  RBX = 1,
+  RCX = 2,
+  RDX = 3,
+  R8 = 4,
+  R9 = 5,
+  R10 = 6,
+  R11 = 7,
+  RSI = 8,
+  RDI = 9,
+  R12 = 10,
+  R13 = 11,
+  R14 = 12,
+  R15 = 13,
+
+  // Never allocated; only used to address the stack
+  RBP = 16,
+  RSP = 17,
+};
+#define TOTAL_REGISTERS 14
+std::ostream& operator<<(std::ostream& os, const Register& reg);
+
+std::string registerToByteEquivalent(Register reg, unsigned int bytes);
+std::string registerTo8BitEquivalent(Register reg);
+std::string registerTo16BitEquivalent(Register reg);
+std::string registerTo32BitEquivalent(Register reg);
+
+// Bit set of registers, indexed by the Register's value
+typedef unsigned int RegisterMask;
+RegisterMask registerMask(Register reg);
+#define ALL_REGISTERS_MASK 0xFFFFFFFFu
+
+struct Label {
+  unsigned int id;
+
+  explicit Label(bool exists = true) {
+    if (exists) {
+      this->id = idCount++;
+    } else {
+      this->id = 0;
+    }
+  }
+
+  bool exists() {
+    return id != 0;
+  }
+
+private:
+  static unsigned int idCount;
+
+};
+std::ostream& operator<<(std::ostream& os, const Label& location);
+
+struct Operand {
+  enum class Type {
+    NONE = 0,
+    REGISTER,
+    IMMEDIATE,
+    MEMORY,
+    SYMBOL,
+  };
+
+  Type type = Type::NONE;
+  Register reg = Register::NONE; // REGISTER, or the base of a MEMORY operand
+  unsigned int bytes = 8; // Width of a REGISTER, or access size of a MEMORY operand (0 = implied)
+  long long value = 0; // IMMEDIATE, or the displacement of a MEMORY operand
+  Register index = Register::NONE; // Scaled index of a MEMORY operand
+  unsigned int scale = 1;
+  std::string symbol; // SYMBOL (labels and constants)
+
+  Operand() = default;
+  Operand(Register reg, unsigned int bytes = 8) // NOLINT(google-explicit-constructor)
+      : type(Type::REGISTER), reg(reg), bytes(bytes) {}
+  Operand(long long immediate) // NOLINT(google-explicit-constructor)
+      : type(Type::IMMEDIATE), value(immediate) {}
+  Operand(const Label& label); // NOLINT(google-explicit-constructor)
+
+  static Operand memory(Register base, long long displacement, unsigned int bytes = 0);
+  static Operand memory(Register base, Register index, unsigned int scale, long long displacement, unsigned int bytes = 0);
+  static Operand symbolic(const std::string& symbol);
+
+  bool isRegister(Register r) const {
+    return type == Type::REGISTER && reg == r;
+  }
+  RegisterMask registersRead() const;
+
+  bool operator==(const Operand& other) const;
+  bool operator!=(const Operand& other) const {
+    return !(*this == other);
+  }
+};
+std::ostream& operator<<(std::ostream& os, const Operand& operand);
+
+struct Instruction {
+  enum class Type {
+    INSTRUCTION = 0,
+    LABEL,
+    DIRECTIVE,
+    COMMENT,
+  };
+
+  Type type = Type::INSTRUCTION;
+  std::string mnemonic; // Also holds the label name, directive text or comment text
+  std::vector<Operand> operands;
+  std::string comment; // Trailing comment
+
+  static Instruction label(const Label& label);
+  static Instruction label(const std::string& name);
+  static Instruction directive(const std::string& text);
+  static Instruction commentLine(const std::string& text);
+
+  bool isInstruction() const {
+    return type == Type::INSTRUCTION;
+  }
+  bool isUnconditionalJump() const;
+  bool isConditionalJump() const;
+  // Control never falls through to the next instruction
+  bool isBarrier() const;
+  std::string jumpTarget() const;
+
+  // Registers whose value the instruction depends on
+  RegisterMask registersRead() const;
+  // Registers the instruction completely overwrites (partial writes don't count)
+  RegisterMask registersWritten() const;
+};
+std::ostream& operator<<(std::ostream& os, const Instruction& instruction);
+
+// A run of output; each internal procedure is emitted into its own buffer
+struct CodeBuffer {
+  std::string procedure; // Empty when not a procedure
+  std::vector<Instruction> instructions;
+};
+
+std::string invertConditionCode(const std::string& conditionCode);
+
+// Conservatively decides whether `reg` may still be read after code[index] executes
+bool isRegisterLiveAfter(const std::vector<Instruction>& code, size_t index, Register reg);
+
+#endif //COMPILER_VISUALIZATION_INSTRUCTION_H
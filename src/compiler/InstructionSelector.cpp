@@ -0,0 +1,275 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <cstdint>
+#include <utility>
+#include "InstructionSelector.h"
+
+typedef InstructionSelector::Nonterminal Nonterminal;
+typedef InstructionSelector::Rule Rule;
+
+static bool isCommutative(ExpressionOperatorType op) {
+  return op == ExpressionOperatorType::ADD || op == ExpressionOperatorType::MULTIPLY
+      || op == ExpressionOperatorType::EQUALS || op == ExpressionOperatorType::NOT_EQUALS;
+}
+
+static bool isComparison(ExpressionOperatorType op) {
+  switch (op) {
+    case ExpressionOperatorType::EQUALS:
+    case ExpressionOperatorType::NOT_EQUALS:
+    case ExpressionOperatorType::LESS_THAN:
+    case ExpressionOperatorType::LESS_THAN_OR_EQUAL:
+    case ExpressionOperatorType::GREATER_THAN:
+    case ExpressionOperatorType::GREATER_THAN_OR_EQUAL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+InstructionSelector::InstructionSelector(Leaves leaves, bool isReducingStrength)
+    : leaves(std::move(leaves)), isReducingStrength(isReducingStrength) {
+}
+
+const InstructionSelector::Choice& InstructionSelector::select(ASTExpression* node, Nonterminal as) {
+  return label(node).choices[(int) as];
+}
+
+bool InstructionSelector::isIntegerLiteral(ASTExpression* node, unsigned long long& value) {
+  if (node->type != ASTType::LITERAL) return false;
+  auto literal = static_cast<ASTLiteral*>(node);
+  if (literal->valueType != ASTLiteral::ValueType::INTEGER) return false;
+
+  value = literal->value.integerData;
+  return true;
+}
+
+// Divisors that aren't a positive 32 bit value keep idiv, so it still faults on zero. The reciprocals only cover
+// 32 bit dividends, so 64 bit ones keep it too.
+bool InstructionSelector::isStrengthReducible(ExpressionOperatorType op, unsigned long long constant, bool isWide) {
+  switch (op) {
+    case ExpressionOperatorType::MULTIPLY:
+      return true;
+    case ExpressionOperatorType::DIVIDE:
+      return !isWide && constant != 0 && constant <= INT32_MAX;
+    default:
+      return false;
+  }
+}
+
+InstructionSelector::Match& InstructionSelector::label(ASTExpression* node) {
+  auto existing = matches.find(node);
+  if (existing != matches.end()) return existing->second;
+
+  Match match;
+  if (leaves.isReused(node)) {
+    consider(match, Nonterminal::REG, {1, Rule::LEAF});
+  } else {
+    switch (node->type) {
+      case ASTType::LITERAL: {
+        consider(match, Nonterminal::REG, {1, Rule::LEAF});
+        unsigned long long value;
+        if (isIntegerLiteral(node, value) && value <= INT32_MAX) {
+          consider(match, Nonterminal::IMM, {0, Rule::IMMEDIATE});
+        }
+        break;
+      }
+      case ASTType::VARIABLE: {
+        auto variable = static_cast<ASTVariableIdent*>(node);
+        consider(match, Nonterminal::REG, {leaves.isInRegister(variable) ? 0u : 1u, Rule::LEAF});
+        if (leaves.isMemoryOperand(variable)) {
+          consider(match, Nonterminal::MEM, {0, Rule::MEMORY});
+        }
+        break;
+      }
+      case ASTType::BIN_OP:
+        labelBinOp(static_cast<ASTBinOp*>(node), match);
+        break;
+      case ASTType::UNARY_OP:
+        labelUnaryOp(static_cast<ASTUnaryOp*>(node), match);
+        break;
+      default:
+        consider(match, Nonterminal::REG, {1, Rule::LEAF});
+        break;
+    }
+  }
+
+  return matches[node] = match;
+}
+
+InstructionSelector::Match InstructionSelector::labelOperand(ASTExpression* node) {
+  Match match = label(node);
+
+  // Its own value is needed, so its parent can't fold it into an address or operand
+  if (leaves.isKept(node)) {
+    Choice reg = match.choices[(int) Nonterminal::REG];
+    match = Match();
+    match.choices[(int) Nonterminal::REG] = reg;
+  }
+  return match;
+}
+
+void InstructionSelector::labelBinOp(ASTBinOp* node, Match& match) {
+  Match leftMatch = labelOperand(node->left);
+  Match rightMatch = labelOperand(node->right);
+  const Choice* left = leftMatch.choices;
+  const Choice* right = rightMatch.choices;
+  auto cost = [](const Choice* choices, Nonterminal as) {
+    return choices[(int) as].cost;
+  };
+  auto has = [](const Choice* choices, Nonterminal as) {
+    return choices[(int) as].rule != Rule::NONE;
+  };
+
+  ExpressionOperatorType op = node->op;
+  if (op == ExpressionOperatorType::LOGICAL_AND || op == ExpressionOperatorType::LOGICAL_OR) {
+    unsigned int branches = cost(left, Nonterminal::REG) + cost(right, Nonterminal::REG) + operationCost(op);
+    consider(match, Nonterminal::REG, {branches, Rule::OP_REG, node->left, Nonterminal::REG, node->right});
+    return;
+  }
+
+  unsigned int opCost = operationCost(op);
+  unsigned int general = cost(left, Nonterminal::REG) + cost(right, Nonterminal::REG) + opCost + copyCost(node->left);
+  consider(match, Nonterminal::REG, {general, Rule::OP_REG, node->left, Nonterminal::REG, node->right});
+
+  // Each operand order is tried for the commutative operators; `a` is the operand kept in a register
+  for (int swapped = 0; swapped < 2; ++swapped) {
+    if (swapped && !isCommutative(op)) break;
+    ASTExpression* a = swapped ? node->right : node->left;
+    ASTExpression* b = swapped ? node->left : node->right;
+    const Choice* aChoices = swapped ? right : left;
+    const Choice* bChoices = swapped ? left : right;
+    unsigned int aCost = cost(aChoices, Nonterminal::REG);
+
+    unsigned long long constant = 0;
+    bool isLiteral = isIntegerLiteral(b, constant);
+
+    if (has(bChoices, Nonterminal::IMM) && (op == ExpressionOperatorType::ADD || op == ExpressionOperatorType::MINUS
+        || isComparison(op))) {
+      Rule rule = Rule::OP_IMM;
+      if (constant == 1 && op == ExpressionOperatorType::ADD) {
+        rule = Rule::INC;
+      } else if (constant == 1 && op == ExpressionOperatorType::MINUS) {
+        rule = Rule::DEC;
+      }
+      consider(match, Nonterminal::REG, {aCost + opCost + copyCost(a), rule, a, Nonterminal::REG, b,
+                                         Nonterminal::IMM});
+    }
+
+    if (has(bChoices, Nonterminal::MEM) && op != ExpressionOperatorType::DIVIDE) {
+      consider(match, Nonterminal::REG, {aCost + opCost + copyCost(a), Rule::OP_MEM, a, Nonterminal::REG, b,
+                                         Nonterminal::MEM});
+    }
+
+    if (isLiteral && isStrengthReducible(op, constant, leaves.isWide(node))) {
+      bool isMultiply = op == ExpressionOperatorType::MULTIPLY;
+      if (isReducingStrength) {
+        unsigned int sequenceCost = isMultiply ? multiplyCost(constant) : divideCost(constant);
+        consider(match, Nonterminal::REG, {aCost + sequenceCost + copyCost(a), isMultiply ? Rule::MUL_CONST
+                                                                                          : Rule::DIV_CONST,
+                                           a, Nonterminal::REG, b, Nonterminal::IMM});
+      }
+
+      if (isMultiply && (constant == 2 || constant == 4 || constant == 8)) {
+        consider(match, Nonterminal::INDEX, {aCost, Rule::SCALE, a, Nonterminal::REG, b, Nonterminal::IMM});
+      }
+    }
+
+    if (op == ExpressionOperatorType::ADD) {
+      consider(match, Nonterminal::BASE_INDEX, {aCost + cost(bChoices, Nonterminal::REG), Rule::BASE_PLUS_INDEX,
+                                                a, Nonterminal::REG, b, Nonterminal::REG});
+      if (has(bChoices, Nonterminal::INDEX)) {
+        consider(match, Nonterminal::BASE_INDEX, {aCost + cost(bChoices, Nonterminal::INDEX),
+                                                  Rule::BASE_PLUS_INDEX, a, Nonterminal::REG, b, Nonterminal::INDEX});
+      }
+    }
+
+    if ((op == ExpressionOperatorType::ADD || op == ExpressionOperatorType::MINUS)
+        && has(bChoices, Nonterminal::IMM)) {
+      Rule rule = op == ExpressionOperatorType::ADD ? Rule::PLUS_DISPLACEMENT : Rule::MINUS_DISPLACEMENT;
+      consider(match, Nonterminal::ADDRESS, {aCost, rule, a, Nonterminal::REG, b, Nonterminal::IMM});
+      if (has(aChoices, Nonterminal::BASE_INDEX)) {
+        consider(match, Nonterminal::ADDRESS, {cost(aChoices, Nonterminal::BASE_INDEX), rule,
+                                               a, Nonterminal::BASE_INDEX, b, Nonterminal::IMM});
+      }
+    }
+  }
+
+  // Only taken when it saves something, such as the copy of a variable an add would otherwise need
+  for (Nonterminal address : {Nonterminal::BASE_INDEX, Nonterminal::ADDRESS}) {
+    const Choice& choice = match.choices[(int) address];
+    if (choice.rule != Rule::NONE) {
+      consider(match, Nonterminal::REG, {choice.cost + 1, Rule::LEA, node, address});
+    }
+  }
+}
+
+void InstructionSelector::labelUnaryOp(ASTUnaryOp* node, Match& match) {
+  unsigned int childCost = labelOperand(node->child).choices[(int) Nonterminal::REG].cost;
+
+  switch (node->op) {
+    case ExpressionOperatorType::ADD:
+      consider(match, Nonterminal::REG, {childCost, Rule::OP_REG, node->child});
+      break;
+    case ExpressionOperatorType::MINUS:
+      consider(match, Nonterminal::REG, {childCost + 1 + copyCost(node->child), Rule::NEG, node->child});
+      break;
+    default:
+      consider(match, Nonterminal::REG, {childCost + operationCost(node->op) + copyCost(node->child), Rule::OP_REG,
+                                         node->child});
+      break;
+  }
+}
+
+void InstructionSelector::consider(Match& match, Nonterminal as, const Choice& choice) {
+  Choice& best = match.choices[(int) as];
+  if (best.rule == Rule::NONE || choice.cost < best.cost) {
+    best = choice;
+  }
+}
+
+// Rough cycles, with a comparison's setcc and movzx counted
+unsigned int InstructionSelector::operationCost(ExpressionOperatorType op) {
+  switch (op) {
+    case ExpressionOperatorType::ADD:
+    case ExpressionOperatorType::MINUS:
+      return 1;
+    case ExpressionOperatorType::MULTIPLY:
+      return 3;
+    case ExpressionOperatorType::DIVIDE:
+      return 25;
+    case ExpressionOperatorType::LOGICAL_AND:
+    case ExpressionOperatorType::LOGICAL_OR:
+      return 4;
+    default:
+      return 3;
+  }
+}
+
+// Mirrors Generator::emitMultiplyByConstant
+unsigned int InstructionSelector::multiplyCost(unsigned long long constant) {
+  if (constant == 0) return 1;
+
+  unsigned int shift = 0;
+  unsigned long long odd = constant;
+  while (!(odd & 1)) {
+    odd >>= 1;
+    shift++;
+  }
+
+  if (odd == 1) return shift ? 1 : 0;
+  if (odd == 3 || odd == 5 || odd == 9) return shift ? 2 : 1;
+  return constant <= INT32_MAX ? 3 : 4;
+}
+
+// Mirrors Generator::emitDivideByConstant
+unsigned int InstructionSelector::divideCost(unsigned long long constant) {
+  if (constant == 1) return 1;
+  if (!(constant & (constant - 1))) return 5;
+  return 9;
+}
+
+unsigned int InstructionSelector::copyCost(ASTExpression* node) {
+  return node->type == ASTType::VARIABLE ? 1 : 0;
+}
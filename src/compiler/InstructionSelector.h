@@ -0,0 +1,104 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_INSTRUCTIONSELECTOR_H
+#define COMPILER_VISUALIZATION_INSTRUCTIONSELECTOR_H
+
+#include <functional>
+#include <map>
+#include "AST.h"
+
+// Bottom up tree pattern matching over expression trees. Every node is labelled with the cheapest way of producing
+// it as each kind of operand (nonterminal), and the generator then walks the tree following the rules chosen for
+// the operand kind its parent needs. Literals can be immediates, 8 byte frame variables memory operands, and sums
+// of registers, scaled registers and literals a single lea.
+class InstructionSelector {
+public:
+  enum class Nonterminal {
+    REG = 0, // Value in a register
+    IMM, // Literal that fits a sign extended 32 bit immediate
+    MEM, // Variable read straight from its frame slot
+    INDEX, // reg * 2, 4 or 8
+    BASE_INDEX, // reg + reg, or reg + INDEX
+    ADDRESS, // reg or BASE_INDEX, plus or minus an IMM
+    COUNT,
+  };
+
+  enum class Rule {
+    NONE = 0,
+    LEAF, // Literals, variables and reused expressions, produced by walking them as usual
+    IMMEDIATE,
+    MEMORY,
+    OP_REG, // reg op reg, the general case
+    OP_IMM, // reg op imm
+    OP_MEM, // reg op [mem]
+    INC, // reg + 1
+    DEC, // reg - 1
+    NEG, // -reg
+    MUL_CONST, // reg * literal as shifts, lea or imul with an immediate
+    DIV_CONST, // reg / literal as shifts or a multiply by its reciprocal
+    SCALE, // INDEX <- reg * 2, 4 or 8
+    BASE_PLUS_INDEX, // BASE_INDEX <- reg + reg, reg + INDEX
+    PLUS_DISPLACEMENT, // ADDRESS <- (reg or BASE_INDEX) + imm
+    MINUS_DISPLACEMENT, // ADDRESS <- (reg or BASE_INDEX) - imm
+    LEA, // REG <- BASE_INDEX or ADDRESS
+  };
+
+  // How one nonterminal of a node is produced: from `first` and `second` (the node's operands, swapped for
+  // commutative rules), themselves produced as the nonterminals given
+  struct Choice {
+    unsigned int cost = 0;
+    Rule rule = Rule::NONE;
+    ASTExpression* first = nullptr;
+    Nonterminal firstAs = Nonterminal::REG;
+    ASTExpression* second = nullptr;
+    Nonterminal secondAs = Nonterminal::REG;
+  };
+
+  // What the generator knows about the leaves of a tree before walking it
+  struct Leaves {
+    std::function<bool(ASTVariableIdent*)> isInRegister; // Read without a load
+    std::function<bool(ASTVariableIdent*)> isMemoryOperand; // 8 byte frame slot usable as an operand as is
+    std::function<bool(ASTExpression*)> isReused; // Reloaded from its value numbering slot rather than computed
+    std::function<bool(ASTExpression*)> isKept; // Stored for reuse, so its value has to be computed by itself
+    std::function<bool(ASTExpression*)> isWide; // Has a 64 bit operand
+  };
+
+private:
+  struct Match {
+    Choice choices[(int) Nonterminal::COUNT];
+  };
+
+  Leaves leaves;
+  bool isReducingStrength; // Multiplies and divides by literals may become shifts, lea or a reciprocal multiply
+  std::map<ASTExpression*, Match> matches;
+
+public:
+  InstructionSelector(Leaves leaves, bool isReducingStrength);
+
+  // Cheapest way of producing `node` as `as`; labels the tree first if it hasn't been already. The rule is NONE
+  // when the node can't be produced that way.
+  const Choice& select(ASTExpression* node, Nonterminal as = Nonterminal::REG);
+
+  static bool isIntegerLiteral(ASTExpression* node, unsigned long long& value);
+  static bool isStrengthReducible(ExpressionOperatorType op, unsigned long long constant, bool isWide);
+
+private:
+  Match& label(ASTExpression* node);
+  // The node's labels as seen by its parent
+  Match labelOperand(ASTExpression* node);
+  void labelBinOp(ASTBinOp* node, Match& match);
+  void labelUnaryOp(ASTUnaryOp* node, Match& match);
+
+  // Keeps the choice if it is cheaper than what `match` already has for `as`
+  static void consider(Match& match, Nonterminal as, const Choice& choice);
+
+  static unsigned int operationCost(ExpressionOperatorType op);
+  static unsigned int multiplyCost(unsigned long long constant);
+  static unsigned int divideCost(unsigned long long constant);
+  // Working in place needs a copy first unless the operand is a temporary nothing else reads
+  static unsigned int copyCost(ASTExpression* node);
+};
+
+#endif //COMPILER_VISUALIZATION_INSTRUCTIONSELECTOR_H
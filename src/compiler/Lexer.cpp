@@ -439,6 +439,14 @@ Token Lexer::readNumber(const LexerContext& lexerContext) {
 Token Lexer::identifyKeyword(const LexerContext& lexerContext, const std::string& keyword) {
   if (keyword == "int") {
     return {lexerContext, Token::Type::TOKEN_KEYWORD_INT};
+  } else if (keyword == "i8") {
+    return {lexerContext, Token::Type::TOKEN_KEYWORD_I8};
+  } else if (keyword == "i16") {
+    return {lexerContext, Token::Type::TOKEN_KEYWORD_I16};
+  } else if (keyword == "i32") {
+    return {lexerContext, Token::Type::TOKEN_KEYWORD_I32};
+  } else if (keyword == "i64") {
+    return {lexerContext, Token::Type::TOKEN_KEYWORD_I64};
   } else if (keyword == "void") {
     return {lexerContext, Token::Type::TOKEN_KEYWORD_VOID};
   } else if (keyword == "return") {
@@ -500,12 +508,12 @@ Token Lexer::readOperator(const LexerContext& lexerContext) {
     } else {
       return {lexerContext, Token::Type::TOKEN_LOGICAL_NOT}; // '!'
     }
-//  } else if (firstChar == '&' && currentChar == '&') {
-//    advanceCursor();
-//    return {lexerContext, Token::Type::TOKEN_LOGICAL_AND}; // '&&'
-//  } else if (firstChar == '|' && currentChar == '|') {
-//    advanceCursor();
-//    return {lexerContext, Token::Type::TOKEN_LOGICAL_OR}; // '||'
+  } else if (firstChar == '&' && currentChar == '&') {
+    advanceCursor();
+    return {lexerContext, Token::Type::TOKEN_LOGICAL_AND}; // '&&'
+  } else if (firstChar == '|' && currentChar == '|') {
+    advanceCursor();
+    return {lexerContext, Token::Type::TOKEN_LOGICAL_OR}; // '||'
   } else if (firstChar == '<') {
     if (currentChar == '=') {
       advanceCursor();
@@ -77,6 +77,10 @@ struct Token {
     TOKEN_KEYWORD_WHILE = 34,
     TOKEN_KEYWORD_FOR = 35,
     TOKEN_KEYWORD_EXTERN = 37,
+    TOKEN_KEYWORD_I8 = 38,
+    TOKEN_KEYWORD_I16 = 39,
+    TOKEN_KEYWORD_I32 = 40,
+    TOKEN_KEYWORD_I64 = 41,
   };
 
   enum class ValueType {
@@ -478,6 +478,10 @@ ASTStatement* Parser::parseStatement() {
       return parseProcedureDeclaration(true);
     case Token::Type::TOKEN_KEYWORD_VOID:
     case Token::Type::TOKEN_KEYWORD_INT:
+    case Token::Type::TOKEN_KEYWORD_I8:
+    case Token::Type::TOKEN_KEYWORD_I16:
+    case Token::Type::TOKEN_KEYWORD_I32:
+    case Token::Type::TOKEN_KEYWORD_I64:
       return parseVariableDeclaration();
     case Token::Type::TOKEN_IDENTIFIER:
       if (peekToken()->type == Token::Type::TOKEN_PARENTHESIS_OPEN) {
@@ -1036,8 +1040,14 @@ ASTExpression* Parser::parseFactor() {
 DataType Parser::parseTypeSpecifier() {
   if (accept(Token::Type::TOKEN_KEYWORD_VOID)) {
     return DataType::VOID;
-  } else if (accept(Token::Type::TOKEN_KEYWORD_INT)) {
-    return DataType::INT;
+  } else if (accept(Token::Type::TOKEN_KEYWORD_INT) || accept(Token::Type::TOKEN_KEYWORD_I32)) {
+    return DataType::I32;
+  } else if (accept(Token::Type::TOKEN_KEYWORD_I8)) {
+    return DataType::I8;
+  } else if (accept(Token::Type::TOKEN_KEYWORD_I16)) {
+    return DataType::I16;
+  } else if (accept(Token::Type::TOKEN_KEYWORD_I64)) {
+    return DataType::I64;
   }
 
   auto token = currentToken();
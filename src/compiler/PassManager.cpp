@@ -0,0 +1,181 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <chrono>
+#include <iomanip>
+#include <sys/resource.h>
+#include "PassManager.h"
+
+static const std::string passNames[TOTAL_PASSES] = {
+    "tail-calls",
+    "inline",
+    "unroll",
+    "branch-fold",
+    "dead-procedures",
+    "value-numbering",
+    "hoist",
+    "promote-locals",
+    "strength-reduce",
+    "if-convert",
+    "rotate-loops",
+    "align-loops",
+    "live-call-saves",
+    "red-zone",
+    "layout",
+    "peephole",
+    "redundancy-elimination",
+    "dead-store-elimination",
+};
+
+static long long peakResidentKilobytes() {
+  struct rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024; // Bytes there, kilobytes on Linux
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+PassManager::PassManager(const PassSet& enabled, bool isTiming)
+    : enabled(enabled), isTiming(isTiming), statistics(TOTAL_PASSES) {
+}
+
+bool PassManager::isEnabled(Pass pass) const {
+  if (pass == Pass::HOIST && !enabled[(size_t) Pass::VALUE_NUMBERING]) return false;
+  return enabled[(size_t) pass];
+}
+
+bool PassManager::run(Pass pass, const std::function<void()>& body, const std::function<long long()>& size) {
+  if (!isEnabled(pass)) return false;
+  if (!isTiming) {
+    body();
+    return true;
+  }
+
+  long long sizeBefore = size ? size() : 0;
+  long long peakBefore = peakResidentKilobytes();
+  auto start = std::chrono::steady_clock::now();
+  body();
+  auto end = std::chrono::steady_clock::now();
+  long long peakAfter = peakResidentKilobytes();
+  long long sizeAfter = size ? size() : 0;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  Statistics& passStatistics = statistics[(size_t) pass];
+  passStatistics.runs++;
+  passStatistics.milliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+  passStatistics.removed += sizeBefore - sizeAfter;
+  passStatistics.kilobytes += peakAfter - peakBefore;
+  return true;
+}
+
+void PassManager::printStatistics(std::ostream& os) {
+  std::lock_guard<std::mutex> lock(mutex);
+  double total = 0;
+  os << "Pass statistics:" << std::endl;
+  for (size_t pass = 0; pass < TOTAL_PASSES; ++pass) {
+    const Statistics& passStatistics = statistics[pass];
+    if (passStatistics.runs == 0) continue;
+
+    os << "- " << passNames[pass] << ": " << passStatistics.runs << " runs, " << std::fixed << std::setprecision(3)
+       << passStatistics.milliseconds << " ms, ";
+    if (pass < (size_t) Pass::VALUE_NUMBERING) {
+      os << passStatistics.removed << " nodes removed, ";
+    } else if (pass > (size_t) Pass::LAYOUT) {
+      os << passStatistics.removed << " instructions removed, ";
+    }
+    os << passStatistics.kilobytes << " KiB" << std::defaultfloat << std::endl;
+    total += passStatistics.milliseconds;
+  }
+  os << "- total: " << std::fixed << std::setprecision(3) << total << " ms" << std::defaultfloat << std::endl;
+}
+
+bool PassManager::preset(const std::string& level, PassSet& passes) {
+  passes.reset();
+  if (level == "0") return true;
+
+  if (level == "1") {
+    for (Pass pass : {Pass::TAIL_CALLS, Pass::BRANCH_FOLD, Pass::DEAD_PROCEDURES, Pass::VALUE_NUMBERING,
+                      Pass::PROMOTE_LOCALS, Pass::STRENGTH_REDUCE, Pass::LIVE_CALL_SAVES, Pass::RED_ZONE,
+                      Pass::PEEPHOLE, Pass::REDUNDANCY_ELIMINATION}) {
+      passes.set((size_t) pass);
+    }
+    return true;
+  }
+
+  passes.set();
+  if (level == "2") return true;
+  if (level == "s") {
+    // Copies of bodies and conditions, and padding before loops, trade size for speed
+    passes.reset((size_t) Pass::INLINE);
+    passes.reset((size_t) Pass::UNROLL);
+    passes.reset((size_t) Pass::ROTATE_LOOPS);
+    passes.reset((size_t) Pass::ALIGN_LOOPS);
+    return true;
+  }
+  return false;
+}
+
+const std::string& PassManager::nameOf(Pass pass) {
+  return passNames[(size_t) pass];
+}
+
+bool PassManager::findPass(const std::string& name, Pass& pass) {
+  for (size_t i = 0; i < TOTAL_PASSES; ++i) {
+    if (passNames[i] == name) {
+      pass = (Pass) i;
+      return true;
+    }
+  }
+  return false;
+}
+
+long long PassManager::sizeOf(ASTStatement* node) {
+  if (!node) return 0;
+  switch (node->type) {
+    case BLOCK: {
+      long long size = 1;
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        size += sizeOf(statement);
+      }
+      return size;
+    }
+    case PROC_DECL:
+      return 1 + sizeOf(static_cast<ASTProcedure*>(node)->block);
+    case PROC_CALL: {
+      long long size = 1;
+      for (auto parameter : static_cast<ASTProcedureCall*>(node)->parameters) {
+        size += sizeOf(parameter);
+      }
+      return size;
+    }
+    case VARIABLE_DECL:
+      return 1 + sizeOf(static_cast<ASTVariableDeclaration*>(node)->initialValueExpression);
+    case VARIABLE_ASSIGNMENT:
+      return 1 + sizeOf(static_cast<ASTVariableAssignment*>(node)->newValueExpression);
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      return 1 + sizeOf(ifNode->conditional) + sizeOf(ifNode->trueStatement) + sizeOf(ifNode->falseStatement);
+    }
+    case WHILE: {
+      auto* whileNode = static_cast<ASTWhile*>(node);
+      return 1 + sizeOf(whileNode->conditional) + sizeOf(whileNode->body);
+    }
+    default:
+      return 1;
+  }
+}
+
+long long PassManager::sizeOf(ASTExpression* node) {
+  if (!node) return 0;
+  switch (node->type) {
+    case ASTType::BIN_OP:
+      return 1 + sizeOf(static_cast<ASTBinOp*>(node)->left) + sizeOf(static_cast<ASTBinOp*>(node)->right);
+    case ASTType::UNARY_OP:
+      return 1 + sizeOf(static_cast<ASTUnaryOp*>(node)->child);
+    default:
+      return 1;
+  }
+}
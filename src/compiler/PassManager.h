@@ -0,0 +1,85 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_PASSMANAGER_H
+#define COMPILER_VISUALIZATION_PASSMANAGER_H
+
+#include <bitset>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "AST.h"
+
+// Every optional transformation, in the order they run
+enum class Pass {
+  // Over the whole program's AST, before any code is generated
+  TAIL_CALLS,
+  INLINE,
+  UNROLL,
+  BRANCH_FOLD,
+  DEAD_PROCEDURES,
+  // Made while generating each procedure's code, so not timed on their own
+  VALUE_NUMBERING,
+  HOIST, // Only with VALUE_NUMBERING, which finds the invariants
+  PROMOTE_LOCALS,
+  STRENGTH_REDUCE,
+  IF_CONVERT,
+  ROTATE_LOOPS,
+  ALIGN_LOOPS,
+  LIVE_CALL_SAVES,
+  RED_ZONE,
+  // Orders the procedures' code once it is all generated
+  LAYOUT,
+  // Over each procedure's instructions on its own, repeated until none of them changes anything
+  PEEPHOLE,
+  REDUNDANCY_ELIMINATION,
+  DEAD_STORE_ELIMINATION,
+};
+constexpr size_t TOTAL_PASSES = (size_t) Pass::DEAD_STORE_ELIMINATION + 1;
+
+typedef std::bitset<TOTAL_PASSES> PassSet;
+
+// Decides which passes run and, with --time-passes, what each one cost. Passes over separate procedures may run
+// at the same time, so run() can be called from several threads.
+class PassManager {
+public:
+  struct Statistics {
+    unsigned int runs = 0;
+    double milliseconds = 0; // Wall time, added up over every run, so more than elapsed when run in parallel
+    long long removed = 0; // AST nodes or instructions; negative when the pass adds them
+    long long kilobytes = 0; // Growth of the peak resident set while it ran
+  };
+
+private:
+  PassSet enabled;
+  bool isTiming;
+
+  std::mutex mutex;
+  std::vector<Statistics> statistics;
+
+public:
+  PassManager(const PassSet& enabled, bool isTiming);
+
+  bool isEnabled(Pass pass) const;
+
+  // Runs `body` if `pass` is enabled, returning whether it did. `size` measures what the pass works on, before and
+  // after, for the statistics; it may be null when the pass changes nothing's size
+  bool run(Pass pass, const std::function<void()>& body, const std::function<long long()>& size = nullptr);
+
+  // One line per pass that ran, plus their total
+  void printStatistics(std::ostream& os);
+
+  // The passes run at -O<level>: "0" none, "1" the cheap ones, "2" all, "s" all but those that grow the code
+  static bool preset(const std::string& level, PassSet& passes);
+  static const std::string& nameOf(Pass pass);
+  static bool findPass(const std::string& name, Pass& pass);
+
+  // Statements and expressions under `node`, including procedure bodies
+  static long long sizeOf(ASTStatement* node);
+  static long long sizeOf(ASTExpression* node);
+};
+
+#endif //COMPILER_VISUALIZATION_PASSMANAGER_H
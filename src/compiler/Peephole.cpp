@@ -0,0 +1,314 @@
+//
+// Created on 2026/10/19.
+//
+
+#include "Peephole.h"
+
+const std::vector<Peephole::Rule> Peephole::rules = {
+    {"self-move", removeSelfMove},
+    {"overwritten-move", removeOverwrittenMove},
+    {"setcc-branch", branchOnFlags},
+    {"zero-before-cdq", removeZeroBeforeSignExtend},
+    {"push-pop-pair", removePushPopPair},
+    {"call-save-pair", removeCallSavePair},
+    {"jump-thread", threadJump},
+    {"branch-over-jump", invertBranchOverJump},
+    {"jump-to-next", removeJumpToNext},
+    {"unreachable", removeUnreachable},
+};
+
+static const RegisterMask calleeSavedMask = (1u << RBX) | (1u << R12) | (1u << R13) | (1u << R14) | (1u << R15);
+
+Peephole::Peephole(const std::set<std::string>& abiCompliantProcedures)
+    : abiCompliantProcedures(abiCompliantProcedures) {
+}
+
+unsigned int Peephole::run(std::vector<Instruction>& code) {
+  unsigned int totalRewrites = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < code.size(); ++i) {
+      if (!code[i].isInstruction()) continue;
+
+      for (auto& rule : rules) {
+        if (rule.apply(*this, code, i)) {
+          hits[rule.name]++;
+          totalRewrites++;
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  return totalRewrites;
+}
+
+// Windows skip over comments, but never extend past a label as it may be jumped to
+size_t Peephole::nextInstruction(const std::vector<Instruction>& code, size_t position) {
+  for (size_t i = position + 1; i < code.size(); ++i) {
+    if (code[i].type == Instruction::Type::COMMENT) continue;
+    if (code[i].isInstruction()) return i;
+    break;
+  }
+  return code.size();
+}
+
+size_t Peephole::previousInstruction(const std::vector<Instruction>& code, size_t position) {
+  for (size_t i = position; i-- > 0;) {
+    if (code[i].type == Instruction::Type::COMMENT) continue;
+    if (code[i].isInstruction()) return i;
+    break;
+  }
+  return code.size();
+}
+
+size_t Peephole::findLabel(const std::vector<Instruction>& code, const std::string& name) {
+  for (size_t i = 0; i < code.size(); ++i) {
+    if (code[i].type == Instruction::Type::LABEL && code[i].mnemonic == name) {
+      return i;
+    }
+  }
+  return code.size();
+}
+
+bool Peephole::isReferenced(const std::vector<Instruction>& code, const std::string& label) {
+  for (const auto& instruction : code) {
+    for (const auto& operand : instruction.operands) {
+      if (operand.type == Operand::Type::SYMBOL && operand.symbol == label) return true;
+    }
+  }
+  return false;
+}
+
+// mov rX, rX
+bool Peephole::removeSelfMove(Peephole&, std::vector<Instruction>& code, size_t position) {
+  const Instruction& mov = code[position];
+  if (mov.mnemonic != "mov" || mov.operands.size() != 2) return false;
+
+  const Operand& dest = mov.operands[0];
+  const Operand& src = mov.operands[1];
+  // A 32 bit move zero extends, so it isn't a no-op
+  if (dest.type != Operand::Type::REGISTER || dest != src || dest.bytes == 4) return false;
+
+  code.erase(code.begin() + position);
+  return true;
+}
+
+// mov rX, a; mov rX, b => mov rX, b
+bool Peephole::removeOverwrittenMove(Peephole&, std::vector<Instruction>& code, size_t position) {
+  const Instruction& first = code[position];
+  if (first.mnemonic != "mov" || first.operands.size() != 2) return false;
+  if (first.operands[0].type != Operand::Type::REGISTER) return false;
+
+  size_t nextPosition = nextInstruction(code, position);
+  if (nextPosition == code.size()) return false;
+  const Instruction& second = code[nextPosition];
+  if (second.mnemonic != "mov" || second.operands.size() != 2) return false;
+
+  RegisterMask dest = registerMask(first.operands[0].reg);
+  if (!(second.registersWritten() & dest)) return false;
+  if (second.registersRead() & dest) return false;
+
+  code.erase(code.begin() + position);
+  return true;
+}
+
+// setcc r8; movzx r, r8; [mov r2, r;] test r2, r2; jz/jnz label => jcc label
+bool Peephole::branchOnFlags(Peephole&, std::vector<Instruction>& code, size_t position) {
+  const Instruction& set = code[position];
+  if (set.mnemonic.compare(0, 3, "set") != 0 || set.operands.size() != 1) return false;
+  Register reg = set.operands[0].reg;
+  std::string conditionCode = set.mnemonic.substr(3);
+
+  size_t movzxPosition = nextInstruction(code, position);
+  if (movzxPosition == code.size()) return false;
+  const Instruction& movzx = code[movzxPosition];
+  if (movzx.mnemonic != "movzx" || !movzx.operands[0].isRegister(reg) || !movzx.operands[1].isRegister(reg)) {
+    return false;
+  }
+
+  size_t testPosition = nextInstruction(code, movzxPosition);
+  if (testPosition == code.size()) return false;
+  Register testedReg = reg;
+  size_t copyPosition = 0;
+  bool hasCopy = code[testPosition].mnemonic == "mov"
+      && code[testPosition].operands[0].type == Operand::Type::REGISTER
+      && code[testPosition].operands[1] == Operand(reg);
+  if (hasCopy) {
+    copyPosition = testPosition;
+    testedReg = code[copyPosition].operands[0].reg;
+    testPosition = nextInstruction(code, copyPosition);
+    if (testPosition == code.size()) return false;
+  }
+  const Instruction& test = code[testPosition];
+  if (test.mnemonic != "test" || !test.operands[0].isRegister(testedReg) || test.operands[1] != test.operands[0]) {
+    return false;
+  }
+
+  size_t jumpPosition = nextInstruction(code, testPosition);
+  if (jumpPosition == code.size()) return false;
+  const Instruction& jump = code[jumpPosition];
+  bool jumpIfFalse = jump.mnemonic == "jz" || jump.mnemonic == "je";
+  bool jumpIfTrue = jump.mnemonic == "jnz" || jump.mnemonic == "jne";
+  if (!jumpIfFalse && !jumpIfTrue) return false;
+
+  // Neither the setcc, movzx nor mov touch the flags, so the branch can use the cmp's directly
+  code[jumpPosition].mnemonic = "j" + (jumpIfTrue ? conditionCode : invertConditionCode(conditionCode));
+  code.erase(code.begin() + testPosition);
+  jumpPosition--;
+
+  // The 0/1 value itself can only go if nothing needs it after the branch
+  if (isRegisterLiveAfter(code, jumpPosition, reg) || isRegisterLiveAfter(code, jumpPosition, testedReg)) {
+    return true;
+  }
+  if (hasCopy) {
+    code.erase(code.begin() + copyPosition);
+  }
+  code.erase(code.begin() + movzxPosition);
+  code.erase(code.begin() + position);
+  return true;
+}
+
+// xor rdx, rdx; cdq => cdq
+bool Peephole::removeZeroBeforeSignExtend(Peephole&, std::vector<Instruction>& code, size_t position) {
+  const Instruction& zero = code[position];
+  if (zero.mnemonic != "xor" || zero.operands.size() != 2 || zero.operands[0] != zero.operands[1]) return false;
+  if (!zero.operands[0].isRegister(RDX) && zero.operands[0] != Operand(RDX, 4)) return false;
+
+  size_t nextPosition = nextInstruction(code, position);
+  if (nextPosition == code.size()) return false;
+  if (code[nextPosition].mnemonic != "cdq" && code[nextPosition].mnemonic != "cqo") return false;
+
+  code.erase(code.begin() + position);
+  return true;
+}
+
+// push rX; pop rX
+bool Peephole::removePushPopPair(Peephole&, std::vector<Instruction>& code, size_t position) {
+  const Instruction& push = code[position];
+  if (push.mnemonic != "push") return false;
+
+  size_t popPosition = nextInstruction(code, position);
+  if (popPosition == code.size()) return false;
+  const Instruction& pop = code[popPosition];
+  if (pop.mnemonic != "pop" || pop.operands[0] != push.operands[0]) return false;
+
+  code.erase(code.begin() + popPosition);
+  code.erase(code.begin() + position);
+  return true;
+}
+
+// push rX; call proc; pop rX, where the callee preserves rX or rX is not used again
+bool Peephole::removeCallSavePair(Peephole& peephole, std::vector<Instruction>& code, size_t position) {
+  const Instruction& call = code[position];
+  if (call.mnemonic != "call" || call.operands.empty()) return false;
+  bool preservesCalleeSaved = peephole.abiCompliantProcedures.count(call.operands[0].symbol) > 0;
+
+  // Pair the pushes before the call with the pops after it, innermost first
+  size_t pushPosition = previousInstruction(code, position);
+  size_t popPosition = nextInstruction(code, position);
+  while (pushPosition != code.size() && popPosition != code.size()
+      && code[pushPosition].mnemonic == "push" && code[popPosition].mnemonic == "pop"
+      && code[pushPosition].operands[0] == code[popPosition].operands[0]) {
+    const Operand& saved = code[pushPosition].operands[0];
+
+    bool isPreserved = preservesCalleeSaved
+        && saved.type == Operand::Type::REGISTER
+        && (registerMask(saved.reg) & calleeSavedMask);
+    bool isDead = saved.type == Operand::Type::REGISTER
+        && !isRegisterLiveAfter(code, popPosition, saved.reg);
+    if (isPreserved || isDead) {
+      code.erase(code.begin() + popPosition);
+      code.erase(code.begin() + pushPosition);
+      return true;
+    }
+
+    pushPosition = previousInstruction(code, pushPosition);
+    popPosition = nextInstruction(code, popPosition);
+  }
+
+  return false;
+}
+
+// jmp/jcc L1; ... L1: jmp L2 => jmp/jcc L2
+bool Peephole::threadJump(Peephole&, std::vector<Instruction>& code, size_t position) {
+  std::string target = code[position].jumpTarget();
+  if (target.empty()) return false;
+  size_t labelPosition = findLabel(code, target);
+  if (labelPosition == code.size()) return false; // Another procedure
+
+  // The first instruction run from the label, past any other labels and alignment
+  size_t next = labelPosition;
+  while (next < code.size() && !code[next].isInstruction()) ++next;
+  if (next == code.size() || !code[next].isUnconditionalJump()) return false;
+
+  // A jump to itself is a loop with no way out, and threading it would never stop
+  std::string finalTarget = code[next].jumpTarget();
+  if (finalTarget.empty() || finalTarget == target) return false;
+
+  code[position].operands[0] = code[next].operands[0];
+  return true;
+}
+
+// jcc L1; jmp L2; L1: => j!cc L2; L1:
+bool Peephole::invertBranchOverJump(Peephole&, std::vector<Instruction>& code, size_t position) {
+  const Instruction& branch = code[position];
+  if (!branch.isConditionalJump() || branch.jumpTarget().empty()) return false;
+
+  size_t jumpPosition = nextInstruction(code, position);
+  if (jumpPosition == code.size() || !code[jumpPosition].isUnconditionalJump()) return false;
+
+  bool isOverJump = false;
+  for (size_t i = jumpPosition + 1; i < code.size() && !code[i].isInstruction(); ++i) {
+    if (code[i].type == Instruction::Type::LABEL && code[i].mnemonic == branch.jumpTarget()) {
+      isOverJump = true;
+      break;
+    }
+  }
+  if (!isOverJump) return false;
+
+  code[position].mnemonic = "j" + invertConditionCode(branch.mnemonic.substr(1));
+  code[position].operands = code[jumpPosition].operands;
+  code.erase(code.begin() + jumpPosition);
+  return true;
+}
+
+// jmp/jcc L; L:
+bool Peephole::removeJumpToNext(Peephole&, std::vector<Instruction>& code, size_t position) {
+  std::string target = code[position].jumpTarget();
+  if (target.empty()) return false;
+
+  for (size_t i = position + 1; i < code.size() && !code[i].isInstruction(); ++i) {
+    if (code[i].type == Instruction::Type::LABEL && code[i].mnemonic == target) {
+      code.erase(code.begin() + position);
+      return true;
+    }
+  }
+  return false;
+}
+
+// jmp/ret; anything up to a label that is jumped to
+bool Peephole::removeUnreachable(Peephole&, std::vector<Instruction>& code, size_t position) {
+  if (!code[position].isBarrier()) return false;
+
+  for (size_t i = position + 1; i < code.size(); ++i) {
+    const Instruction& next = code[i];
+    if (next.type == Instruction::Type::COMMENT
+        || (next.type == Instruction::Type::DIRECTIVE && next.mnemonic.compare(0, 5, "align") == 0)) {
+      continue;
+    }
+
+    // Only the generator's own labels; a procedure's can be called from anywhere
+    bool isDeadLabel = next.type == Instruction::Type::LABEL && next.mnemonic.compare(0, 4, "_lbl") == 0
+        && !isReferenced(code, next.mnemonic);
+    if (next.isInstruction() || isDeadLabel) {
+      code.erase(code.begin() + i);
+      return true;
+    }
+    break;
+  }
+  return false;
+}
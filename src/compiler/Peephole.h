@@ -0,0 +1,60 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_PEEPHOLE_H
+#define COMPILER_VISUALIZATION_PEEPHOLE_H
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "Instruction.h"
+
+class Peephole {
+public:
+  struct Rule {
+    std::string name;
+    // Tries to rewrite the window starting at code[position]; returns true if anything changed
+    std::function<bool(Peephole& peephole, std::vector<Instruction>& code, size_t position)> apply;
+  };
+
+private:
+  static const std::vector<Rule> rules;
+
+  // Procedures known to preserve callee saved registers across a call
+  const std::set<std::string>& abiCompliantProcedures;
+
+  std::map<std::string, unsigned int> hits;
+
+public:
+  explicit Peephole(const std::set<std::string>& abiCompliantProcedures);
+
+  // Rewrites `code` until no rule applies; returns the number of rewrites made
+  unsigned int run(std::vector<Instruction>& code);
+
+  const std::map<std::string, unsigned int>& getHits() const {
+    return hits;
+  }
+
+private:
+  static size_t nextInstruction(const std::vector<Instruction>& code, size_t position);
+  static size_t previousInstruction(const std::vector<Instruction>& code, size_t position);
+  static size_t findLabel(const std::vector<Instruction>& code, const std::string& name);
+  // Whether any instruction names `label`, so it can be jumped to
+  static bool isReferenced(const std::vector<Instruction>& code, const std::string& label);
+
+  static bool removeSelfMove(Peephole& peephole, std::vector<Instruction>& code, size_t position);
+  static bool removeOverwrittenMove(Peephole& peephole, std::vector<Instruction>& code, size_t position);
+  static bool branchOnFlags(Peephole& peephole, std::vector<Instruction>& code, size_t position);
+  static bool removeZeroBeforeSignExtend(Peephole& peephole, std::vector<Instruction>& code, size_t position);
+  static bool removePushPopPair(Peephole& peephole, std::vector<Instruction>& code, size_t position);
+  static bool removeCallSavePair(Peephole& peephole, std::vector<Instruction>& code, size_t position);
+  static bool threadJump(Peephole& peephole, std::vector<Instruction>& code, size_t position);
+  static bool invertBranchOverJump(Peephole& peephole, std::vector<Instruction>& code, size_t position);
+  static bool removeJumpToNext(Peephole& peephole, std::vector<Instruction>& code, size_t position);
+  static bool removeUnreachable(Peephole& peephole, std::vector<Instruction>& code, size_t position);
+};
+
+#endif //COMPILER_VISUALIZATION_PEEPHOLE_H
@@ -0,0 +1,200 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "ProcedureLayout.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cppcoreguidelines-pro-type-static-cast-downcast"
+
+ProcedureLayout::ProcedureLayout(ASTBlock* root, const Profile* profile)
+    : root(root), profile(profile) {
+}
+
+void ProcedureLayout::run() {
+  for (auto statement : root->statements) {
+    if (statement->type != ASTType::PROC_DECL) continue;
+    auto* procedure = static_cast<ASTProcedure*>(statement);
+    if (procedure->isExternal) continue;
+
+    procedures.push_back(procedure->ident);
+    if (!profile) {
+      weighCalls(procedure->block, procedure->ident, 1);
+    }
+  }
+
+  if (profile) {
+    std::set<std::string> called;
+    for (const auto& count : *profile) {
+      if (count.second == 0) continue;
+      addWeight(count.first.first, count.first.second, count.second);
+      called.insert(count.first.second);
+    }
+    for (const auto& procedure : procedures) {
+      if (procedure != "main" && !called.count(procedure)) {
+        cold.insert(procedure);
+      }
+    }
+  }
+
+  // Heaviest first, ties in declaration order
+  std::map<std::string, size_t> position;
+  for (size_t i = 0; i < procedures.size(); ++i) {
+    position[procedures[i]] = i;
+  }
+  std::vector<std::pair<std::pair<std::string, std::string>, unsigned long long>> edges;
+  for (const auto& edge : weights) {
+    if (position.count(edge.first.first) && position.count(edge.first.second)) {
+      edges.emplace_back(edge);
+    }
+  }
+  std::stable_sort(edges.begin(), edges.end(), [&position](const auto& a, const auto& b) {
+    if (a.second != b.second) return a.second > b.second;
+    return std::min(position.at(a.first.first), position.at(a.first.second))
+        < std::min(position.at(b.first.first), position.at(b.first.second));
+  });
+
+  std::vector<std::vector<std::string>> chains;
+  std::map<std::string, size_t> chainOf;
+  for (const auto& procedure : procedures) {
+    chainOf[procedure] = chains.size();
+    chains.push_back({procedure});
+  }
+
+  for (const auto& edge : edges) {
+    size_t a = chainOf.at(edge.first.first);
+    size_t b = chainOf.at(edge.first.second);
+    if (a == b) continue;
+    if (a > b) std::swap(a, b);
+
+    std::vector<std::string>& first = chains[a];
+    std::vector<std::string>& second = chains[b];
+
+    // Of the four ways of joining them, the one with the heaviest pair of procedures at the join
+    unsigned long long best = weightBetween(first.back(), second.front());
+    bool reverseFirst = false;
+    bool reverseSecond = false;
+    unsigned long long candidate = weightBetween(first.back(), second.back());
+    if (candidate > best) {
+      best = candidate;
+      reverseSecond = true;
+    }
+    candidate = weightBetween(first.front(), second.front());
+    if (candidate > best) {
+      best = candidate;
+      reverseFirst = true;
+      reverseSecond = false;
+    }
+    candidate = weightBetween(first.front(), second.back());
+    if (candidate > best) {
+      reverseFirst = true;
+      reverseSecond = true;
+    }
+
+    if (reverseFirst) std::reverse(first.begin(), first.end());
+    if (reverseSecond) std::reverse(second.begin(), second.end());
+    for (const auto& procedure : second) {
+      chainOf[procedure] = a;
+    }
+    first.insert(first.end(), second.begin(), second.end());
+    second.clear();
+  }
+
+  // A chain's weight is that of every call edge touching it
+  std::vector<std::pair<unsigned long long, size_t>> ranked;
+  for (size_t i = 0; i < chains.size(); ++i) {
+    if (chains[i].empty()) continue;
+
+    unsigned long long total = 0;
+    for (const auto& edge : weights) {
+      auto first = chainOf.find(edge.first.first);
+      auto second = chainOf.find(edge.first.second);
+      if ((first != chainOf.end() && first->second == i) || (second != chainOf.end() && second->second == i)) {
+        total += edge.second;
+      }
+    }
+    ranked.emplace_back(total, i);
+  }
+  std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+    return a.first > b.first;
+  });
+
+  for (bool isColdPass : {false, true}) {
+    for (const auto& chain : ranked) {
+      for (const auto& procedure : chains[chain.second]) {
+        if (isCold(procedure) == isColdPass) {
+          order.push_back(procedure);
+        }
+      }
+    }
+  }
+}
+
+bool ProcedureLayout::readProfile(const std::string& filepath, Profile& profile, std::string& error) {
+  std::ifstream file(filepath);
+  if (!file) {
+    error = "Couldn't open profile " + filepath;
+    return false;
+  }
+
+  std::string line;
+  unsigned int lineNumber = 0;
+  while (std::getline(file, line)) {
+    lineNumber++;
+    std::stringstream ssLine(line);
+    std::string caller;
+    if (!(ssLine >> caller) || caller[0] == '#') continue;
+
+    std::string callee;
+    unsigned long long count;
+    std::string rest;
+    if (!(ssLine >> callee >> count) || ssLine >> rest) {
+      error = filepath + ":" + std::to_string(lineNumber) + " Expected \"caller callee count\"";
+      return false;
+    }
+    profile[{caller, callee}] += count;
+  }
+  return true;
+}
+
+void ProcedureLayout::weighCalls(ASTStatement* node, const std::string& caller, unsigned long long frequency) {
+  if (!node) return;
+  switch (node->type) {
+    case BLOCK:
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        weighCalls(statement, caller, frequency);
+      }
+      break;
+    case PROC_CALL:
+      addWeight(caller, static_cast<ASTProcedureCall*>(node)->ident, frequency);
+      break;
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      weighCalls(ifNode->trueStatement, caller, frequency);
+      weighCalls(ifNode->falseStatement, caller, frequency);
+      break;
+    }
+    case WHILE:
+      weighCalls(static_cast<ASTWhile*>(node)->body, caller,
+                 std::min(frequency * LOOP_CALL_WEIGHT, MAX_CALL_WEIGHT));
+      break;
+    default:
+      break;
+  }
+}
+
+void ProcedureLayout::addWeight(const std::string& a, const std::string& b, unsigned long long weight) {
+  if (a == b) return;
+  weights[std::minmax(a, b)] += weight;
+}
+
+unsigned long long ProcedureLayout::weightBetween(const std::string& a, const std::string& b) const {
+  if (a == b) return 0;
+  auto weight = weights.find(std::minmax(a, b));
+  return weight != weights.end() ? weight->second : 0;
+}
+
+#pragma clang diagnostic pop
@@ -0,0 +1,66 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_PROCEDURELAYOUT_H
+#define COMPILER_VISUALIZATION_PROCEDURELAYOUT_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "AST.h"
+
+// How many times more often a call inside a loop is assumed to run than one outside it
+#define LOOP_CALL_WEIGHT 10
+// Caps the static estimate, so deep loop nests can't overflow it
+#define MAX_CALL_WEIGHT 1000000000ULL
+
+// Orders procedures so the ones that call each other most end up next to each other in .text (Pettis and Hansen's
+// procedure placement). Every procedure starts in a chain of its own; the two chains joined by the heaviest call
+// edge are merged, with their ends facing each other chosen so the heavier pair of procedures is adjacent, until no
+// edge joins two chains. The chains are then placed heaviest first.
+//
+// Edge weights come from a profile of call counts when there is one, and are otherwise estimated from the loops
+// around each call. With a profile, procedures it never saw called (other than main) are cold, and are placed
+// after the rest in a section of their own.
+class ProcedureLayout {
+public:
+  // Calls counted, by caller and callee
+  typedef std::map<std::pair<std::string, std::string>, unsigned long long> Profile;
+
+private:
+  ASTBlock* root;
+  const Profile* profile;
+
+  std::vector<std::string> procedures; // Internal procedures, in declaration order
+  std::map<std::pair<std::string, std::string>, unsigned long long> weights; // Undirected, the lesser name first
+  std::vector<std::string> order;
+  std::set<std::string> cold;
+
+public:
+  // `profile` may be null
+  ProcedureLayout(ASTBlock* root, const Profile* profile);
+
+  void run();
+
+  // Every internal procedure, hot ones first
+  const std::vector<std::string>& getOrder() const {
+    return order;
+  }
+  bool isCold(const std::string& procedure) const {
+    return cold.count(procedure) > 0;
+  }
+
+  // Reads lines of "caller callee count"; blank lines and lines starting with # are skipped. On failure `error`
+  // says why.
+  static bool readProfile(const std::string& filepath, Profile& profile, std::string& error);
+
+private:
+  void weighCalls(ASTStatement* node, const std::string& caller, unsigned long long frequency);
+  void addWeight(const std::string& a, const std::string& b, unsigned long long weight);
+  unsigned long long weightBetween(const std::string& a, const std::string& b) const;
+};
+
+#endif //COMPILER_VISUALIZATION_PROCEDURELAYOUT_H
@@ -0,0 +1,619 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <algorithm>
+#include <climits>
+#include <set>
+#include <tuple>
+#include "RedundancyElimination.h"
+
+static bool fitsInSigned32(long long value) {
+  return value >= INT_MIN && value <= INT_MAX;
+}
+
+static bool overlaps(long long displacement, unsigned int bytes, long long otherDisplacement, unsigned int otherBytes) {
+  return displacement < otherDisplacement + (long long) otherBytes
+      && otherDisplacement < displacement + (long long) bytes;
+}
+
+// What a sign extending load reads back after `value` is stored in `bytes`
+static long long truncate(long long value, unsigned int bytes) {
+  if (bytes >= 8) return value;
+  unsigned int unused = 64 - 8 * bytes;
+  return (long long) ((unsigned long long) value << unused) >> unused;
+}
+
+static bool isFrameSlot(const Operand& memory) {
+  return (memory.reg == Register::RBP || memory.reg == Register::RSP) && memory.index == Register::NONE;
+}
+
+static bool isZeroingIdiom(const Instruction& instruction) {
+  return instruction.mnemonic == "xor" && instruction.operands.size() == 2
+      && instruction.operands[0].type == Operand::Type::REGISTER
+      && instruction.operands[0] == instruction.operands[1]
+      && instruction.operands[0].bytes >= 4;
+}
+
+static bool isCommutative(const std::string& operation) {
+  return operation == "add" || operation == "imul" || operation == "and" || operation == "or"
+      || operation == "xor" || operation == "sete" || operation == "setne";
+}
+
+RedundancyElimination::Value RedundancyElimination::Value::expression(const std::string& operation,
+                                                                      std::vector<Value> operands) {
+  if (isCommutative(operation)) {
+    std::sort(operands.begin(), operands.end());
+  }
+
+  Value expression;
+  expression.kind = Kind::EXPRESSION;
+  expression.operation = operation;
+  expression.operands = std::move(operands);
+  return expression;
+}
+
+bool RedundancyElimination::Value::fitsIn(unsigned int width) const {
+  if (width >= 8) return true;
+
+  switch (kind) {
+    case Kind::IMMEDIATE:
+      return truncate(value, width) == value;
+    case Kind::MEMORY:
+      return bytes <= width;
+    case Kind::REGISTER:
+      return false;
+    case Kind::EXPRESSION:
+      // Conditions are 0 or 1
+      return operation.compare(0, 3, "set") == 0;
+  }
+  return false;
+}
+
+bool RedundancyElimination::Value::dependsOn(Register r) const {
+  switch (kind) {
+    case Kind::IMMEDIATE:
+      return false;
+    case Kind::MEMORY:
+    case Kind::REGISTER:
+      return reg == r;
+    case Kind::EXPRESSION:
+      return std::any_of(operands.begin(), operands.end(), [r](const Value& operand) {
+        return operand.dependsOn(r);
+      });
+  }
+  return true;
+}
+
+bool RedundancyElimination::Value::dependsOn(
+    const std::function<bool(long long displacement, unsigned int bytes)>& isSlot) const {
+  switch (kind) {
+    case Kind::IMMEDIATE:
+    case Kind::REGISTER:
+      return false;
+    case Kind::MEMORY:
+      return isSlot(value, bytes);
+    case Kind::EXPRESSION:
+      return std::any_of(operands.begin(), operands.end(), [&isSlot](const Value& operand) {
+        return operand.dependsOn(isSlot);
+      });
+  }
+  return true;
+}
+
+bool RedundancyElimination::Value::operator<(const Value& other) const {
+  if (std::tie(kind, value, reg, bytes, operation)
+      != std::tie(other.kind, other.value, other.reg, other.bytes, other.operation)) {
+    return std::tie(kind, value, reg, bytes, operation)
+        < std::tie(other.kind, other.value, other.reg, other.bytes, other.operation);
+  }
+  return std::lexicographical_compare(operands.begin(), operands.end(),
+                                      other.operands.begin(), other.operands.end());
+}
+
+unsigned int RedundancyElimination::run(std::vector<Instruction>& code) {
+  rewrites = 0;
+  forgetAll();
+  incomingStates.clear();
+
+  // Labels jumped back to head a loop, so what is known on entry isn't known before the jumps are seen
+  std::set<std::string> seenLabels;
+  std::set<std::string> loopHeads;
+  for (const auto& instruction : code) {
+    if (instruction.type == Instruction::Type::LABEL) {
+      seenLabels.insert(instruction.mnemonic);
+    } else if (seenLabels.count(instruction.jumpTarget()) > 0) {
+      loopHeads.insert(instruction.jumpTarget());
+    }
+  }
+
+  // Nothing is known on entry to a procedure
+  bool fallsThrough = false;
+  for (size_t i = 0; i < code.size(); ++i) {
+    if (code[i].type == Instruction::Type::LABEL) {
+      const std::string& name = code[i].mnemonic;
+      auto incoming = incomingStates.find(name);
+      if (loopHeads.count(name) > 0 || (incoming == incomingStates.end() && !fallsThrough)) {
+        forgetAll();
+      } else if (incoming != incomingStates.end() && !fallsThrough) {
+        registerValues = incoming->second.registerValues;
+        slotValues = incoming->second.slotValues;
+      } else if (incoming != incomingStates.end()) {
+        meet(incoming->second);
+      }
+      fallsThrough = true;
+      continue;
+    }
+    if (!code[i].isInstruction()) continue;
+
+    std::string target = code[i].jumpTarget();
+    if (!target.empty() && loopHeads.count(target) == 0) {
+      auto incoming = incomingStates.find(target);
+      if (incoming == incomingStates.end()) {
+        incomingStates[target] = State{registerValues, slotValues};
+      } else {
+        mergeInto(incoming->second);
+      }
+    }
+    fallsThrough = !code[i].isBarrier();
+
+    if (trackMove(code, i)) continue;
+    if (trackComparison(code, i)) continue;
+
+    propagateOperands(code[i]);
+    if (trackOperation(code, i)) continue;
+    update(code[i]);
+  }
+
+  removeDeadMoves(code);
+
+  return rewrites;
+}
+
+void RedundancyElimination::hit(const std::string& name) {
+  hits[name]++;
+  rewrites++;
+}
+
+void RedundancyElimination::forgetAll() {
+  registerValues.clear();
+  slotValues.clear();
+}
+
+// Keeps only what `state` knows as well
+void RedundancyElimination::mergeInto(State& state) const {
+  for (auto it = state.registerValues.begin(); it != state.registerValues.end();) {
+    auto known = registerValues.find(it->first);
+    bool agrees = known != registerValues.end() && known->second == it->second;
+    it = agrees ? std::next(it) : state.registerValues.erase(it);
+  }
+  for (auto it = state.slotValues.begin(); it != state.slotValues.end();) {
+    auto known = slotValues.find(it->first);
+    bool agrees = known != slotValues.end() && known->second == it->second;
+    it = agrees ? std::next(it) : state.slotValues.erase(it);
+  }
+}
+
+void RedundancyElimination::meet(const State& state) {
+  State merged = state;
+  mergeInto(merged);
+  registerValues = merged.registerValues;
+  slotValues = merged.slotValues;
+}
+
+void RedundancyElimination::forgetRegister(Register reg) {
+  auto dependsOn = [reg](const Value& value) {
+    return value.dependsOn(reg);
+  };
+
+  registerValues.erase(reg);
+  for (auto it = registerValues.begin(); it != registerValues.end();) {
+    it = dependsOn(it->second) ? registerValues.erase(it) : std::next(it);
+  }
+  for (auto it = slotValues.begin(); it != slotValues.end();) {
+    it = dependsOn(it->second) ? slotValues.erase(it) : std::next(it);
+  }
+}
+
+void RedundancyElimination::forgetMemory(const Operand& memory, unsigned int bytes) {
+  // Only rbp relative slots can be told apart; anything else may alias all of them
+  bool isSlot = isFrameSlot(memory);
+  std::function<bool(long long, unsigned int)> isClobbered = [&](long long displacement, unsigned int width) {
+    return !isSlot || overlaps(displacement, width, memory.value, bytes);
+  };
+
+  for (auto it = registerValues.begin(); it != registerValues.end();) {
+    it = it->second.dependsOn(isClobbered) ? registerValues.erase(it) : std::next(it);
+  }
+  for (auto it = slotValues.begin(); it != slotValues.end();) {
+    bool clobbered = isClobbered(it->first.first, it->first.second) || it->second.dependsOn(isClobbered);
+    it = clobbered ? slotValues.erase(it) : std::next(it);
+  }
+}
+
+Register RedundancyElimination::findRegisterHolding(const Value& value, Register excluding) const {
+  for (const auto& entry : registerValues) {
+    if (entry.first != excluding && entry.second == value) {
+      return entry.first;
+    }
+  }
+  return Register::NONE;
+}
+
+bool RedundancyElimination::holds(Register reg, const Value& value) const {
+  auto it = registerValues.find(reg);
+  return it != registerValues.end() && it->second == value;
+}
+
+bool RedundancyElimination::trackMove(std::vector<Instruction>& code, size_t& position) {
+  Instruction& move = code[position];
+  if (move.operands.size() != 2 || move.operands[0].type != Operand::Type::REGISTER) return false;
+
+  Register reg = move.operands[0].reg;
+  const Operand& source = move.operands[1];
+
+  if (isZeroingIdiom(move)) {
+    Value zero;
+    if (holds(reg, zero)) {
+      code.erase(code.begin() + position);
+      position--;
+      hit("redundant-move");
+      return true;
+    }
+    forgetRegister(reg);
+    registerValues[reg] = zero;
+    return true;
+  }
+
+  // mov rX, [mem], and movsx / movsxd for narrow values
+  bool isExtending = move.mnemonic == "movsx" || move.mnemonic == "movsxd";
+  if ((move.mnemonic == "mov" || isExtending) && source.type == Operand::Type::MEMORY
+      && move.operands[0].bytes == 8) {
+    return trackLoad(code, position);
+  }
+
+  // mov rX, imm
+  if (move.mnemonic == "mov" && source.type == Operand::Type::IMMEDIATE && move.operands[0].bytes == 8) {
+    Value constant;
+    constant.value = source.value;
+    if (holds(reg, constant)) {
+      code.erase(code.begin() + position);
+      position--;
+      hit("redundant-move");
+      return true;
+    }
+    forgetRegister(reg);
+    registerValues[reg] = constant;
+    return true;
+  }
+
+  // mov rX, rY
+  if (move.mnemonic == "mov" && source.type == Operand::Type::REGISTER
+      && move.operands[0].bytes == 8 && source.bytes == 8 && source.reg != reg) {
+    Value copied;
+    copied.kind = Value::Kind::REGISTER;
+    copied.reg = source.reg;
+    auto known = registerValues.find(source.reg);
+    if (known != registerValues.end()) {
+      copied = known->second;
+    }
+
+    if (holds(reg, copied) || holds(source.reg, Value{Value::Kind::REGISTER, 0, reg})) {
+      code.erase(code.begin() + position);
+      position--;
+      hit("redundant-move");
+      return true;
+    }
+    if (copied.kind == Value::Kind::IMMEDIATE && fitsInSigned32(copied.value)) {
+      move.operands[1] = Operand(copied.value);
+      hit("propagated-constant");
+    } else if (copied.kind == Value::Kind::REGISTER && copied.reg != source.reg) {
+      move.operands[1] = Operand(copied.reg);
+      hit("propagated-copy");
+    }
+    forgetRegister(reg);
+    registerValues[reg] = copied;
+    return true;
+  }
+
+  // movsx rX, rYb / movsxd rX, eY truncate; that does nothing if the value already fits
+  bool isTruncation = isExtending && source.type == Operand::Type::REGISTER && move.operands[0].bytes == 8;
+  if (isTruncation) {
+    auto known = registerValues.find(source.reg);
+    if (known != registerValues.end() && known->second.fitsIn(source.bytes)) {
+      Value value = known->second;
+      if (source.reg == reg) {
+        code.erase(code.begin() + position);
+        position--;
+        hit("redundant-extension");
+        return true;
+      }
+      move.mnemonic = "mov";
+      move.operands = {Operand(reg), Operand(source.reg)};
+      hit("redundant-extension");
+      forgetRegister(reg);
+      registerValues[reg] = value;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool RedundancyElimination::trackLoad(std::vector<Instruction>& code, size_t& position) {
+  const Instruction& load = code[position];
+  Register reg = load.operands[0].reg;
+  const Operand& memory = load.operands[1];
+  unsigned int bytes = load.mnemonic == "mov" ? 8 : memory.bytes;
+
+  if (!isFrameSlot(memory)) {
+    update(code[position]);
+    return true;
+  }
+
+  Value inMemory;
+  inMemory.kind = Value::Kind::MEMORY;
+  inMemory.value = memory.value;
+  inMemory.reg = memory.reg;
+  inMemory.bytes = bytes;
+
+  // What was last stored there, if we still know it
+  Value loaded = inMemory;
+  auto stored = slotValues.find(Slot(memory.value, bytes));
+  if (stored != slotValues.end()) {
+    loaded = stored->second;
+  }
+
+  bool isRedundant = holds(reg, loaded) || holds(reg, inMemory)
+      || (loaded.kind == Value::Kind::REGISTER && loaded.reg == reg);
+
+  Instruction replacement = load;
+  replacement.mnemonic = "mov";
+  bool replace = false;
+  if (!isRedundant) {
+    Register holder = findRegisterHolding(loaded, reg);
+    if (holder == Register::NONE) {
+      holder = findRegisterHolding(inMemory, reg);
+    }
+
+    if (loaded.kind == Value::Kind::IMMEDIATE && fitsInSigned32(loaded.value)) {
+      replacement.operands = {Operand(reg), Operand(loaded.value)};
+      replace = true;
+    } else if (loaded.kind == Value::Kind::REGISTER) {
+      replacement.operands = {Operand(reg), Operand(loaded.reg)};
+      replace = true;
+    } else if (holder != Register::NONE) {
+      replacement.operands = {Operand(reg), Operand(holder)};
+      replace = true;
+    }
+  }
+
+  if (isRedundant) {
+    code.erase(code.begin() + position);
+    position--;
+    hit("redundant-load");
+    return true;
+  }
+
+  if (replace) {
+    code[position] = replacement;
+    hit("redundant-load");
+  }
+
+  forgetRegister(reg);
+  registerValues[reg] = loaded;
+  return true;
+}
+
+bool RedundancyElimination::valueOf(const Operand& operand, Value& value) const {
+  if (operand.type == Operand::Type::IMMEDIATE) {
+    value = Value();
+    value.value = operand.value;
+    return true;
+  }
+  if (operand.type != Operand::Type::REGISTER || operand.bytes != 8) return false;
+
+  auto known = registerValues.find(operand.reg);
+  if (known != registerValues.end()) {
+    value = known->second;
+  } else {
+    value = Value{Value::Kind::REGISTER, 0, operand.reg};
+  }
+  return true;
+}
+
+// add rX, src etc.: if another register already holds the result, copy it instead
+bool RedundancyElimination::trackOperation(std::vector<Instruction>& code, size_t& position) {
+  Instruction& operation = code[position];
+  const std::string& mnemonic = operation.mnemonic;
+  bool isTracked = mnemonic == "add" || mnemonic == "sub" || mnemonic == "imul" || mnemonic == "and"
+      || mnemonic == "or" || (mnemonic == "xor" && !isZeroingIdiom(operation));
+  if (!isTracked || operation.operands.size() != 2) return false;
+
+  const Operand& destination = operation.operands[0];
+  if (destination.type != Operand::Type::REGISTER || destination.bytes != 8) return false;
+  Register reg = destination.reg;
+
+  // The old value of the destination is about to go, so it has to be known by what it is
+  auto left = registerValues.find(reg);
+  Value right;
+  if (left == registerValues.end() || !valueOf(operation.operands[1], right)) return false;
+
+  Value result = Value::expression(mnemonic, {left->second, right});
+  if (result.dependsOn(reg)) return false;
+
+  Register holder = findRegisterHolding(result, reg);
+  if (holder != Register::NONE) {
+    operation.mnemonic = "mov";
+    operation.operands = {Operand(reg), Operand(holder)};
+    hit("common-subexpression");
+  }
+
+  forgetRegister(reg);
+  registerValues[reg] = result;
+  return true;
+}
+
+// cmp a, b; setcc rXb; movzx rX, rXb gives rX a value that can be reused like any other
+bool RedundancyElimination::trackComparison(std::vector<Instruction>& code, size_t& position) {
+  const Instruction& compare = code[position];
+  if (compare.mnemonic != "cmp" || compare.operands.size() != 2) return false;
+
+  auto nextInstruction = [&code](size_t from) {
+    size_t next = from + 1;
+    while (next < code.size() && code[next].type == Instruction::Type::COMMENT) next++;
+    return next;
+  };
+  size_t setPosition = nextInstruction(position);
+  if (setPosition >= code.size() || code[setPosition].mnemonic.compare(0, 3, "set") != 0) return false;
+  size_t extendPosition = nextInstruction(setPosition);
+  if (extendPosition >= code.size()) return false;
+
+  const Instruction& set = code[setPosition];
+  Instruction& extend = code[extendPosition];
+  if (extend.mnemonic != "movzx" || set.operands.size() != 1 || set.operands[0].type != Operand::Type::REGISTER
+      || !extend.operands[0].isRegister(set.operands[0].reg) || extend.operands[1] != set.operands[0]) {
+    return false;
+  }
+  Register reg = extend.operands[0].reg;
+
+  Value left;
+  Value right;
+  if (!valueOf(compare.operands[0], left) || !valueOf(compare.operands[1], right)) return false;
+  Value result = Value::expression(set.mnemonic, {left, right});
+  if (result.dependsOn(reg)) return false;
+
+  Register holder = findRegisterHolding(result, reg);
+  if (holder != Register::NONE) {
+    extend.mnemonic = "mov";
+    extend.operands = {Operand(reg), Operand(holder)};
+    hit("common-subexpression");
+
+    // The comparison itself is only needed if something after still reads the flags
+    size_t after = nextInstruction(extendPosition);
+    bool readsFlags = after < code.size() && (code[after].isConditionalJump()
+        || code[after].mnemonic.compare(0, 3, "set") == 0 || code[after].mnemonic.compare(0, 4, "cmov") == 0);
+    if (!readsFlags) {
+      code.erase(code.begin() + setPosition);
+      code.erase(code.begin() + position);
+      extendPosition -= 2;
+    }
+  }
+
+  forgetRegister(reg);
+  registerValues[reg] = result;
+  position = extendPosition;
+  return true;
+}
+
+// Replaces registers read by `instruction` with the constant or original register they are known to hold
+void RedundancyElimination::propagateOperands(Instruction& instruction) {
+  const std::string& mnemonic = instruction.mnemonic;
+  bool readsSource = mnemonic == "mov" || mnemonic == "add" || mnemonic == "sub" || mnemonic == "and"
+      || mnemonic == "or" || mnemonic == "cmp" || (mnemonic == "imul" && instruction.operands.size() == 2)
+      || (mnemonic == "xor" && !isZeroingIdiom(instruction));
+  if (!readsSource || instruction.operands.size() != 2) return;
+
+  Operand& destination = instruction.operands[0];
+  Operand& source = instruction.operands[1];
+  if (source.type != Operand::Type::REGISTER) return;
+
+  auto known = registerValues.find(source.reg);
+  if (known == registerValues.end()) return;
+  const Value& value = known->second;
+
+  if (value.kind == Value::Kind::REGISTER) {
+    source.reg = value.reg;
+    hit("propagated-copy");
+    return;
+  }
+
+  if (value.kind != Value::Kind::IMMEDIATE) return;
+  if (destination.type == Operand::Type::MEMORY && mnemonic == "mov") {
+    long long constant = truncate(value.value, source.bytes);
+    if (source.bytes == 8 && !fitsInSigned32(constant)) return;
+    if (destination.bytes == 0) {
+      destination.bytes = source.bytes;
+    }
+    source = Operand(constant);
+    hit("propagated-constant");
+  } else if (destination.type == Operand::Type::REGISTER && destination.bytes == 8 && source.bytes == 8
+      && fitsInSigned32(value.value)) {
+    source = Operand(value.value);
+    hit("propagated-constant");
+  }
+}
+
+void RedundancyElimination::update(const Instruction& instruction) {
+  if (instruction.registersRead() == ALL_REGISTERS_MASK) {
+    forgetAll();
+    return;
+  }
+
+  const std::string& mnemonic = instruction.mnemonic;
+  const auto& operands = instruction.operands;
+
+  RegisterMask modified = instruction.registersWritten();
+  bool writesFirstOperand = !operands.empty() && mnemonic != "cmp" && mnemonic != "test" && mnemonic != "push"
+      && mnemonic != "idiv" && mnemonic != "div" && !(mnemonic == "imul" && operands.size() == 1)
+      && !instruction.isConditionalJump() && !instruction.isUnconditionalJump() && mnemonic != "call";
+  if (writesFirstOperand && operands[0].type == Operand::Type::REGISTER) {
+    modified |= registerMask(operands[0].reg);
+  }
+  for (unsigned int r = 0; r <= Register::RSP; ++r) {
+    if (modified & (1u << r)) {
+      forgetRegister((Register) r);
+    }
+  }
+
+  if (writesFirstOperand && operands[0].type == Operand::Type::MEMORY) {
+    const Operand& memory = operands[0];
+    unsigned int bytes = memory.bytes;
+    if (bytes == 0) {
+      bool hasRegisterSource = operands.size() > 1 && operands[1].type == Operand::Type::REGISTER;
+      bytes = hasRegisterSource ? operands[1].bytes : 8;
+    }
+    forgetMemory(memory, bytes);
+
+    // Remember what the slot now holds, so it can be reused instead of reloaded
+    if (mnemonic == "mov" && isFrameSlot(memory) && operands.size() == 2) {
+      const Operand& source = operands[1];
+      if (source.type == Operand::Type::IMMEDIATE) {
+        Value constant;
+        constant.value = truncate(source.value, bytes);
+        slotValues[Slot(memory.value, bytes)] = constant;
+      } else if (source.type == Operand::Type::REGISTER) {
+        auto known = registerValues.find(source.reg);
+        if (known != registerValues.end() && known->second.fitsIn(bytes)) {
+          slotValues[Slot(memory.value, bytes)] = known->second;
+        } else if (bytes == 8) {
+          slotValues[Slot(memory.value, bytes)] = Value{Value::Kind::REGISTER, 0, source.reg};
+        }
+      }
+    }
+  }
+
+  if (instruction.isBarrier()) {
+    forgetAll();
+  }
+}
+
+// Moves into registers nothing reads, usually left behind by the propagation above
+void RedundancyElimination::removeDeadMoves(std::vector<Instruction>& code) {
+  for (size_t i = code.size(); i-- > 0;) {
+    const Instruction& instruction = code[i];
+    if (!instruction.isInstruction() || instruction.operands.empty()) continue;
+
+    bool isMove = instruction.mnemonic == "mov" || instruction.mnemonic == "movzx" || instruction.mnemonic == "movsx"
+        || instruction.mnemonic == "movsxd" || isZeroingIdiom(instruction)
+        || (instruction.mnemonic.compare(0, 3, "set") == 0 && instruction.operands.size() == 1);
+    if (!isMove || instruction.operands[0].type != Operand::Type::REGISTER) continue;
+
+    Register reg = instruction.operands[0].reg;
+    if (reg == Register::RBP || reg == Register::RSP) continue;
+    if (isRegisterLiveAfter(code, i, reg)) continue;
+
+    code.erase(code.begin() + i);
+    hit("dead-move");
+  }
+}
@@ -0,0 +1,109 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_REDUNDANCYELIMINATION_H
+#define COMPILER_VISUALIZATION_REDUNDANCYELIMINATION_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Instruction.h"
+
+// Forward dataflow tracking which value every register (and frame slot) holds. Reloads of values already in a
+// register are removed or turned into register moves, known constants and copies are propagated into the
+// instructions that read them, and values computed again are taken from the register already holding them
+// (value numbering). What is known flows through forward branches and is merged where they join; loop heads
+// start from nothing.
+class RedundancyElimination {
+public:
+  struct Value {
+    enum class Kind {
+      IMMEDIATE = 0,
+      MEMORY, // Sign extended load of `bytes` from [reg + value]
+      REGISTER, // Same 64 bits as reg
+      EXPRESSION, // Result of `operation` applied to `operands`
+    };
+
+    Kind kind = Kind::IMMEDIATE;
+    long long value = 0;
+    Register reg = Register::NONE;
+    unsigned int bytes = 8;
+    std::string operation;
+    std::vector<Value> operands;
+
+    static Value expression(const std::string& operation, std::vector<Value> operands);
+
+    // Whether the value is unchanged by truncating it to `width` bytes and sign extending it again
+    bool fitsIn(unsigned int width) const;
+    bool dependsOn(Register r) const;
+    bool dependsOn(const std::function<bool(long long displacement, unsigned int bytes)>& isSlot) const;
+
+    bool operator==(const Value& other) const {
+      return kind == other.kind && value == other.value && reg == other.reg && bytes == other.bytes
+          && operation == other.operation && operands == other.operands;
+    }
+    bool operator!=(const Value& other) const {
+      return !(*this == other);
+    }
+    bool operator<(const Value& other) const;
+  };
+
+private:
+  // Frame slot as (displacement from the frame base, width)
+  typedef std::pair<long long, unsigned int> Slot;
+
+  struct State {
+    std::map<Register, Value> registerValues;
+    std::map<Slot, Value> slotValues;
+  };
+
+  std::map<Register, Value> registerValues;
+  std::map<Slot, Value> slotValues;
+
+  // What is known on each forward jump to a label, merged over all of them
+  std::map<std::string, State> incomingStates;
+
+  std::map<std::string, unsigned int> hits;
+  unsigned int rewrites = 0;
+
+public:
+  // Rewrites `code` in a single forward pass; returns the number of rewrites made
+  unsigned int run(std::vector<Instruction>& code);
+
+  const std::map<std::string, unsigned int>& getHits() const {
+    return hits;
+  }
+
+private:
+  void forgetAll();
+  void mergeInto(State& state) const;
+  void meet(const State& state);
+  void forgetRegister(Register reg);
+  void forgetMemory(const Operand& memory, unsigned int bytes);
+
+  // A register other than `excluding` holding `value`, or NONE
+  Register findRegisterHolding(const Value& value, Register excluding) const;
+  bool holds(Register reg, const Value& value) const;
+
+  // Each returns true if it has accounted for the instruction(s) at `position`, which is left on the last of them
+  bool trackMove(std::vector<Instruction>& code, size_t& position);
+  bool trackLoad(std::vector<Instruction>& code, size_t& position);
+
+  bool trackOperation(std::vector<Instruction>& code, size_t& position);
+  bool trackComparison(std::vector<Instruction>& code, size_t& position);
+
+  // Value of a register or immediate operand, or false if unknown
+  bool valueOf(const Operand& operand, Value& value) const;
+
+  void propagateOperands(Instruction& instruction);
+  void update(const Instruction& instruction);
+
+  void removeDeadMoves(std::vector<Instruction>& code);
+
+  void hit(const std::string& name);
+};
+
+#endif //COMPILER_VISUALIZATION_REDUNDANCYELIMINATION_H
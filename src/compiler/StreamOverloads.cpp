@@ -92,6 +92,18 @@ std::ostream& operator<<(std::ostream& os, const Token::Type& type) {
     case Token::Type::TOKEN_KEYWORD_INT:
       os << "KEYWORD_INT";
       break;
+    case Token::Type::TOKEN_KEYWORD_I8:
+      os << "KEYWORD_I8";
+      break;
+    case Token::Type::TOKEN_KEYWORD_I16:
+      os << "KEYWORD_I16";
+      break;
+    case Token::Type::TOKEN_KEYWORD_I32:
+      os << "KEYWORD_I32";
+      break;
+    case Token::Type::TOKEN_KEYWORD_I64:
+      os << "KEYWORD_I64";
+      break;
     case Token::Type::TOKEN_KEYWORD_VOID:
       os << "KEYWORD_VOID";
       break;
@@ -257,8 +269,17 @@ std::ostream& operator<<(std::ostream& os, const DataType& dataType) {
     case DataType::VOID:
       os << "VOID";
       break;
-    case DataType::INT:
-      os << "INT";
+    case DataType::I8:
+      os << "I8";
+      break;
+    case DataType::I16:
+      os << "I16";
+      break;
+    case DataType::I32:
+      os << "I32";
+      break;
+    case DataType::I64:
+      os << "I64";
       break;
   }
   return os;
@@ -299,9 +320,24 @@ std::ostream& operator<<(std::ostream& os, const Register& reg) {
     case R11:
       os << "r11";
       break;
+    case R12:
+      os << "r12";
+      break;
+    case R13:
+      os << "r13";
+      break;
+    case R14:
+      os << "r14";
+      break;
     case R15:
       os << "r15";
       break;
+    case RBP:
+      os << "rbp";
+      break;
+    case RSP:
+      os << "rsp";
+      break;
     default:
       os << "UNKNOWN_REGISTER(" << (int)reg << ")";
       break;
@@ -0,0 +1,158 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <algorithm>
+#include "TailCalls.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cppcoreguidelines-pro-type-static-cast-downcast"
+
+TailCalls::TailCalls(ASTBlock* root)
+    : root(root) {
+}
+
+void TailCalls::run() {
+  for (auto statement : root->statements) {
+    if (statement->type != ASTType::PROC_DECL) continue;
+    auto* procedure = static_cast<ASTProcedure*>(statement);
+    if (procedure->isExternal) continue;
+
+    ASTStatement* body = procedure->block;
+    std::vector<ASTStatement**> calls;
+    find(body, calls);
+    calls.erase(std::remove_if(calls.begin(), calls.end(), [procedure](ASTStatement** slot) {
+      auto* call = static_cast<ASTProcedureCall*>(*slot);
+      return call->ident != procedure->ident || call->parameters.size() != procedure->parameters.size();
+    }), calls.end());
+    if (calls.empty()) continue;
+
+    // Parameters are assigned by name at the calls, so none can be hidden by a local of the same name
+    bool isShadowed = false;
+    std::vector<ASTStatement*> pending(procedure->block->statements.begin(), procedure->block->statements.end());
+    while (!pending.empty()) {
+      ASTStatement* node = pending.back();
+      pending.pop_back();
+      switch (node->type) {
+        case BLOCK: {
+          auto& statements = static_cast<ASTBlock*>(node)->statements;
+          pending.insert(pending.end(), statements.begin(), statements.end());
+          break;
+        }
+        case VARIABLE_DECL:
+          isShadowed |= std::any_of(procedure->parameters.begin(), procedure->parameters.end(),
+                                    [node](ASTVariableDeclaration* parameter) {
+                                      return parameter->ident == static_cast<ASTVariableDeclaration*>(node)->ident;
+                                    });
+          break;
+        case IF: {
+          auto* ifNode = static_cast<ASTIf*>(node);
+          pending.push_back(ifNode->trueStatement);
+          if (ifNode->falseStatement) {
+            pending.push_back(ifNode->falseStatement);
+          }
+          break;
+        }
+        case WHILE:
+          pending.push_back(static_cast<ASTWhile*>(node)->body);
+          break;
+        default:
+          break;
+      }
+    }
+    if (isShadowed) continue;
+
+    for (auto slot : calls) {
+      *slot = loopBack(static_cast<ASTProcedureCall*>(*slot), procedure);
+    }
+
+    // Running off the end of the body still returns
+    auto* loopBody = new ASTBlock();
+    loopBody->nodeId = procedure->block->nodeId;
+    loopBody->parent = procedure->block;
+    loopBody->statements = procedure->block->statements;
+    auto* exit = new ASTBreak();
+    exit->nodeId = procedure->block->nodeId;
+    loopBody->statements.push_back(exit);
+
+    auto* always = new ASTLiteral();
+    always->nodeId = procedure->block->nodeId;
+    always->valueType = ASTLiteral::ValueType::INTEGER;
+    always->value.integerData = 1;
+
+    auto* loop = new ASTWhile();
+    loop->nodeId = procedure->block->nodeId;
+    loop->conditional = always;
+    loop->body = loopBody;
+    procedure->block->statements = {loop};
+
+    loops.push_back(procedure->ident);
+  }
+}
+
+void TailCalls::find(ASTStatement*& node, std::vector<ASTStatement**>& calls) {
+  switch (node->type) {
+    case BLOCK: {
+      auto* block = static_cast<ASTBlock*>(node);
+      if (!block->statements.empty()) {
+        find(block->statements.back(), calls);
+      }
+      break;
+    }
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      find(ifNode->trueStatement, calls);
+      if (ifNode->falseStatement) {
+        find(ifNode->falseStatement, calls);
+      }
+      break;
+    }
+    case PROC_CALL:
+      calls.push_back(&node);
+      break;
+    default:
+      break;
+  }
+}
+
+// Every argument is evaluated before any parameter is assigned, as they would have been for the call
+ASTBlock* TailCalls::loopBack(ASTProcedureCall* call, ASTProcedure* procedure) {
+  auto* block = new ASTBlock();
+  block->nodeId = call->nodeId;
+
+  std::vector<ASTStatement*> assignments;
+  for (size_t i = 0; i < procedure->parameters.size(); ++i) {
+    ASTVariableDeclaration* parameter = procedure->parameters[i];
+    ASTExpression* argument = call->parameters[i];
+
+    // Passed on unchanged
+    if (argument->type == ASTType::VARIABLE && static_cast<ASTVariableIdent*>(argument)->ident == parameter->ident) {
+      continue;
+    }
+
+    auto* next = new ASTVariableDeclaration();
+    next->nodeId = call->nodeId;
+    next->dataType = parameter->dataType;
+    next->ident = parameter->ident + ".next";
+    next->initialValueExpression = argument;
+    block->statements.push_back(next);
+
+    auto* value = new ASTVariableIdent();
+    value->nodeId = call->nodeId;
+    value->ident = next->ident;
+
+    auto* assignment = new ASTVariableAssignment();
+    assignment->nodeId = call->nodeId;
+    assignment->ident = parameter->ident;
+    assignment->newValueExpression = value;
+    assignments.push_back(assignment);
+  }
+  block->statements.insert(block->statements.end(), assignments.begin(), assignments.end());
+
+  auto* again = new ASTContinue();
+  again->nodeId = call->nodeId;
+  block->statements.push_back(again);
+  return block;
+}
+
+#pragma clang diagnostic pop
@@ -0,0 +1,42 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_TAILCALLS_H
+#define COMPILER_VISUALIZATION_TAILCALLS_H
+
+#include <string>
+#include <vector>
+#include "AST.h"
+
+// Calls in tail position are the last thing their procedure does: the last statement of its block, or of either
+// branch of an if that is itself in tail position.
+//
+// A procedure calling itself there is turned into a loop, before anything else sees the tree:
+//   void f(int n) { ...; f(n - 1); }
+// becomes
+//   void f(int n) { while (1) { ...; { int n.next = n - 1; n = n.next; continue; } break; } }
+// Other tail calls are left to the generator, which tears the frame down and jumps to the callee instead.
+class TailCalls {
+private:
+  ASTBlock* root;
+  std::vector<std::string> loops;
+
+public:
+  explicit TailCalls(ASTBlock* root);
+
+  void run();
+
+  // Procedures whose recursive calls became a loop
+  const std::vector<std::string>& getLoops() const {
+    return loops;
+  }
+
+  // Collects the slot holding each call in tail position in `node`
+  static void find(ASTStatement*& node, std::vector<ASTStatement**>& calls);
+
+private:
+  static ASTBlock* loopBack(ASTProcedureCall* call, ASTProcedure* procedure);
+};
+
+#endif //COMPILER_VISUALIZATION_TAILCALLS_H
@@ -0,0 +1,51 @@
+//
+// Created on 2026/10/19.
+//
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int threads) {
+  workers.reserve(threads);
+  for (unsigned int i = 0; i < threads; ++i) {
+    workers.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    isStopping = true;
+  }
+  hasTask.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+  std::packaged_task<void()> packaged(std::move(task));
+  std::future<void> future = packaged.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push(std::move(packaged));
+  }
+  hasTask.notify_one();
+  return future;
+}
+
+void ThreadPool::work() {
+  while (true) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      hasTask.wait(lock, [this]() {
+        return isStopping || !tasks.empty();
+      });
+      // Only once the queue has drained
+      if (tasks.empty()) return;
+      task = std::move(tasks.front());
+      tasks.pop();
+    }
+    task();
+  }
+}
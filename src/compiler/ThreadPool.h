@@ -0,0 +1,44 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_THREADPOOL_H
+#define COMPILER_VISUALIZATION_THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// A fixed set of workers taking tasks off one queue in the order they were submitted. Destroying the pool waits
+// for the tasks already queued.
+class ThreadPool {
+  std::vector<std::thread> workers;
+  std::queue<std::packaged_task<void()>> tasks;
+
+  std::mutex mutex;
+  std::condition_variable hasTask;
+  bool isStopping = false;
+
+public:
+  explicit ThreadPool(unsigned int threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // The future rethrows anything the task throws
+  std::future<void> submit(std::function<void()> task);
+
+  size_t size() const {
+    return workers.size();
+  }
+
+private:
+  void work();
+};
+
+#endif //COMPILER_VISUALIZATION_THREADPOOL_H
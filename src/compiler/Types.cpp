@@ -9,14 +9,10 @@
 unsigned int bytesOf(DataType type) {
 //  return 8;
   switch (type) {
-    case DataType::INT: return 1;
-//    case DataType::S8: return 1;
-//    case DataType::U16: return 2;
-//    case DataType::S16: return 2;
-//    case DataType::U32: return 4;
-//    case DataType::S32: return 4;
-//    case DataType::U64: return 8;
-//    case DataType::S64: return 8;
+    case DataType::I8: return 1;
+    case DataType::I16: return 2;
+    case DataType::I32: return 4;
+    case DataType::I64: return 8;
     case DataType::VOID: return 0;
     case DataType::UNINITIALISED: {
       std::cout << "Data type is uninitialised!" << std::endl;
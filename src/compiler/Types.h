@@ -9,7 +9,11 @@ enum class DataType {
   UNINITIALISED = 0,
 
   VOID,
-  INT,
+  // Signed integers; `int` is I32
+  I8,
+  I16,
+  I32,
+  I64,
 };
 std::ostream& operator<<(std::ostream& os, const DataType& type);
 
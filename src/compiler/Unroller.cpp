@@ -0,0 +1,408 @@
+//
+// Created on 2026/10/19.
+//
+
+#include <cstdint>
+#include "Unroller.h"
+#include "InstructionSelector.h"
+#include "Types.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cppcoreguidelines-pro-type-static-cast-downcast"
+
+// What a variable `bytes` wide holds after being given `value`
+static long long truncate(long long value, unsigned int bytes) {
+  if (bytes >= 8) return value;
+  unsigned int unused = 64 - 8 * bytes;
+  return (long long) ((unsigned long long) value << unused) >> unused;
+}
+
+static bool compare(long long left, ExpressionOperatorType op, long long right) {
+  switch (op) {
+    case ExpressionOperatorType::LESS_THAN:
+      return left < right;
+    case ExpressionOperatorType::LESS_THAN_OR_EQUAL:
+      return left <= right;
+    case ExpressionOperatorType::GREATER_THAN:
+      return left > right;
+    case ExpressionOperatorType::GREATER_THAN_OR_EQUAL:
+      return left >= right;
+    default:
+      return false;
+  }
+}
+
+static ASTLiteral* integerLiteral(unsigned long long value, unsigned long nodeId) {
+  auto* literal = new ASTLiteral();
+  literal->nodeId = nodeId;
+  literal->valueType = ASTLiteral::ValueType::INTEGER;
+  literal->value.integerData = value;
+  return literal;
+}
+
+Unroller::Unroller(ASTBlock* root, unsigned int factor, unsigned int budget)
+    : root(root), factor(factor), budget(budget) {
+}
+
+void Unroller::run() {
+  for (auto statement : root->statements) {
+    if (statement->type != ASTType::PROC_DECL) continue;
+    auto* declaration = static_cast<ASTProcedure*>(statement);
+    if (declaration->isExternal) continue;
+
+    procedure = declaration->ident;
+    scopes.emplace_back();
+    for (auto parameter : declaration->parameters) {
+      scopes.back()[parameter->ident] = parameter->dataType;
+    }
+    unrollBlock(declaration->block);
+    scopes.pop_back();
+  }
+}
+
+void Unroller::unrollLoops(ASTStatement*& node, ASTStatement* previous, ASTBlock* parent) {
+  switch (node->type) {
+    case BLOCK:
+      unrollBlock(static_cast<ASTBlock*>(node));
+      break;
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      unrollLoops(ifNode->trueStatement, nullptr, parent);
+      if (ifNode->falseStatement) {
+        unrollLoops(ifNode->falseStatement, nullptr, parent);
+      }
+      break;
+    }
+    case WHILE:
+      unrollBlock(static_cast<ASTWhile*>(node)->body);
+      unroll(node, previous, parent);
+      break;
+    default:
+      break;
+  }
+}
+
+void Unroller::unrollBlock(ASTBlock* block) {
+  scopes.emplace_back();
+  auto& statements = block->statements;
+  for (size_t i = 0; i < statements.size(); ++i) {
+    unrollLoops(statements[i], i > 0 ? statements[i - 1] : nullptr, block);
+    if (statements[i]->type == ASTType::VARIABLE_DECL) {
+      auto* declaration = static_cast<ASTVariableDeclaration*>(statements[i]);
+      scopes.back()[declaration->ident] = declaration->dataType;
+    }
+  }
+  scopes.pop_back();
+}
+
+void Unroller::unroll(ASTStatement*& node, ASTStatement* previous, ASTBlock* parent) {
+  auto* loop = static_cast<ASTWhile*>(node);
+
+  Decision decision;
+  decision.procedure = procedure;
+  CountedLoop counted;
+  if (!recognise(loop, counted, decision.outcome)) {
+    decisions.push_back(decision);
+    return;
+  }
+  decision.variable = counted.variable;
+
+  unsigned int size = sizeOf(loop->body);
+  unsigned int count;
+  bool isKnown = tripCount(counted, previous, count);
+
+  // Every iteration the loop could make is certain to fit the counter when the bound does
+  bool boundFits;
+  unsigned long long boundValue;
+  if (InstructionSelector::isIntegerLiteral(counted.bound, boundValue)) {
+    boundFits = truncate((long long) boundValue, counted.bytes) == (long long) boundValue;
+  } else {
+    const DataType* boundType = typeOf(static_cast<ASTVariableIdent*>(counted.bound)->ident);
+    boundFits = boundType && bytesOf(*boundType) <= counted.bytes;
+  }
+
+  if (isKnown && count * size <= budget) {
+    auto* block = new ASTBlock();
+    block->nodeId = loop->nodeId;
+    block->parent = parent;
+    for (unsigned int i = 0; i < count; ++i) {
+      block->statements.push_back(cloner.cloneBlock(loop->body, block));
+    }
+    node = block;
+
+    decision.isUnrolled = true;
+    decision.outcome = "fully unrolled, " + std::to_string(count) + " iterations";
+  } else if (factor < 2) {
+    decision.outcome = "unrolling is off";
+  } else if (counted.bytes == 8) {
+    decision.outcome = "64 bit counter could overflow looking ahead";
+  } else if (!boundFits) {
+    decision.outcome = "bound wider than the counter";
+  } else if ((factor + 1) * size > budget) {
+    decision.outcome = "too large (" + std::to_string(size) + " nodes)";
+  } else {
+    // i + (factor - 1) * step against the bound, so the copies only run while they all would have
+    auto* condition = static_cast<ASTBinOp*>(loop->conditional);
+    auto* ahead = new ASTBinOp();
+    ahead->nodeId = condition->nodeId;
+    ahead->op = counted.step > 0 ? ExpressionOperatorType::ADD : ExpressionOperatorType::MINUS;
+    auto* counter = new ASTVariableIdent();
+    counter->nodeId = condition->nodeId;
+    counter->ident = counted.variable;
+    ahead->left = counter;
+    unsigned long long distance = (factor - 1) * (unsigned long long) (counted.step > 0 ? counted.step : -counted.step);
+    ahead->right = integerLiteral(distance, condition->nodeId);
+
+    auto* check = new ASTBinOp();
+    check->nodeId = condition->nodeId;
+    check->op = counted.op;
+    check->left = ahead;
+    check->right = cloner.cloneExpression(counted.bound);
+
+    auto* block = new ASTBlock();
+    block->nodeId = loop->nodeId;
+    block->parent = parent;
+
+    auto* unrolled = new ASTWhile();
+    unrolled->nodeId = loop->nodeId;
+    unrolled->conditional = check;
+    unrolled->body = new ASTBlock();
+    unrolled->body->nodeId = loop->body->nodeId;
+    unrolled->body->parent = block;
+    for (unsigned int i = 0; i < factor; ++i) {
+      unrolled->body->statements.push_back(cloner.cloneBlock(loop->body, unrolled->body));
+    }
+
+    // What is left over
+    block->statements = {unrolled, loop};
+    node = block;
+
+    decision.isUnrolled = true;
+    decision.outcome = "unrolled by " + std::to_string(factor);
+  }
+  decisions.push_back(decision);
+}
+
+bool Unroller::recognise(ASTWhile* loop, CountedLoop& counted, std::string& reason) const {
+  reason = "not a counted loop";
+  if (loop->conditional->type != ASTType::BIN_OP) return false;
+  auto* condition = static_cast<ASTBinOp*>(loop->conditional);
+
+  // As `counter op bound`
+  ASTExpression* counter = condition->left;
+  counted.bound = condition->right;
+  counted.op = condition->op;
+  if (counter->type != ASTType::VARIABLE) {
+    std::swap(counter, counted.bound);
+    switch (counted.op) {
+      case ExpressionOperatorType::LESS_THAN:
+        counted.op = ExpressionOperatorType::GREATER_THAN;
+        break;
+      case ExpressionOperatorType::LESS_THAN_OR_EQUAL:
+        counted.op = ExpressionOperatorType::GREATER_THAN_OR_EQUAL;
+        break;
+      case ExpressionOperatorType::GREATER_THAN:
+        counted.op = ExpressionOperatorType::LESS_THAN;
+        break;
+      case ExpressionOperatorType::GREATER_THAN_OR_EQUAL:
+        counted.op = ExpressionOperatorType::LESS_THAN_OR_EQUAL;
+        break;
+      default:
+        break;
+    }
+  }
+  bool isUpwards = counted.op == ExpressionOperatorType::LESS_THAN
+      || counted.op == ExpressionOperatorType::LESS_THAN_OR_EQUAL;
+  bool isDownwards = counted.op == ExpressionOperatorType::GREATER_THAN
+      || counted.op == ExpressionOperatorType::GREATER_THAN_OR_EQUAL;
+  if (counter->type != ASTType::VARIABLE || (!isUpwards && !isDownwards)) return false;
+  counted.variable = static_cast<ASTVariableIdent*>(counter)->ident;
+
+  const DataType* type = typeOf(counted.variable);
+  if (!type || bytesOf(*type) == 0) return false;
+  counted.bytes = bytesOf(*type);
+
+  unsigned long long value;
+  if (counted.bound->type == ASTType::VARIABLE) {
+    const std::string& bound = static_cast<ASTVariableIdent*>(counted.bound)->ident;
+    if (bound == counted.variable || assigns(loop->body, bound)) {
+      reason = "bound changes in the loop";
+      return false;
+    }
+  } else if (!InstructionSelector::isIntegerLiteral(counted.bound, value)) {
+    return false;
+  }
+
+  // The body ends by stepping the counter by a literal
+  auto& statements = loop->body->statements;
+  if (statements.empty() || statements.back()->type != ASTType::VARIABLE_ASSIGNMENT) return false;
+  auto* increment = static_cast<ASTVariableAssignment*>(statements.back());
+  if (increment->ident != counted.variable || increment->newValueExpression->type != ASTType::BIN_OP) return false;
+  auto* stepping = static_cast<ASTBinOp*>(increment->newValueExpression);
+  auto isCounter = [&counted](ASTExpression* node) {
+    return node->type == ASTType::VARIABLE && static_cast<ASTVariableIdent*>(node)->ident == counted.variable;
+  };
+  if (stepping->op == ExpressionOperatorType::ADD && isCounter(stepping->left)
+      && InstructionSelector::isIntegerLiteral(stepping->right, value)) {
+    counted.step = (long long) value;
+  } else if (stepping->op == ExpressionOperatorType::ADD && isCounter(stepping->right)
+      && InstructionSelector::isIntegerLiteral(stepping->left, value)) {
+    counted.step = (long long) value;
+  } else if (stepping->op == ExpressionOperatorType::MINUS && isCounter(stepping->left)
+      && InstructionSelector::isIntegerLiteral(stepping->right, value)) {
+    counted.step = -(long long) value;
+  } else {
+    return false;
+  }
+  if (value == 0 || value > INT32_MAX || (isUpwards != (counted.step > 0))) {
+    reason = "steps away from its bound";
+    return false;
+  }
+
+  for (size_t i = 0; i + 1 < statements.size(); ++i) {
+    if (assigns(statements[i], counted.variable)) {
+      reason = "counter assigned in the body";
+      return false;
+    }
+    std::string blocked = blocker(statements[i], false);
+    if (!blocked.empty()) {
+      reason = blocked;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Unroller::tripCount(const CountedLoop& counted, ASTStatement* previous, unsigned int& count) const {
+  unsigned long long bound;
+  if (!previous || !InstructionSelector::isIntegerLiteral(counted.bound, bound)) return false;
+
+  ASTExpression* initial = nullptr;
+  if (previous->type == ASTType::VARIABLE_DECL
+      && static_cast<ASTVariableDeclaration*>(previous)->ident == counted.variable) {
+    initial = static_cast<ASTVariableDeclaration*>(previous)->initialValueExpression;
+  } else if (previous->type == ASTType::VARIABLE_ASSIGNMENT
+      && static_cast<ASTVariableAssignment*>(previous)->ident == counted.variable) {
+    initial = static_cast<ASTVariableAssignment*>(previous)->newValueExpression;
+  }
+  unsigned long long start;
+  if (!initial || !InstructionSelector::isIntegerLiteral(initial, start)) return false;
+
+  long long value = truncate((long long) start, counted.bytes);
+  count = 0;
+  while (compare(value, counted.op, (long long) bound)) {
+    if (++count > UNROLL_MAX_TRIP_COUNT) return false;
+    value = truncate(value + counted.step, counted.bytes);
+  }
+  return true;
+}
+
+const DataType* Unroller::typeOf(const std::string& ident) const {
+  for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+    auto variable = scope->find(ident);
+    if (variable != scope->end()) return &variable->second;
+  }
+  return nullptr;
+}
+
+unsigned int Unroller::sizeOf(ASTStatement* node) {
+  if (!node) return 0;
+  switch (node->type) {
+    case BLOCK: {
+      unsigned int size = 1;
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        size += sizeOf(statement);
+      }
+      return size;
+    }
+    case PROC_CALL: {
+      unsigned int size = 1;
+      for (auto parameter : static_cast<ASTProcedureCall*>(node)->parameters) {
+        size += sizeOf(parameter);
+      }
+      return size;
+    }
+    case VARIABLE_DECL:
+      return 1 + sizeOf(static_cast<ASTVariableDeclaration*>(node)->initialValueExpression);
+    case VARIABLE_ASSIGNMENT:
+      return 1 + sizeOf(static_cast<ASTVariableAssignment*>(node)->newValueExpression);
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      return 1 + sizeOf(ifNode->conditional) + sizeOf(ifNode->trueStatement) + sizeOf(ifNode->falseStatement);
+    }
+    case WHILE: {
+      auto* whileNode = static_cast<ASTWhile*>(node);
+      return 1 + sizeOf(whileNode->conditional) + sizeOf(whileNode->body);
+    }
+    default:
+      return 1;
+  }
+}
+
+unsigned int Unroller::sizeOf(ASTExpression* node) {
+  if (!node) return 0;
+  switch (node->type) {
+    case ASTType::BIN_OP:
+      return 1 + sizeOf(static_cast<ASTBinOp*>(node)->left) + sizeOf(static_cast<ASTBinOp*>(node)->right);
+    case ASTType::UNARY_OP:
+      return 1 + sizeOf(static_cast<ASTUnaryOp*>(node)->child);
+    default:
+      return 1;
+  }
+}
+
+std::string Unroller::blocker(ASTStatement* node, bool isNested) {
+  if (!node) return "";
+  switch (node->type) {
+    case BLOCK:
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        std::string blocked = blocker(statement, isNested);
+        if (!blocked.empty()) return blocked;
+      }
+      return "";
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      std::string blocked = blocker(ifNode->trueStatement, isNested);
+      return blocked.empty() ? blocker(ifNode->falseStatement, isNested) : blocked;
+    }
+    case WHILE:
+      return blocker(static_cast<ASTWhile*>(node)->body, true);
+    case PROC_CALL:
+      return "makes a call";
+    case PROC_DECL:
+      return "declares a procedure";
+    case RETURN:
+      return "returns";
+    case BREAK:
+      return isNested ? "" : "breaks out";
+    case CONTINUE:
+      return isNested ? "" : "continues";
+    default:
+      return "";
+  }
+}
+
+bool Unroller::assigns(ASTStatement* node, const std::string& ident) {
+  if (!node) return false;
+  switch (node->type) {
+    case BLOCK:
+      for (auto statement : static_cast<ASTBlock*>(node)->statements) {
+        if (assigns(statement, ident)) return true;
+      }
+      return false;
+    case VARIABLE_DECL:
+      return static_cast<ASTVariableDeclaration*>(node)->ident == ident;
+    case VARIABLE_ASSIGNMENT:
+      return static_cast<ASTVariableAssignment*>(node)->ident == ident;
+    case IF: {
+      auto* ifNode = static_cast<ASTIf*>(node);
+      return assigns(ifNode->trueStatement, ident) || assigns(ifNode->falseStatement, ident);
+    }
+    case WHILE:
+      return assigns(static_cast<ASTWhile*>(node)->body, ident);
+    default:
+      return false;
+  }
+}
+
+#pragma clang diagnostic pop
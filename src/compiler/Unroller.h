@@ -0,0 +1,82 @@
+//
+// Created on 2026/10/19.
+//
+
+#ifndef COMPILER_VISUALIZATION_UNROLLER_H
+#define COMPILER_VISUALIZATION_UNROLLER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "AST.h"
+#include "Cloner.h"
+
+// Most iterations simulated when working out a loop's trip count
+#define UNROLL_MAX_TRIP_COUNT 256
+
+// Unrolls counted loops, of the form
+//   while (i < n) { ...; i = i + step; }
+// where the comparison is <, <=, > or >=, the literal step moves i towards n, n is a literal or a variable the body
+// never assigns, and the rest of the body never assigns i, makes a call, breaks, continues or returns.
+//
+// When i is given a literal just before the loop and n is a literal, the trip count is known, and a loop whose
+// copies fit the budget is replaced by that many copies of its body. Otherwise the body is copied `factor` times
+// into a loop that only runs while that many more iterations are certain,
+//   while (i + (factor - 1) * step < n) { {...; i = i + step;} {...; i = i + step;} ... }
+// followed by the original loop for the iterations left over.
+class Unroller {
+public:
+  struct Decision {
+    std::string procedure;
+    std::string variable; // The loop's counter, when it has one
+    bool isUnrolled = false;
+    std::string outcome; // How it was unrolled, or why it wasn't
+  };
+
+private:
+  struct CountedLoop {
+    std::string variable;
+    ExpressionOperatorType op = ExpressionOperatorType::UNINITIALISED; // As `variable op bound`
+    ASTExpression* bound = nullptr;
+    long long step = 0;
+    unsigned int bytes = 0; // Width of the counter
+  };
+
+  ASTBlock* root;
+  unsigned int factor;
+  unsigned int budget; // Most AST nodes the copies of one loop may add up to
+  std::vector<Decision> decisions;
+
+  std::string procedure; // Being unrolled
+  std::vector<std::map<std::string, DataType>> scopes; // Variables visible at each level, innermost last
+  Cloner cloner;
+
+public:
+  Unroller(ASTBlock* root, unsigned int factor, unsigned int budget);
+
+  void run();
+
+  const std::vector<Decision>& getDecisions() const {
+    return decisions;
+  }
+
+private:
+  // Unrolls the loops in `node`, innermost first; `previous` is the statement before it in its block
+  void unrollLoops(ASTStatement*& node, ASTStatement* previous, ASTBlock* parent);
+  void unrollBlock(ASTBlock* block);
+  void unroll(ASTStatement*& node, ASTStatement* previous, ASTBlock* parent);
+
+  bool recognise(ASTWhile* loop, CountedLoop& counted, std::string& reason) const;
+  // How many times the loop runs, if `previous` gives the counter a literal and the bound is one
+  bool tripCount(const CountedLoop& counted, ASTStatement* previous, unsigned int& count) const;
+  const DataType* typeOf(const std::string& ident) const;
+
+  static unsigned int sizeOf(ASTStatement* node);
+  static unsigned int sizeOf(ASTExpression* node);
+  // Why `node` stops a loop it is in from being unrolled, or empty if it doesn't; `isNested` when inside a loop
+  // within it
+  static std::string blocker(ASTStatement* node, bool isNested);
+  static bool assigns(ASTStatement* node, const std::string& ident);
+};
+
+#endif //COMPILER_VISUALIZATION_UNROLLER_H
@@ -16,6 +16,9 @@ struct CliOptions {
   char* sourceFilepath = nullptr;
   char* destFilepath = nullptr;
   bool hasUI = true;
+  GeneratorOptions generatorOptions;
+  std::string optimisationLevel = "2";
+  std::vector<std::pair<Pass, bool>> passChanges; // --enable and --disable, applied over the level's passes
 };
 
 static CliOptions cliOptions;
@@ -74,7 +77,7 @@ int compileWorker(const std::function<void(const Data&)>& ready) {
   });
 
   try {
-    Generator generator(ready, root, cliOptions.destFilepath);
+    Generator generator(ready, root, cliOptions.destFilepath, cliOptions.generatorOptions);
     generator.generate();
   } catch (ThreadTerminateException&) {
     throw;
@@ -110,14 +113,68 @@ int main(int argc, char* argv[]) {
       }
     } else if (strcmp(argv[i], "--no-ui") == 0) {
       cliOptions.hasUI = false;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      if (i + 1 < argc) {
+        cliOptions.generatorOptions.profileFilepath = argv[++i];
+      } else {
+        std::cerr << "--profile option requires one arguments." << std::endl;
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--dump-dataflow") == 0) {
+      cliOptions.generatorOptions.dumpDataflow = true;
+    } else if (strncmp(argv[i], "-O", 2) == 0) {
+      PassSet passes;
+      if (!PassManager::preset(argv[i] + 2, passes)) {
+        std::cerr << "Unknown optimisation level " << argv[i] << ", expected -O0, -O1, -O2 or -Os." << std::endl;
+        return 1;
+      }
+      cliOptions.optimisationLevel = argv[i] + 2;
+    } else if (strcmp(argv[i], "--enable") == 0 || strcmp(argv[i], "--disable") == 0) {
+      Pass pass;
+      if (i + 1 >= argc || !PassManager::findPass(argv[i + 1], pass)) {
+        std::cerr << argv[i] << " option requires one pass name:";
+        for (size_t known = 0; known < TOTAL_PASSES; ++known) {
+          std::cerr << " " << PassManager::nameOf((Pass) known);
+        }
+        std::cerr << std::endl;
+        return 1;
+      }
+      cliOptions.passChanges.emplace_back(pass, strcmp(argv[i], "--enable") == 0);
+      i++;
+    } else if (strcmp(argv[i], "--time-passes") == 0) {
+      cliOptions.generatorOptions.timePasses = true;
+    } else if (strcmp(argv[i], "--unroll") == 0 || strcmp(argv[i], "--unroll-budget") == 0
+        || strcmp(argv[i], "--jobs") == 0) {
+      char* end = nullptr;
+      unsigned long value = i + 1 < argc ? strtoul(argv[i + 1], &end, 10) : 0;
+      if (i + 1 >= argc || end == argv[i + 1] || *end != '\0' || value == 0) {
+        std::cerr << argv[i] << " option requires one positive number." << std::endl;
+        return 1;
+      }
+      if (strcmp(argv[i], "--unroll") == 0) {
+        cliOptions.generatorOptions.unrollFactor = value;
+      } else if (strcmp(argv[i], "--unroll-budget") == 0) {
+        cliOptions.generatorOptions.unrollBudget = value;
+      } else {
+        cliOptions.generatorOptions.jobs = value;
+      }
+      i++;
     }
   }
 
   if (cliOptions.sourceFilepath == nullptr || cliOptions.destFilepath == nullptr) {
-    std::cerr << "Usage: cv -i <sourceFilepath> -o <destFilepath> [--no-ui]" << std::endl;
+    std::cerr << "Usage: cv -i <sourceFilepath> -o <destFilepath> [--no-ui] [--profile <profileFilepath>]"
+              << " [--unroll <factor>] [--unroll-budget <nodes>] [--dump-dataflow] [-O0|-O1|-O2|-Os]"
+              << " [--enable <pass>] [--disable <pass>] [--time-passes] [--jobs <threads>]" << std::endl;
     return 1;
   }
 
+  // The level picks the passes, whatever order the flags came in, then each --enable and --disable in turn
+  PassManager::preset(cliOptions.optimisationLevel, cliOptions.generatorOptions.passes);
+  for (const auto& change : cliOptions.passChanges) {
+    cliOptions.generatorOptions.passes.set((size_t) change.first, change.second);
+  }
+
   ThreadSync threadSync(cliOptions.hasUI, true, compileWorker);
 
   if (cliOptions.hasUI) {
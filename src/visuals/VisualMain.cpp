@@ -211,6 +211,9 @@ void VisualMain::init() {
   tblRegisters.add(g, "R11", "");
   tblRegisters.add(g, "RSI", "");
   tblRegisters.add(g, "RDI", "");
+  tblRegisters.add(g, "R12", "");
+  tblRegisters.add(g, "R13", "");
+  tblRegisters.add(g, "R14", "");
   tblRegisters.add(g, "R15", "");
 
   tblLocations.position = {(float) g->getWidth() + (float) g->getWidth() / 3, titleHeight + tblRegisters.frameSize.y};